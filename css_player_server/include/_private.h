@@ -29,6 +29,8 @@ void threadstorage_init(void);		/*!< Provided by threadstorage.c */
 //int css_event_init(void);		/*!< Provided by event.c */
 //int css_device_state_engine_init(void);	/*!< Provided by devicestate.c */
 int cssobj2_init(void);			/*!< Provided by cssobj2.c */
+int css_h264_init(void);		/*!< Provided by css_h264.c */
+int css_gmp_init(void);			/*!< Provided by css_gmp.c */
 //int css_file_init(void);		/*!< Provided by file.c */
 //int css_features_init(void);            /*!< Provided by features.c */
 //void css_autoservice_init(void);	/*!< Provided by autoservice.c */
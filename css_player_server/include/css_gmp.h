@@ -0,0 +1,86 @@
+/*
+ * File:   css_gmp.h
+ * Author: root
+ *
+ * GMP package header decoding.
+ *
+ * Every GMP datagram starts with a 27 byte header, multi byte fields
+ * little endian and not aligned:
+ *
+ *   0  5 bytes  reserved
+ *   5  u8       media type, 0x00 is H.264
+ *   6  u8       package type, see enum css_gmp_package_type
+ *   7  u32      stream id
+ *  11  u32      sequence number, 0 ~ 65535
+ *  15  u32      package length, header included
+ *  19  u32      timestamp, seconds
+ *  23  u32      timestamp, nanoseconds
+ *
+ * The payload follows the header.  A datagram may be longer than the
+ * package length it announces, never shorter.
+ */
+
+#ifndef CSS_GMP_H
+#define	CSS_GMP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#define CSS_GMP_HEADER_LEN 27
+#define CSS_GMP_SEQ_MAX 65536
+#define CSS_GMP_MEDIA_H264 0x00
+
+/*! \brief Package types, a frame is begin, other..., end or a single only */
+enum css_gmp_package_type {
+    CSS_GMP_FRAME_BEGIN = 0x40,
+    CSS_GMP_FRAME_OTHER = 0x41,
+    CSS_GMP_FRAME_END = 0x42,
+    CSS_GMP_FRAME_ONLY = 0x43,
+};
+
+/*! \brief css_gmp_parse() results */
+enum css_gmp_parse_result {
+    CSS_GMP_PARSE_OK = 0,
+    CSS_GMP_PARSE_SHORT = -1,       /*!< shorter than a header */
+    CSS_GMP_PARSE_LENGTH = -2,      /*!< package length below the header length */
+    CSS_GMP_PARSE_TRUNCATED = -3,   /*!< package length beyond the datagram */
+    CSS_GMP_PARSE_TYPE = -4,        /*!< unknown package type */
+    CSS_GMP_PARSE_SEQ = -5,         /*!< sequence number out of range */
+};
+#define CSS_GMP_PARSE_RESULTS 6
+
+/*! \brief A decoded package header */
+struct css_gmp_header {
+    unsigned char media;
+    unsigned char type;             /*!< enum css_gmp_package_type */
+    uint32_t stream_id;
+    uint32_t seq;
+    uint32_t length;                /*!< package length, header included */
+    uint32_t sec;
+    uint32_t nsec;
+};
+
+/*!
+ * \brief Decode and check the header of a package.
+ *
+ * Reads nothing beyond \a len bytes of \a buf, which needs no alignment.
+ * The media type is decoded but not checked, the caller decides what it
+ * can play.
+ *
+ * \return CSS_GMP_PARSE_OK with \a hdr filled in, or the reason the
+ * package can not be used
+ */
+int css_gmp_parse(const void *buf, size_t len, struct css_gmp_header *hdr);
+
+/*! \brief Text for a css_gmp_parse() result */
+const char *css_gmp_parse_str(int result);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* CSS_GMP_H */
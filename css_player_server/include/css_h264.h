@@ -0,0 +1,96 @@
+/*
+ * File:   css_h264.h
+ * Author: root
+ *
+ * H.264 Annex B bitstream scanning.
+ *
+ * Finds the 00 00 01 start codes of a byte stream and splits it into NAL
+ * units.  The start code search uses SSE2 or AVX2 when the CPU has them
+ * and falls back to a scalar search otherwise.
+ */
+
+#ifndef CSS_H264_H
+#define	CSS_H264_H
+
+#include <stddef.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*! \name nal_unit_type values, ITU-T H.264 table 7-1 */
+/*@{*/
+#define CSS_H264_NAL_SLICE  1   /*!< coded slice of a non-IDR picture */
+#define CSS_H264_NAL_IDR    5   /*!< coded slice of an IDR picture */
+#define CSS_H264_NAL_SEI    6
+#define CSS_H264_NAL_SPS    7
+#define CSS_H264_NAL_PPS    8
+#define CSS_H264_NAL_AUD    9
+/*@}*/
+
+/*! \name css_h264_frame_info() flags */
+/*@{*/
+#define CSS_H264_HAS_SLICE  (1 << 0)    /*!< a coded picture follows the headers */
+#define CSS_H264_HAS_IDR    (1 << 1)    /*!< that picture is an IDR picture */
+#define CSS_H264_HAS_SPS    (1 << 2)
+#define CSS_H264_HAS_PPS    (1 << 3)
+#define CSS_H264_HAS_SEI    (1 << 4)
+/*@}*/
+
+/*! \brief One NAL unit of a buffer */
+struct css_h264_nal {
+    size_t offset;      /*!< offset of the NAL header byte */
+    size_t len;         /*!< bytes from the header byte on, trailing zero bytes excluded */
+    int type;           /*!< nal_unit_type */
+};
+
+/*! \brief Start code search implementations */
+enum css_h264_scanner {
+    CSS_H264_SCAN_AUTO,     /*!< the fastest one the CPU supports */
+    CSS_H264_SCAN_SCALAR,
+    CSS_H264_SCAN_SSE2,
+    CSS_H264_SCAN_AVX2,
+};
+
+/*!
+ * \brief Find the next 00 00 01 start code.
+ *
+ * \return the first byte of the start code, \a end if there is none
+ */
+const unsigned char *css_h264_find_start(const unsigned char *p, const unsigned char *end);
+
+/*!
+ * \brief Split an Annex B buffer into NAL units.
+ *
+ * Bytes before the first start code are skipped.
+ *
+ * \return the number of NAL units found, at most \a max are stored
+ */
+int css_h264_split(const unsigned char *data, size_t len, struct css_h264_nal *nals, int max);
+
+/*!
+ * \brief Tell what an access unit holds.
+ *
+ * Looks at the NAL units up to the first coded slice only.  Parameter
+ * sets and SEI come before it, and the slice data after it is not scanned.
+ *
+ * \return CSS_H264_HAS_* flags
+ */
+unsigned int css_h264_frame_info(const unsigned char *data, size_t len);
+
+/*!
+ * \brief Select the start code search implementation.
+ *
+ * \retval 0 on success
+ * \retval -1 if the CPU does not support it, the current one is kept
+ */
+int css_h264_set_scanner(enum css_h264_scanner scanner);
+
+/*! \brief Name of the start code search implementation in use */
+const char *css_h264_scanner_name(void);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* CSS_H264_H */
@@ -8,6 +8,9 @@
 #ifndef CSS_MONITOR_H
 #define	CSS_MONITOR_H
 
+#include <stddef.h>
+#include <stdint.h>
+#include <netinet/in.h>
 
 #ifdef	__cplusplus
 extern "C" {
@@ -16,6 +19,39 @@ extern "C" {
     void *css_monitor_init(void *data);
     void *css_monitor_udp_init(void *data);
 
+    /*! \brief Output counters of a replay, summed over its streams */
+    struct css_monitor_replay_stats {
+        unsigned int streams;
+        uint64_t packets;           /*!< packages put out in order */
+        uint64_t gaps;
+        uint64_t lost;              /*!< packages skipped over by gaps */
+        uint64_t dups;
+        uint64_t late;              /*!< packages behind the window, thrown away */
+        uint64_t frames;
+        uint64_t frames_dropped;
+    };
+
+    /*!
+     * \brief Offline replay of GMP datagrams through the ingest pipeline.
+     *
+     * Sets up one worker without sockets, fed from memory, which runs the
+     * same reorder, assembly and recording code as a live worker and
+     * writes its recordings to \a outdir.  For benchmarks, not to be used
+     * while css_monitor_udp_init() runs.
+     *
+     * \retval 0 on success, -1 on failure
+     */
+    int css_monitor_replay_start(const char *outdir, int reorder_timeout);
+
+    /*! \brief Hand one datagram to the replay worker, as received from \a from */
+    void css_monitor_replay_feed(const struct sockaddr_in *from, const void *data, size_t len);
+
+    /*!
+     * \brief Put out what the reorder windows still hold, stop the replay
+     * worker and wait for the recordings to be written.
+     */
+    void css_monitor_replay_stop(struct css_monitor_replay_stats *stats);
+
 #ifdef	__cplusplus
 }
 #endif
@@ -0,0 +1,106 @@
+/*
+ * File:   css_recorder.h
+ * Author: root
+ *
+ * Asynchronous recording writer.
+ *
+ * Network threads hand recorded bytes to a dedicated writer thread through
+ * a pair of lock-free chunk stacks per producer, so the receive loop never
+ * waits on storage: filled chunks go to the writer on the full stack and
+ * come back on the free stack.  Only the producer pushes onto its full
+ * stack and only the writer onto the free one; each side takes the other
+ * stack whole.  Bytes are coalesced into large page-aligned chunks which
+ * the writer thread writes with writev().
+ */
+
+#ifndef CSS_RECORDER_H
+#define	CSS_RECORDER_H
+
+#include <sys/types.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*! \brief Open recording files with O_DIRECT, bypassing the page cache */
+#define CSS_RECORDER_DIRECT (1 << 0)
+
+struct css_recorder;
+struct css_recorder_sink;
+
+/*!
+ * \brief Start a writer thread.
+ *
+ * \param producers number of producer threads; each one gets its own queue
+ * \param chunk_size bytes per chunk, rounded up to a multiple of the page size
+ * \param chunks maximum chunks in flight per producer; every open sink may
+ *        hold one more partly filled chunk, so a producer uses at most
+ *        chunks plus its open sinks times \a chunk_size bytes
+ * \param prealloc bytes to reserve ahead of the write offset with fallocate(), 0 to disable
+ * \param flags CSS_RECORDER_* flags
+ *
+ * \retval the recorder, stop it with css_recorder_stop()
+ * \retval NULL on failure
+ */
+struct css_recorder *css_recorder_start(int producers, size_t chunk_size, int chunks, off_t prealloc, unsigned int flags);
+
+/*!
+ * \brief Write out everything queued and stop the writer thread.
+ *
+ * All sinks must have been closed by their producers.
+ */
+void css_recorder_stop(struct css_recorder *rec);
+
+/*!
+ * \brief Open a file for appending.
+ *
+ * \param producer queue the sink is fed through; only that producer thread
+ *        may use the sink afterwards
+ *
+ * \retval NULL if the file can not be opened
+ */
+struct css_recorder_sink *css_recorder_open(struct css_recorder *rec, int producer, const char *filename);
+
+/*!
+ * \brief Append \a len bytes to a sink.
+ *
+ * Never blocks.  The bytes are copied into the current chunk of the sink;
+ * a chunk is queued to the writer when it is full.  If the writer has
+ * fallen so far behind that no chunk is free, the bytes are dropped.
+ *
+ * \retval 0 on success
+ * \retval -1 if the bytes were dropped
+ */
+int css_recorder_write(struct css_recorder_sink *sink, const void *data, size_t len);
+
+/*!
+ * \brief File offset the next byte written to a sink will land at.
+ *
+ * Counts the bytes accepted by css_recorder_write(), whether or not the
+ * writer has written them yet.  A write that returned -1 may have been
+ * accepted in part.
+ */
+off_t css_recorder_tell(struct css_recorder_sink *sink);
+
+/*!
+ * \brief Queue the partly filled chunk of a sink.
+ *
+ * Call periodically so a quiet sink still reaches the disk.  Sinks opened
+ * with CSS_RECORDER_DIRECT keep partial chunks until they fill up or the
+ * sink is closed, as O_DIRECT writes have to be block aligned.
+ */
+void css_recorder_flush(struct css_recorder_sink *sink);
+
+/*!
+ * \brief Queue the rest of a sink and close it.
+ *
+ * The writer thread closes the file once everything queued is written;
+ * the sink must not be used afterwards.
+ */
+void css_recorder_close(struct css_recorder_sink *sink);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* CSS_RECORDER_H */
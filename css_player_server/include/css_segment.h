@@ -0,0 +1,102 @@
+/*
+ * File:   css_segment.h
+ * Author: root
+ *
+ * Segmented recording index.
+ *
+ * A stream recorded in segments is a series of Annex B files, each
+ * starting with a key frame.  Every segment has a side index file with
+ * one fixed size record per frame: timestamp, offset of the frame in the
+ * segment, size and whether it is an IDR frame.  Records are in recording
+ * order, so a time is found with a binary search over the index instead
+ * of scanning the segment.
+ *
+ * Index layout, all fields little endian:
+ *
+ *   header: "CSSSIDX1", u32 version, u32 record size
+ *   record: u32 sec, u32 nsec, u32 offset, u32 size | CSS_SEGMENT_IDR
+ */
+
+#ifndef CSS_SEGMENT_H
+#define	CSS_SEGMENT_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#define CSS_SEGMENT_MAGIC "CSSSIDX1"
+#define CSS_SEGMENT_VERSION 1
+#define CSS_SEGMENT_IDR (1U << 31)     /*!< record flag: the frame is an IDR frame */
+#define CSS_SEGMENT_SIZE_MAX (CSS_SEGMENT_IDR - 1)
+
+/*! \brief Index file header, as stored */
+struct css_segment_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+};
+
+/*! \brief Index record, as stored */
+struct css_segment_record {
+    uint32_t sec;
+    uint32_t nsec;
+    uint32_t offset;
+    uint32_t size;          /*!< frame bytes, CSS_SEGMENT_IDR or'ed in */
+};
+
+/*! \brief A decoded index record */
+struct css_segment_frame {
+    unsigned int sec;
+    unsigned int nsec;
+    off_t offset;           /*!< of the frame in the segment file */
+    size_t size;
+    int idr;
+};
+
+struct css_segment_index;
+
+/*! \brief Fill in the header a new index file starts with */
+void css_segment_header_init(struct css_segment_header *hdr);
+
+/*! \brief Encode one index record */
+void css_segment_record_pack(struct css_segment_record *rec, const struct css_segment_frame *frame);
+
+/*!
+ * \brief Map an index file for lookups.
+ *
+ * A record cut short at the end (the segment is still being written) is
+ * ignored.
+ *
+ * \retval NULL if the file can not be read or is not an index
+ */
+struct css_segment_index *css_segment_index_open(const char *filename);
+
+void css_segment_index_close(struct css_segment_index *index);
+
+/*! \brief Number of frames in an index */
+int css_segment_index_count(struct css_segment_index *index);
+
+/*!
+ * \brief Decode record \a i of an index.
+ * \retval 0 on success, -1 if \a i is out of range
+ */
+int css_segment_index_get(struct css_segment_index *index, int i, struct css_segment_frame *frame);
+
+/*!
+ * \brief Find the frame to start at for a time.
+ *
+ * Binary search for the last frame at or before \a sec / \a nsec, then,
+ * if \a idr is set, back to the IDR frame it depends on.
+ *
+ * \return the record number, -1 if the index starts after that time
+ */
+int css_segment_index_seek(struct css_segment_index *index, unsigned int sec, unsigned int nsec, int idr);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* CSS_SEGMENT_H */
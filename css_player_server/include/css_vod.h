@@ -0,0 +1,92 @@
+/*
+ * File:   css_vod.h
+ * Author: root
+ *
+ * Playback of recorded GMP streams.
+ *
+ * A sort recording is the ordered GMP packages of one stream, headers
+ * included.  Opening one maps it read only and scans the package headers
+ * once into a table of complete frames (time, file range, key frame), so
+ * a play request finds its starting key frame with a binary search and
+ * the payload is then sent straight from the file.
+ *
+ * A segment recording (seg-*.h264 with its .idx, see css_segment.h) can
+ * be opened the same way.  Its frames are stored without GMP headers, so
+ * the table comes from the index and every frame is one payload range,
+ * directly followed by the next frame.
+ */
+
+#ifndef CSS_VOD_H
+#define	CSS_VOD_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*! \brief One complete frame of a recording */
+struct css_vod_frame {
+    unsigned int sec;       /*!< GMP time of the first package */
+    unsigned int nsec;
+    off_t offset;           /*!< file offset of the first package */
+    off_t end;              /*!< file offset after the last package */
+    int packages;
+    int key;                /*!< a player can start decoding here */
+};
+
+struct css_vod;
+
+/*!
+ * \brief Map a sort recording and build its frame table.
+ *
+ * The table covers the file as it is when opened.  Frames missing a
+ * package are left out; scanning stops at a damaged package header.
+ * A file ending in .h264 next to an .idx file of the same name is read
+ * as a segment recording instead.
+ *
+ * \retval NULL if the file can not be read
+ */
+struct css_vod *css_vod_open(const char *filename);
+
+void css_vod_close(struct css_vod *vod);
+
+/*! \brief Number of complete frames found */
+int css_vod_count(struct css_vod *vod);
+
+/*! \brief Frame \a i of the table, NULL if out of range */
+const struct css_vod_frame *css_vod_frame(struct css_vod *vod, int i);
+
+/*!
+ * \brief Find the key frame to start playing at for a time.
+ *
+ * \return the key frame at or before \a sec / \a nsec, the first key frame
+ * if the recording starts later, -1 if it holds no key frame
+ */
+int css_vod_seek(struct css_vod *vod, unsigned int sec, unsigned int nsec);
+
+/*! \brief The recording file, open read only */
+int css_vod_fd(struct css_vod *vod);
+
+/*! \brief Bytes covered by the frame table */
+off_t css_vod_size(struct css_vod *vod);
+
+/*!
+ * \brief Walk the packages of a frame.
+ *
+ * A frame of a segment recording is a single package covering the whole
+ * frame.
+ *
+ * \param pos file offset of a package of the frame, updated to the next one
+ * \param payload set to the file offset of the package payload
+ *
+ * \return payload bytes, 0 once \a pos reached \a frame->end
+ */
+size_t css_vod_next_package(struct css_vod *vod, const struct css_vod_frame *frame, off_t *pos, off_t *payload);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* CSS_VOD_H */
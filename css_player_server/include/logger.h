@@ -11,6 +11,7 @@
 #include "compiler.h"
 
 #include <stdarg.h>
+#include <stdint.h>
 
 #if defined(__cplusplus) || defined(c_plusplus)
 extern "C" {
@@ -51,6 +52,53 @@ int option_debug;
 void css_log(int level, const char *file, int line, const char *function, const char *fmt, ...)
 	__attribute__((format(printf, 5, 6)));
 
+/*! \brief Most arguments a css_log_fast() call can record */
+#define CSS_LOG_FAST_ARGS 6
+
+/*! \brief Used for logging on hot paths, formatting deferred to the logger thread
+	css_log_fast(LOG_NOTICE, "stream %u lost %u packages\n", id, lost);
+	The caller only copies the format pointer, a CLOCK_MONOTONIC_COARSE timestamp
+	and the raw argument words into a ring of its own thread; the message, the
+	date and the level name are rendered later by the logger thread.  Messages
+	of one thread stay in order, but may be written before or after css_log()
+	messages of the same moment.  When the ring is full the message is dropped
+	and counted.
+	The deferral has rules:
+	- fmt must be a string literal,
+	- at most CSS_LOG_FAST_ARGS arguments, each an integer or a pointer,
+	  floating point is not supported, %e, %f, %g and %a print "?",
+	- %s only for strings that are never freed or changed, such as literals.
+ */
+#define css_log_fast(level, ...) __css_log_fast_expand(level, __VA_ARGS__)
+
+#define __css_log_fast_expand(level, file, line, function, fmt, ...) do { \
+	if (0) \
+		__css_log_fast_check(fmt, ##__VA_ARGS__); \
+	__css_log_fast(level, file, line, function, fmt, __CSS_LOG_NARGS(__VA_ARGS__) \
+		__CSS_LOG_CAT(__CSS_LOG_WORDS_, __CSS_LOG_NARGS(__VA_ARGS__))(__VA_ARGS__)); \
+} while (0)
+
+#define __CSS_LOG_NARGS(...) __CSS_LOG_NARGS_(0, ##__VA_ARGS__, 6, 5, 4, 3, 2, 1, 0)
+#define __CSS_LOG_NARGS_(_0, _1, _2, _3, _4, _5, _6, n, ...) n
+#define __CSS_LOG_CAT(a, b) __CSS_LOG_CAT_(a, b)
+#define __CSS_LOG_CAT_(a, b) a##b
+#define __CSS_LOG_WORD(x) , (unsigned long long) (uintptr_t) (x)
+#define __CSS_LOG_WORDS_0(...)
+#define __CSS_LOG_WORDS_1(a) __CSS_LOG_WORD(a)
+#define __CSS_LOG_WORDS_2(a, ...) __CSS_LOG_WORD(a) __CSS_LOG_WORDS_1(__VA_ARGS__)
+#define __CSS_LOG_WORDS_3(a, ...) __CSS_LOG_WORD(a) __CSS_LOG_WORDS_2(__VA_ARGS__)
+#define __CSS_LOG_WORDS_4(a, ...) __CSS_LOG_WORD(a) __CSS_LOG_WORDS_3(__VA_ARGS__)
+#define __CSS_LOG_WORDS_5(a, ...) __CSS_LOG_WORD(a) __CSS_LOG_WORDS_4(__VA_ARGS__)
+#define __CSS_LOG_WORDS_6(a, ...) __CSS_LOG_WORD(a) __CSS_LOG_WORDS_5(__VA_ARGS__)
+
+/*! \brief Records a css_log_fast() message, every variadic argument an unsigned long long */
+void __css_log_fast(int level, const char *file, int line, const char *function, const char *fmt, int nargs, ...);
+
+/*! \brief Never called, lets the compiler check css_log_fast() formats */
+static inline void __attribute__((format(printf, 1, 2))) __css_log_fast_check(const char *fmt, ...)
+{
+}
+
 void css_backtrace(void);
 
 /*! \brief Reload logger without rotating log files */
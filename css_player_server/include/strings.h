@@ -14,6 +14,9 @@ extern "C" {
 
 /* #define DEBUG_OPAQUE */
 
+/* This header shadows the system <strings.h>, which <string.h> pulls in
+ * for strcasecmp() and friends, so hand that one on too. */
+#include_next <strings.h>
 #include <ctype.h>
 
 #include "utils.h"
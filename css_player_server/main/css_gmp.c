@@ -0,0 +1,328 @@
+/*
+ * File:   css_gmp.c
+ * Author: root
+ *
+ * GMP package header decoding, see css_gmp.h.
+ */
+
+#include "css_gmp.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <endian.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "logger.h"
+#include "utils.h"
+#include "cli.h"
+#include "unaligned.h"
+#include "_private.h"
+
+#define GMP_REPLAY_DEFAULT_ROUNDS 10
+
+static const char * const parse_results[CSS_GMP_PARSE_RESULTS] = {
+    [-CSS_GMP_PARSE_OK] = "ok",
+    [-CSS_GMP_PARSE_SHORT] = "shorter than a header",
+    [-CSS_GMP_PARSE_LENGTH] = "bad package length",
+    [-CSS_GMP_PARSE_TRUNCATED] = "truncated",
+    [-CSS_GMP_PARSE_TYPE] = "unknown package type",
+    [-CSS_GMP_PARSE_SEQ] = "sequence out of range",
+};
+
+int css_gmp_parse(const void *buf, size_t len, struct css_gmp_header *hdr)
+{
+    const unsigned char *p = buf;
+
+    if (len < CSS_GMP_HEADER_LEN) {
+        return CSS_GMP_PARSE_SHORT;
+    }
+
+    //协议字段为小端, 不保证对齐
+    hdr->media = p[5];
+    hdr->type = p[6];
+    hdr->stream_id = le32toh(get_unaligned_uint32(p + 7));
+    hdr->seq = le32toh(get_unaligned_uint32(p + 11));
+    hdr->length = le32toh(get_unaligned_uint32(p + 15));
+    hdr->sec = le32toh(get_unaligned_uint32(p + 19));
+    hdr->nsec = le32toh(get_unaligned_uint32(p + 23));
+
+    if (hdr->length < CSS_GMP_HEADER_LEN) {
+        return CSS_GMP_PARSE_LENGTH;
+    }
+    if (hdr->length > len) {
+        return CSS_GMP_PARSE_TRUNCATED;
+    }
+    if (hdr->type < CSS_GMP_FRAME_BEGIN || hdr->type > CSS_GMP_FRAME_ONLY) {
+        return CSS_GMP_PARSE_TYPE;
+    }
+    if (hdr->seq >= CSS_GMP_SEQ_MAX) {
+        return CSS_GMP_PARSE_SEQ;
+    }
+
+    return CSS_GMP_PARSE_OK;
+}
+
+const char *css_gmp_parse_str(int result)
+{
+    return result <= 0 && -result < CSS_GMP_PARSE_RESULTS ? parse_results[-result] : "unknown";
+}
+
+/*! \brief A captured datagram inside the mapped capture file */
+struct gmp_replay_dgram {
+    size_t offset;
+    size_t len;
+};
+
+/*!
+ * \brief Split a capture into datagrams by their announced length.
+ *
+ * Both the normal recording (every datagram as received) and the sort
+ * recordings are captures.  Without framing of its own a capture can only
+ * be followed while the lengths are sane, the rest is left out.
+ *
+ * \return datagrams found, -1 on allocation failure
+ */
+static int gmp_replay_split(const unsigned char *map, size_t maplen, struct gmp_replay_dgram **dgrams, size_t *used)
+{
+    struct gmp_replay_dgram *list = NULL, *tmp;
+    int count = 0, alloc = 0;
+    size_t pos = 0, len;
+
+    while (pos + CSS_GMP_HEADER_LEN <= maplen) {
+        len = le32toh(get_unaligned_uint32(map + pos + 15));
+        if (len < CSS_GMP_HEADER_LEN || len > maplen - pos) {
+            break;
+        }
+        if (count == alloc) {
+            alloc = alloc ? alloc * 2 : 4096;
+            if (!(tmp = css_realloc(list, alloc * sizeof(*list)))) {
+                css_free(list);
+                return -1;
+            }
+            list = tmp;
+        }
+        list[count].offset = pos;
+        list[count].len = len;
+        count++;
+        pos += len;
+    }
+
+    *dgrams = list;
+    *used = pos;
+
+    return count;
+}
+
+/*!
+ * \brief Damage a copy of a datagram the ways the network does.
+ *
+ * \return the length of the damaged copy
+ */
+static size_t gmp_replay_mutate(unsigned char *dst, const unsigned char *src, size_t len, uint32_t *seed)
+{
+    uint32_t x = *seed;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *seed = x;
+
+    memcpy(dst, src, len);
+    switch (x % 4) {
+    case 0: //截断
+        return (x >> 8) % (len + 1);
+    case 1: //随机字节
+        dst[(x >> 8) % len] ^= (x >> 24) | 1;
+        return len;
+    case 2: //长度字段
+        if (len >= 19) {
+            put_unaligned_uint32(dst + 15, htole32(x >> 2));
+        }
+        return len;
+    default: //头部字段
+        if (len >= CSS_GMP_HEADER_LEN) {
+            dst[5 + (x >> 8) % (CSS_GMP_HEADER_LEN - 5)] = x >> 16;
+        }
+        return len;
+    }
+}
+
+/*! \brief Little endian u32 assembled byte by byte, shares nothing with the parser */
+static uint32_t gmp_replay_le32(const unsigned char *p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+/*!
+ * \brief Decode a damaged copy again the slow way and compare.
+ *
+ * Checking an accepted header only against the limits the parser itself
+ * tests can not catch a field read from the wrong offset, and a wrong
+ * rejection is not looked at at all.  Decode the copy independently and
+ * require the same result and, when accepted, the same fields.
+ *
+ * \return 1 if css_gmp_parse() agrees with the slow decode
+ */
+static int gmp_replay_check(const unsigned char *buf, size_t len, int res, const struct css_gmp_header *hdr)
+{
+    uint32_t length, seq;
+    int want;
+
+    if (len < CSS_GMP_HEADER_LEN) {
+        return res == CSS_GMP_PARSE_SHORT;
+    }
+
+    seq = gmp_replay_le32(buf + 11);
+    length = gmp_replay_le32(buf + 15);
+    if (length < CSS_GMP_HEADER_LEN) {
+        want = CSS_GMP_PARSE_LENGTH;
+    } else if (length > len) {
+        want = CSS_GMP_PARSE_TRUNCATED;
+    } else if (buf[6] < CSS_GMP_FRAME_BEGIN || buf[6] > CSS_GMP_FRAME_ONLY) {
+        want = CSS_GMP_PARSE_TYPE;
+    } else if (seq >= CSS_GMP_SEQ_MAX) {
+        want = CSS_GMP_PARSE_SEQ;
+    } else {
+        want = CSS_GMP_PARSE_OK;
+    }
+    if (res != want) {
+        return 0;
+    }
+    if (res != CSS_GMP_PARSE_OK) {
+        return 1;
+    }
+
+    return hdr->media == buf[5] && hdr->type == buf[6] && hdr->stream_id == gmp_replay_le32(buf + 7) &&
+        hdr->seq == seq && hdr->length == length && hdr->sec == gmp_replay_le32(buf + 19) &&
+        hdr->nsec == gmp_replay_le32(buf + 23);
+}
+
+/*! \brief CLI command to replay a capture through the header parser */
+static char *handle_gmp_replay(struct css_cli_entry *e, int cmd, struct css_cli_args *a)
+{
+    struct gmp_replay_dgram *dgrams;
+    struct css_gmp_header hdr;
+    unsigned int results[CSS_GMP_PARSE_RESULTS] = { 0 };
+    unsigned int broken = 0, fuzzed = 0;
+    int rounds = GMP_REPLAY_DEFAULT_ROUNDS, count, i, r, res;
+    unsigned char *map, *copy;
+    size_t maplen, used, len;
+    uint32_t seed = 2463534242U;
+    struct timeval start;
+    struct stat st;
+    int64_t us;
+    int fd;
+
+    switch (cmd) {
+    case CLI_INIT:
+        e->command = "gmp replay";
+        e->usage =
+            "Usage: gmp replay <capture> [<rounds>]\n"
+            "       Replay the datagrams of a normal or sort recording\n"
+            "       through the GMP header parser: time <rounds> passes\n"
+            "       (default 10), then parse as many damaged copies,\n"
+            "       truncated or with bytes changed, count why they were\n"
+            "       rejected and check every result and accepted header\n"
+            "       against a byte by byte decode.\n";
+        return NULL;
+    case CLI_GENERATE:
+        return NULL;
+    }
+
+    if (a->argc < 3 || a->argc > 4) {
+        return CLI_SHOWUSAGE;
+    }
+    if (a->argc > 3 && (sscanf(a->argv[3], "%30d", &rounds) != 1 || rounds < 1)) {
+        return CLI_SHOWUSAGE;
+    }
+
+    if ((fd = open(a->argv[2], O_RDONLY)) < 0) {
+        css_cli(a->fd, "Can not open %s: %s\n", a->argv[2], strerror(errno));
+        return CLI_FAILURE;
+    }
+    if (fstat(fd, &st) || !st.st_size) {
+        css_cli(a->fd, "%s is empty\n", a->argv[2]);
+        close(fd);
+        return CLI_FAILURE;
+    }
+    maplen = st.st_size;
+    map = mmap(NULL, maplen, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        css_cli(a->fd, "Can not map %s: %s\n", a->argv[2], strerror(errno));
+        return CLI_FAILURE;
+    }
+
+    if ((count = gmp_replay_split(map, maplen, &dgrams, &used)) < 0) {
+        munmap(map, maplen);
+        return CLI_FAILURE;
+    }
+    css_cli(a->fd, "%d datagram%s in %zu bytes", count, ESS(count), used);
+    if (used < maplen) {
+        css_cli(a->fd, ", %zu bytes after offset %zu do not split", maplen - used, used);
+    }
+    css_cli(a->fd, "\n");
+    if (!count) {
+        munmap(map, maplen);
+        return CLI_SUCCESS;
+    }
+
+    start = css_tvnow();
+    for (r = 0; r < rounds; r++) {
+        for (i = 0; i < count; i++) {
+            results[-css_gmp_parse(map + dgrams[i].offset, dgrams[i].len, &hdr)]++;
+        }
+    }
+    us = css_tvdiff_us(css_tvnow(), start);
+    css_cli(a->fd, "Parse %d round%s: %.1f ns/datagram, %u ok\n", rounds, ESS(rounds),
+            (double) us * 1000 / ((double) count * rounds), results[0] / rounds);
+    for (i = 1; i < CSS_GMP_PARSE_RESULTS; i++) {
+        if (results[i]) {
+            css_cli(a->fd, "    %-24s %u\n", parse_results[i], results[i] / rounds);
+        }
+    }
+
+    //每个副本单独分配, 越界读取能被内存检查工具发现
+    memset(results, 0, sizeof(results));
+    for (r = 0; r < rounds; r++) {
+        for (i = 0; i < count; i++) {
+            if (!(copy = css_malloc(dgrams[i].len))) {
+                continue;
+            }
+            len = gmp_replay_mutate(copy, map + dgrams[i].offset, dgrams[i].len, &seed);
+            res = css_gmp_parse(copy, len, &hdr);
+            results[-res]++;
+            if (!gmp_replay_check(copy, len, res, &hdr)) {
+                broken++;
+            }
+            fuzzed++;
+            css_free(copy);
+        }
+    }
+    css_cli(a->fd, "Fuzz %u damaged copies:\n", fuzzed);
+    for (i = 0; i < CSS_GMP_PARSE_RESULTS; i++) {
+        css_cli(a->fd, "    %-24s %u\n", parse_results[i], results[i]);
+    }
+    css_cli(a->fd, "%u cop%s parsed unlike a byte by byte decode\n", broken, broken == 1 ? "y" : "ies");
+
+    css_free(dgrams);
+    munmap(map, maplen);
+
+    return broken ? CLI_FAILURE : CLI_SUCCESS;
+}
+
+static struct css_cli_entry cli_gmp_parse[] = {
+    CSS_CLI_DEFINE(handle_gmp_replay, "Replay and fuzz a GMP capture through the parser"),
+};
+
+int css_gmp_init(void)
+{
+    css_cli_register_multiple(cli_gmp_parse, ARRAY_LEN(cli_gmp_parse));
+
+    return 0;
+}
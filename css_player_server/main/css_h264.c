@@ -0,0 +1,368 @@
+/*
+ * File:   css_h264.c
+ * Author: root
+ *
+ * H.264 Annex B bitstream scanning, see css_h264.h.
+ *
+ * The start code search compares three shifted loads of 16 (SSE2) or 32
+ * (AVX2) bytes against 00, 00 and 01 and tests the combined byte mask, so
+ * a block without a start code costs a handful of instructions.  The
+ * implementation is picked on first use from the CPU features.
+ */
+
+#include "css_h264.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CSS_H264_X86 1
+#include <immintrin.h>
+#endif
+
+#include "logger.h"
+#include "utils.h"
+#include "cli.h"
+#include "_private.h"
+
+#define H264_BENCH_DEFAULT_MB 64 //基准测试缓冲大小(MB)
+#define H264_BENCH_MAX_MB 1024
+#define H264_BENCH_DEFAULT_ROUNDS 10
+
+typedef const unsigned char *(*h264_find_fn)(const unsigned char *p, const unsigned char *end);
+
+static const unsigned char *find_start_detect(const unsigned char *p, const unsigned char *end);
+
+//当前使用的起始码查找实现, 首次调用时按CPU特性选择
+static h264_find_fn find_start = find_start_detect;
+static enum css_h264_scanner find_start_scanner = CSS_H264_SCAN_AUTO;
+
+static const char * const scanner_names[] = {
+    [CSS_H264_SCAN_AUTO] = "auto",
+    [CSS_H264_SCAN_SCALAR] = "scalar",
+    [CSS_H264_SCAN_SSE2] = "sse2",
+    [CSS_H264_SCAN_AVX2] = "avx2",
+};
+
+/*!
+ * \brief Scalar start code search.
+ *
+ * Looks at every third byte: if a[2] is above 1 or a[2] is 1 without two
+ * zeros before it, no start code can begin at a, a + 1 or a + 2.
+ */
+static const unsigned char *find_start_scalar(const unsigned char *p, const unsigned char *end)
+{
+    const unsigned char *a = p;
+
+    while (a + 2 < end) {
+        if (a[2] > 1) {
+            a += 3;
+        } else if (!a[2]) {
+            a++;
+        } else if (a[0] || a[1]) {
+            a += 3;
+        } else {
+            return a;
+        }
+    }
+
+    return end;
+}
+
+#ifdef CSS_H264_X86
+__attribute__((target("sse2")))
+static const unsigned char *find_start_sse2(const unsigned char *p, const unsigned char *end)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi8(1);
+    __m128i v0, v1, v2;
+    int mask;
+
+    //每次检查16个起始位置, 需要读到 p + 17
+    while (end - p >= 18) {
+        v0 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) p), zero);
+        v1 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (p + 1)), zero);
+        v2 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (p + 2)), one);
+        if ((mask = _mm_movemask_epi8(_mm_and_si128(_mm_and_si128(v0, v1), v2)))) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 16;
+    }
+
+    return find_start_scalar(p, end);
+}
+
+__attribute__((target("avx2")))
+static const unsigned char *find_start_avx2(const unsigned char *p, const unsigned char *end)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i one = _mm256_set1_epi8(1);
+    __m256i v0, v1, v2;
+    unsigned int mask;
+
+    //每次检查32个起始位置, 需要读到 p + 33
+    while (end - p >= 34) {
+        v0 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *) p), zero);
+        v1 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *) (p + 1)), zero);
+        v2 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *) (p + 2)), one);
+        if ((mask = (unsigned int) _mm256_movemask_epi8(_mm256_and_si256(_mm256_and_si256(v0, v1), v2)))) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 32;
+    }
+
+    return find_start_sse2(p, end);
+}
+#endif /* CSS_H264_X86 */
+
+static h264_find_fn scanner_fn(enum css_h264_scanner scanner)
+{
+#ifdef CSS_H264_X86
+    __builtin_cpu_init();
+#endif
+
+    switch (scanner) {
+    case CSS_H264_SCAN_AUTO:
+#ifdef CSS_H264_X86
+        if (__builtin_cpu_supports("avx2")) {
+            return find_start_avx2;
+        }
+        if (__builtin_cpu_supports("sse2")) {
+            return find_start_sse2;
+        }
+#endif
+        return find_start_scalar;
+    case CSS_H264_SCAN_SCALAR:
+        return find_start_scalar;
+#ifdef CSS_H264_X86
+    case CSS_H264_SCAN_SSE2:
+        return __builtin_cpu_supports("sse2") ? find_start_sse2 : NULL;
+    case CSS_H264_SCAN_AVX2:
+        return __builtin_cpu_supports("avx2") ? find_start_avx2 : NULL;
+#endif
+    default:
+        return NULL;
+    }
+}
+
+static enum css_h264_scanner scanner_of(h264_find_fn fn)
+{
+#ifdef CSS_H264_X86
+    if (fn == find_start_avx2) {
+        return CSS_H264_SCAN_AVX2;
+    }
+    if (fn == find_start_sse2) {
+        return CSS_H264_SCAN_SSE2;
+    }
+#endif
+    return CSS_H264_SCAN_SCALAR;
+}
+
+static const unsigned char *find_start_detect(const unsigned char *p, const unsigned char *end)
+{
+    //多个线程同时选择时结果相同, 无需加锁
+    h264_find_fn fn = scanner_fn(CSS_H264_SCAN_AUTO);
+
+    find_start_scanner = scanner_of(fn);
+    find_start = fn;
+
+    return fn(p, end);
+}
+
+const unsigned char *css_h264_find_start(const unsigned char *p, const unsigned char *end)
+{
+    return find_start(p, end);
+}
+
+int css_h264_set_scanner(enum css_h264_scanner scanner)
+{
+    h264_find_fn fn;
+
+    if (!(fn = scanner_fn(scanner))) {
+        return -1;
+    }
+    find_start_scanner = scanner_of(fn);
+    find_start = fn;
+
+    return 0;
+}
+
+const char *css_h264_scanner_name(void)
+{
+    if (find_start == find_start_detect) {
+        return scanner_names[scanner_of(scanner_fn(CSS_H264_SCAN_AUTO))];
+    }
+    return scanner_names[find_start_scanner];
+}
+
+int css_h264_split(const unsigned char *data, size_t len, struct css_h264_nal *nals, int max)
+{
+    const unsigned char *end = data + len;
+    const unsigned char *p = find_start(data, end);
+    const unsigned char *nal, *next, *last;
+    int count = 0;
+
+    while (p < end) {
+        nal = p + 3;
+        next = nal < end ? find_start(nal, end) : end;
+        //下一个起始码前的 0 属于四字节起始码或尾随填充
+        for (last = next; last > nal && !last[-1]; last--);
+        if (last > nal) {
+            if (count < max) {
+                nals[count].offset = nal - data;
+                nals[count].len = last - nal;
+                nals[count].type = nal[0] & 0x1f;
+            }
+            count++;
+        }
+        p = next;
+    }
+
+    return count;
+}
+
+unsigned int css_h264_frame_info(const unsigned char *data, size_t len)
+{
+    const unsigned char *end = data + len;
+    const unsigned char *p = data;
+    unsigned int flags = 0;
+
+    while ((p = find_start(p, end)) + 3 < end) {
+        switch (p[3] & 0x1f) {
+        case CSS_H264_NAL_IDR:
+            flags |= CSS_H264_HAS_IDR;
+            /* fall through */
+        case CSS_H264_NAL_SLICE:
+        case 2: /* slice data partition A */
+            return flags | CSS_H264_HAS_SLICE;
+        case CSS_H264_NAL_SPS:
+            flags |= CSS_H264_HAS_SPS;
+            break;
+        case CSS_H264_NAL_PPS:
+            flags |= CSS_H264_HAS_PPS;
+            break;
+        case CSS_H264_NAL_SEI:
+            flags |= CSS_H264_HAS_SEI;
+            break;
+        }
+        p += 3;
+    }
+
+    return flags;
+}
+
+/*!
+ * \brief Fill a buffer that looks like a coded stream to the scanner.
+ *
+ * Random slice data with emulation prevention applied (no 00 00 0x with
+ * x <= 3), split by 4 byte start codes every 1 to 64 KB.
+ */
+static size_t h264_bench_fill(unsigned char *buf, size_t len)
+{
+    uint32_t x = 2463534242U;
+    size_t i, next = 0, nals = 0;
+
+    for (i = 0; i < len; i++) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        if (i == next && i + 5 <= len) {
+            memcpy(buf + i, "\x00\x00\x00\x01\x41", 5);
+            i += 4;
+            next = i + 1 + 1024 + x % (63 * 1024);
+            nals++;
+            continue;
+        }
+        //有一半的字节为 0, 让查找经常遇到候选位置
+        buf[i] = (x & 0x100) ? 0 : (unsigned char) x;
+        if (i >= 2 && !buf[i - 2] && !buf[i - 1] && buf[i] <= 3) {
+            buf[i] = 3;
+        }
+    }
+
+    return nals;
+}
+
+/*! \brief CLI command to measure the start code search on a large buffer */
+static char *handle_h264_bench(struct css_cli_entry *e, int cmd, struct css_cli_args *a)
+{
+    static const enum css_h264_scanner scanners[] = {
+        CSS_H264_SCAN_SCALAR, CSS_H264_SCAN_SSE2, CSS_H264_SCAN_AVX2,
+    };
+    int mb = H264_BENCH_DEFAULT_MB, rounds = H264_BENCH_DEFAULT_ROUNDS;
+    unsigned char *buf;
+    size_t len, planted, found;
+    const unsigned char *p, *end;
+    struct timeval start;
+    int64_t us;
+    int i, r;
+    h264_find_fn fn;
+
+    switch (cmd) {
+    case CLI_INIT:
+        e->command = "h264 bench";
+        e->usage =
+            "Usage: h264 bench [<MB> [<rounds>]]\n"
+            "       Time the H.264 start code search of every implementation\n"
+            "       the CPU supports on a <MB> megabyte synthetic stream\n"
+            "       (default 64), scanned <rounds> times (default 10).\n";
+        return NULL;
+    case CLI_GENERATE:
+        return NULL;
+    }
+
+    if (a->argc > 4) {
+        return CLI_SHOWUSAGE;
+    }
+    if (a->argc > 2 && (sscanf(a->argv[2], "%30d", &mb) != 1 || mb < 1 || mb > H264_BENCH_MAX_MB)) {
+        return CLI_SHOWUSAGE;
+    }
+    if (a->argc > 3 && (sscanf(a->argv[3], "%30d", &rounds) != 1 || rounds < 1)) {
+        return CLI_SHOWUSAGE;
+    }
+
+    len = (size_t) mb * 1024 * 1024;
+    if (!(buf = css_malloc(len))) {
+        return CLI_FAILURE;
+    }
+    planted = h264_bench_fill(buf, len);
+    end = buf + len;
+
+    css_cli(a->fd, "%d MB, %d round%s, %zu start codes, in use: %s\n",
+            mb, rounds, ESS(rounds), planted, css_h264_scanner_name());
+
+    for (i = 0; i < ARRAY_LEN(scanners); i++) {
+        if (!(fn = scanner_fn(scanners[i]))) {
+            css_cli(a->fd, "%-8s not supported by this CPU\n", scanner_names[scanners[i]]);
+            continue;
+        }
+        found = 0;
+        start = css_tvnow();
+        for (r = 0; r < rounds; r++) {
+            for (p = fn(buf, end); p < end; p = fn(p + 3, end)) {
+                found++;
+            }
+        }
+        us = css_tvdiff_us(css_tvnow(), start);
+        css_cli(a->fd, "%-8s %8.1f MB/s %6.2f ms/round%s\n", scanner_names[scanners[i]],
+                us ? (double) mb * rounds * 1000000 / us : 0.0, (double) us / rounds / 1000,
+                found == planted * rounds ? "" : " MISMATCH");
+    }
+
+    css_free(buf);
+
+    return CLI_SUCCESS;
+}
+
+static struct css_cli_entry cli_h264[] = {
+    CSS_CLI_DEFINE(handle_h264_bench, "Benchmark the H.264 start code search"),
+};
+
+int css_h264_init(void)
+{
+    css_cli_register_multiple(cli_h264, ARRAY_LEN(cli_h264));
+
+    return 0;
+}
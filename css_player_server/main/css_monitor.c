@@ -4,6 +4,8 @@
  *
  * Created on April 16, 2014, 6:29 PM
  */
+#define _GNU_SOURCE /* recvmmsg() */
+
 #include "css_monitor.h"
 
 #include <stdio.h>
@@ -11,8 +13,11 @@
 #include <string.h>
 #include <signal.h>
 #include <errno.h>
+#include <limits.h>
+#include <time.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <linux/sock_diag.h>
 
 #include <event2/bufferevent.h>
 #include <event2/buffer.h>
@@ -20,40 +25,122 @@
 #include <event2/util.h>
 #include <event2/event.h>
 #include <event2/event_struct.h>
+#include <event2/thread.h>
 
 #include "logger.h"
 #include "linkedlists.h"
+#include "cssobj2.h"
+#include "network.h"
+#include "config.h"
+#include "strings.h"
+#include "utils.h"
+#include "cli.h"
+#include "css_recorder.h"
+#include "css_h264.h"
+#include "css_segment.h"
+#include "css_vod.h"
+#include "css_gmp.h"
 
 struct event_base* base;
-static const char MESSAGE[] = "Hello, World!\n";
 
 static void listener_cb(struct evconnlistener *, evutil_socket_t, 
         struct sockaddr *, int socklen, void *);
+static void conn_readcb(struct bufferevent *, void *);
 static void conn_writecb(struct bufferevent *, void *);
 static void conn_eventcb(struct bufferevent *, short, void *);
-static void signal_cb(evutil_socket_t, short, void *);
+static void gmp_stream_flush_cb(evutil_socket_t, short, void *);
 
 #define RECEPTION_BUFFER_LENGTH 1024 //缓冲大小
 #define OFF_SET(i) ((i) % RECEPTION_BUFFER_LENGTH)
 
 #define REORDERING_WINDOW_SIZE RECEPTION_BUFFER_LENGTH/2 //排序窗口大小
-#define SEQ_MAX 65536
+#define SEQ_MAX CSS_GMP_SEQ_MAX
 #define OFF_SET_SEQ(i) ((i) % SEQ_MAX)
 
+#define GMP_HEADER_LEN CSS_GMP_HEADER_LEN //GMP包头长度
+#define GMP_STREAM_BUCKETS 563 //流容器哈希桶数
+
+#define GMP_CONFIG_FILE "/etc/cssplayer/cssplayer.conf"
+#define DEFAULT_GMP_RECV_BATCH 32 //每次唤醒最多读取的数据包数
+#define GMP_RECV_BATCH_MAX 1024
+
+#define DEFAULT_GMP_ENDPOINT "0.0.0.0:8080" //未配置 endpoint 时的接收地址
+#define GMP_ENDPOINTS_MAX 32
+#define GMP_ENDPOINT_SOURCES_MAX 8 //每个组播地址最多指定的源
+#define GMP_RCVBUF_MAX 1048576 //接收缓冲上限(KB)
+//每个数据包的控制消息: 内核接收时间和套接字丢包计数
+#define GMP_CMSG_SPACE (CMSG_SPACE(sizeof(struct timespec)) + CMSG_SPACE(sizeof(uint32_t)))
+#define GMP_LATENCY_BUCKETS 22 //内核到用户态延迟直方图, 1us ~ 1s 按 2 倍分桶
+
+#define DEFAULT_GMP_WORKERS 1 //接收线程数
+#define GMP_WORKERS_MAX 64
+#define DEFAULT_GMP_REORDER_TIMEOUT 1000 //排序超时(毫秒)
+#define GMP_REORDER_TIMEOUT_MAX 60000
+#define DEFAULT_GMP_REORDER_MIN 20 //自适应模式最短等待(毫秒)
+#define DEFAULT_GMP_REORDER_PERCENTILE 99 //自适应模式覆盖的补包延迟百分位
+#define GMP_JITTER_FACTOR 3 //等待时间不少于 3 倍到达抖动
+#define GMP_GAP_MIN_SAMPLES 16 //样本少于此数时不使用百分位
+#define GMP_GAP_DECAY 256 //样本数到此值时直方图减半, 跟随链路变化
+
+enum gmp_reorder_mode {
+    GMP_REORDER_FIXED,          /*!< always wait reorder_timeout */
+    GMP_REORDER_ADAPTIVE,       /*!< wait as long as measured gaps need, at most reorder_timeout */
+};
+
+//每次唤醒 recvmmsg() 读取的数据包数, 1 表示逐包 recvfrom()
+static int gmp_recv_batch = DEFAULT_GMP_RECV_BATCH;
+//接收线程数, 0 表示每个在线CPU一个
+static int gmp_worker_count = DEFAULT_GMP_WORKERS;
+//是否把接收线程绑定到CPU
+static int gmp_worker_affinity = 1;
+//排序窗口等待丢失包的时间(毫秒), 自适应模式下为上限
+static int gmp_reorder_timeout = DEFAULT_GMP_REORDER_TIMEOUT;
+static int gmp_reorder_mode = GMP_REORDER_FIXED;
+static int gmp_reorder_min = DEFAULT_GMP_REORDER_MIN;
+static int gmp_reorder_percentile = DEFAULT_GMP_REORDER_PERCENTILE;
+
+//补包延迟直方图各桶上限(毫秒), 半倍频程
+static const int gmp_gap_bounds[] = {
+    1, 2, 3, 4, 6, 8, 12, 16, 24, 32, 48, 64, 96, 128, 192, 256,
+    384, 512, 768, 1024, 1536, 2048, 3072, 4096, 6144, 8192, 12288, 16384,
+    24576, 32768, 49152, 65536
+};
+#define GMP_GAP_BUCKETS ARRAY_LEN(gmp_gap_bounds)
+
 //排序窗口使用的变量
 char pathname[128] = "/etc/cssplayer/normal.h264";
-char sortpathname[128] = "/etc/cssplayer/sort.h264";
-FILE *normalfile;
-FILE *sortfile;
+char sortpathname[128] = "/etc/cssplayer";
+
+#define GMP_MTU 1500 //包内联存储大小, 也是可接收的最大数据包
+#define GMP_POOL_SLAB_BLOCKS 256 //每次扩充的包数
+#define DEFAULT_GMP_RECORD_CHUNK 256 //录制块大小(KB)
+#define DEFAULT_GMP_RECORD_CHUNKS 64 //每个接收线程在途的录制块数
+#define DEFAULT_GMP_RECORD_FLUSH 500 //未满的录制块最长等待(毫秒)
+#define GMP_STATS_INTERVAL_MAX 86400
+#define DEFAULT_GMP_STREAM_IDLE 60 //流多久没有数据后释放(秒)
+#define GMP_STREAM_IDLE_MAX 86400
+#define GMP_RECORD_SEGMENT_MAX 86400
+#define GMP_SEGMENT_ROTATE_SIZE ((off_t) UINT32_MAX - 256 * 1024 * 1024) //索引偏移只有 32 位, 留出一个关键帧组的余量
+
+#define DEFAULT_GMP_PLAY_PORT 9999 //播放端连接端口
+#define GMP_PLAY_LINE_MAX 256 //播放请求行最大长度
+#define GMP_PLAY_REQUEST_TIMEOUT 10 //连接后发送播放请求的时限(秒)
+#define GMP_CHANNEL_BUCKETS 563
+#define GMP_CLIENT_BUCKETS 61
+#define DEFAULT_GMP_PLAY_QUEUE_HIGH 4096 //播放端待发送数据上限(KB), 超过后丢帧
+#define DEFAULT_GMP_PLAY_QUEUE_LOW 1024 //待发送数据降到此值(KB)以下才在关键帧恢复
+#define GMP_PLAY_QUEUE_MAX 1048576
+#define DEFAULT_GMP_GOP_FRAMES 300 //关键帧组缓存最大帧数
+#define DEFAULT_GMP_GOP_SIZE 8192 //关键帧组缓存最大字节数(KB)
+#define GMP_GOP_FRAMES_MAX 3000
+#define GMP_VOD_FILL (256 * 1024) //点播每次排队到连接的数据量
+#define GMP_VOD_LOW (64 * 1024) //点播待发送数据降到此值以下时继续排队
 
-int max_seq;//uh
-int espect_seq;
-int time_seq;
-int old_espect_seq;
-struct timeval order_timer;
-int t_Recordering;
+#define GMP_FRAME_MIN_SHIFT 12 //最小帧缓冲 4KB
+#define GMP_FRAME_CLASSES 11 //帧缓冲大小级别 4KB ~ 4MB, 更大的帧直接分配
+#define GMP_FRAME_POOL_MAX 64 //每级保留的空闲帧缓冲数
 
-int lastseq;
+struct frame_pool;
 
 //H264 视频包数据结构体
 struct frame_block{
@@ -62,11 +149,65 @@ struct frame_block{
     int tns;
     int datalen;
     int frame_type;
-    char *dataptr;
+    char *dataptr;              /*!< start of the package inside data[] */
+    struct frame_pool *pool;    /*!< pool the block is returned to */
     CSS_LIST_ENTRY(frame_block) frame_block_list;
+    char data[GMP_MTU];
+};
+
+//一块连续分配的包
+struct frame_slab {
+    struct frame_slab *next;
+    struct frame_block blocks[GMP_POOL_SLAB_BLOCKS];
+};
+
+/*!
+ * \brief Freelist of frame blocks with inline payload storage.
+ *
+ * Blocks are carved out of slabs of GMP_POOL_SLAB_BLOCKS and recycled
+ * through the freelist, so once the pool has grown to the working set the
+ * per-package path does not touch the allocator.  A pool belongs to one
+ * ingest worker and is not locked.
+ */
+struct frame_pool {
+    CSS_LIST_HEAD_NOLOCK(, frame_block) freelist;
+    struct frame_slab *slabs;
+    int total;                  /*!< blocks owned by the pool */
+    int available;              /*!< blocks on the freelist */
+};
+
+/*! \brief Payload buffer of an assembled frame, recycled by size class */
+struct gmp_frame_buf {
+    CSS_LIST_ENTRY(gmp_frame_buf) list;
+    int cls;                    /*!< size class, -1 if not pooled */
+    size_t size;                /*!< bytes available in data[] */
+    char data[0];
+};
+
+struct gmp_frame_class {
+    CSS_LIST_HEAD(, gmp_frame_buf) free;
+    int count;
+};
+
+//帧缓冲在消费线程释放, 每级一个带锁空闲链表
+static struct gmp_frame_class gmp_frame_classes[GMP_FRAME_CLASSES];
+
+/*!
+ * \brief One H.264 access unit, GMP headers stripped.
+ *
+ * Built from the ordered begin/other/end packages of a stream.  Frames are
+ * ao2 objects so every consumer can hold a reference to the same payload.
+ */
+struct gmp_frame {
+    unsigned int ts;            /*!< GMP timestamp, seconds */
+    unsigned int tns;           /*!< GMP timestamp, nanoseconds */
+    int first_seq;              /*!< sequence of the first package */
+    int last_seq;               /*!< sequence of the last package */
+    size_t len;                 /*!< payload bytes in buf->data */
+    int key;                    /*!< IDR picture or the SPS leading one, a player can start decoding here */
+    int slice;                  /*!< holds a coded picture, not only parameter sets / SEI */
+    struct gmp_frame_buf *buf;
 };
-//全局链表
-CSS_LIST_HEAD_NOLOCK(,frame_block) framepq;
 
 enum gmp_h264_media_type {
     gmp_h264_media_type_metadata = 0x00, //H264媒体类型
@@ -74,498 +215,3205 @@ enum gmp_h264_media_type {
     gmp_h264_media_type_frame_begin = 0x40,//H264数据开始包
     gmp_h264_media_type_frame_other = 0x41,//H264数据中间包
     gmp_h264_media_type_frame_end = 0x42,//H264数据结束包
-    gmp_h264_media_type_frame_only = 0x43 //H264未分数据包
+    gmp_h264_media_type_frame_only = 0x43, //H264未分数据包
+    gmp_h264_media_type_foreign = -1 //其他媒体的包, 照常排序和录制, 不装配
 };
 
-struct frame_block **reception_buffer;
-CSS_LIST_HEAD_NOLOCK(,frame_block) gm_pack_list;
+/*!
+ * \brief Counters of the ordered output of a stream.
+ *
+ * Only the worker owning the stream updates them; readers take a plain
+ * snapshot, a counter may be one package behind.
+ */
+struct gmp_stream_stats {
+    unsigned int packets;       /*!< packages put out in order */
+    unsigned int gaps;          /*!< holes left in the ordered output */
+    unsigned int lost;          /*!< packages skipped over by those holes */
+    unsigned int dups;          /*!< duplicate packages thrown away */
+    unsigned int late;          /*!< packages arriving behind the window, thrown away */
+    unsigned int frames;        /*!< frames assembled */
+    unsigned int frames_dropped;/*!< incomplete frames thrown away */
+    unsigned int foreign;       /*!< packages of another media type, left out of the frames */
+};
 
-static void listener_cb(struct evconnlistener *listener, evutil_socket_t fd,
-    struct sockaddr *sa, int socklen, void *user_data)
+/*!
+ * \brief One GMP source: source address + GMP stream id.
+ *
+ * Every stream owns its reorder window and its output sink, so packets
+ * of different encoders never touch each other's sequence state.
+ */
+struct gmp_stream {
+    struct sockaddr_in addr;    /*!< source address of the encoder */
+    unsigned int stream_id;     /*!< GMP stream id from the packet header */
+    char name[64];              /*!< "ip:port/id", used for logs and file names */
+    int max_seq;//uh
+    int espect_seq;
+    int time_seq;
+    int old_espect_seq;
+    struct timeval order_timer; /*!< when the current wait for a missing package started */
+    struct timeval last_seen;   /*!< when the last package arrived, idle streams are dropped */
+    struct event *flush_ev;     /*!< fires depth ms after order_timer */
+    int t_Recordering;
+    int lastseq;
+    struct frame_block *reception_buffer[RECEPTION_BUFFER_LENGTH];
+    CSS_LIST_HEAD_NOLOCK(,frame_block) framepq; //已排序待输出的包
+    struct css_recorder_sink *sink; /*!< ordered output of this stream */
+    struct css_recorder_sink *es;   /*!< assembled frames, NULL unless record_es */
+    struct gmp_channel *channel;    /*!< players of this stream, NULL when playing is off */
+    struct css_recorder_sink *seg;  /*!< current recording segment, NULL until the first key frame */
+    struct css_recorder_sink *seg_index; /*!< frame index of the current segment */
+    unsigned int seg_start;         /*!< GMP time of the first frame of the segment, seconds */
+    unsigned int seg_dropped;       /*!< frames the index of the current segment can not address */
+    struct gmp_frame *partial;  /*!< frame being assembled */
+    struct gmp_stream_stats stats;
+    struct gmp_stream_stats sampled; /*!< stats at the last log sample */
+    struct frame_pool *pool;    /*!< package pool of the owning worker */
+    int worker;                 /*!< index of the owning worker, also its recorder queue */
+
+    /* Arrival statistics, RFC 3550 section 6.4.1 style */
+    int have_transit;
+    int64_t last_transit;       /*!< arrival - media time of the previous package, usec */
+    unsigned int jitter;        /*!< interarrival jitter, usec << 4 */
+    unsigned int reorder;       /*!< mean reorder distance of late packages, packages << 4 */
+    int reorder_max;            /*!< largest reorder distance seen */
+    unsigned int reordered;     /*!< packages that arrived behind a later one */
+    unsigned int gap_hist[GMP_GAP_BUCKETS]; /*!< how long gaps took to fill, ms */
+    unsigned int gap_samples;
+    struct timeval flush_gap;   /*!< start of the last gap given up by the timer */
+    int flush_from;             /*!< first sequence skipped by that flush */
+    int flush_to;               /*!< first sequence after it */
+    int depth;                  /*!< current release deadline, ms */
+};
+
+
+/*!
+ * \brief Ring of pool blocks for batched receive.
+ *
+ * Every slot receives straight into the inline storage of a frame block.
+ * After recvmmsg() the filled blocks are handed to the reorder stage as
+ * they are and the slots are refilled from the worker pool, so a package
+ * is never copied between the socket and the output file.
+ */
+struct gmp_rx_ring {
+    int size;                   /*!< number of slots */
+    struct mmsghdr *msgs;       /*!< one header per slot */
+    struct iovec *iovs;         /*!< one iovec per slot, points into blocks[i]->data */
+    struct sockaddr_in *addrs;  /*!< source address of each slot */
+    struct frame_block **blocks;/*!< block each slot receives into */
+    unsigned char *controls;    /*!< GMP_CMSG_SPACE bytes of control messages per slot */
+};
+
+/*!
+ * \brief An address GMP is received on, one "endpoint" line of [gmp].
+ *
+ * A unicast endpoint is opened by every worker with SO_REUSEPORT, so the
+ * kernel spreads its sources over the workers.  A multicast endpoint is
+ * opened by one worker only: every socket joined to a group gets its own
+ * copy of each datagram, the reorder state would see them twice.
+ */
+struct gmp_endpoint {
+    char name[64];                  /*!< "ip:port" as configured */
+    struct sockaddr_in addr;        /*!< bind address, the group for multicast */
+    int multicast;
+    struct in_addr interface;       /*!< interface to join on, INADDR_ANY lets the kernel pick */
+    struct in_addr sources[GMP_ENDPOINT_SOURCES_MAX]; /*!< source specific join when set */
+    int nsources;
+    int rcvbuf;                     /*!< SO_RCVBUF in KB, 0 keeps the system default */
+};
+
+struct gmp_worker;
+
+/*!
+ * \brief What the kernel tells about the datagrams of a socket.
+ *
+ * Written by the owning worker only, read unlocked by the CLI.
+ */
+struct gmp_socket_stats {
+    uint64_t datagrams;
+    uint64_t bytes;
+    uint32_t drops;                 /*!< datagrams the kernel dropped on a full receive buffer (SO_RXQ_OVFL) */
+    uint32_t drops_sampled;         /*!< drops at the last stats_interval sample */
+    unsigned int truncated;         /*!< datagrams longer than GMP_MTU, cut to it */
+    unsigned int truncated_sampled;
+    unsigned int rejected[CSS_GMP_PARSE_RESULTS]; /*!< datagrams css_gmp_parse() refused, by -result */
+    unsigned int rejected_sampled[CSS_GMP_PARSE_RESULTS];
+    unsigned int batches;           /*!< wakeups that received something */
+    unsigned int batches_full;      /*!< of those, recvmmsg() filled every slot: more was queued */
+    unsigned int queue_peak;        /*!< largest receive queue seen, bytes */
+    unsigned int stamped;           /*!< datagrams with a kernel timestamp (SO_TIMESTAMPNS) */
+    uint64_t latency_sum;           /*!< kernel receive to userspace, us */
+    unsigned int latency_max;
+    unsigned int latency[GMP_LATENCY_BUCKETS]; /*!< bucket i counts latencies below 2^i us, the last one the rest */
+};
+
+/*! \brief A socket of an endpoint, owned by one worker */
+struct gmp_socket {
+    int fd;
+    struct event *ev;
+    struct gmp_endpoint *endpoint;
+    struct gmp_worker *worker;
+    struct gmp_socket_stats stats;
+};
+
+/*!
+ * \brief One ingest worker.
+ *
+ * Each worker owns an event_base and its sockets: one per unicast
+ * endpoint, bound with SO_REUSEPORT to the address the other workers
+ * share, and the multicast endpoints assigned to it.  The kernel hashes
+ * every flow to one socket, so a source always lands on the same worker
+ * and its streams are only ever touched by that worker's thread.
+ */
+struct gmp_worker {
+    int index;
+    int cpu;                        /*!< CPU the thread is pinned to, -1 if not pinned */
+    pthread_t thread;
+    struct event_base *base;
+    struct gmp_socket socks[GMP_ENDPOINTS_MAX];
+    int nsocks;
+    struct gmp_rx_ring *ring;       /*!< NULL when receiving one package per wakeup, shared by the sockets */
+    struct ao2_container *streams;  /*!< streams owned by this worker, keyed by source + stream id */
+    struct frame_pool pool;         /*!< packages of all streams of this worker */
+    struct css_recorder_sink *normal; /*!< raw dump of everything received */
+    struct event *flush_ev;         /*!< pushes partly filled recording chunks to the writer */
+    struct event *stats_ev;         /*!< samples stream stats to the log, NULL if stats_interval is 0 */
+};
+
+static struct gmp_worker *gmp_workers;
+static struct gmp_endpoint gmp_endpoints[GMP_ENDPOINTS_MAX];
+static int gmp_endpoint_count;
+
+/*!
+ * \brief Live output of one stream name.
+ *
+ * Shared by the ingest stream of that name and the players watching it,
+ * so a player may subscribe before the encoder shows up and stays
+ * subscribed when the encoder restarts.
+ */
+struct gmp_channel {
+    char name[64];                  /*!< stream name, "ip:port/id" */
+    int users;                      /*!< streams and players holding it, protected by the gmp_channels lock */
+    struct ao2_container *clients;  /*!< players watching, fed by the worker owning the stream */
+
+    /*
+     * GOP cache: the frames since the last key frame, parameter sets
+     * included, so a new player starts right away instead of waiting up
+     * to a GOP for the next IDR.  Protected by the clients lock, which the
+     * worker holds while it adds a frame and feeds the players.
+     */
+    struct gmp_frame **gop;         /*!< gmp_gop_frames slots, NULL until the first key frame */
+    int gop_count;                  /*!< frames cached, 0 while no complete GOP start is held */
+    size_t gop_bytes;               /*!< payload bytes cached */
+};
+
+enum gmp_client_state {
+    GMP_CLIENT_WAIT,                /*!< subscribed, waiting for the first key frame */
+    GMP_CLIENT_SYNC,                /*!< every frame is queued */
+    GMP_CLIENT_LAG,                 /*!< queue went over the high watermark, shedding until a key frame */
+};
+
+/*!
+ * \brief A player connected to the play port.
+ *
+ * The player sends "PLAY <stream>\r\n", is answered "OK <stream>\r\n"
+ * and then receives the assembled H.264 frames of that stream, starting
+ * at a key frame.
+ *
+ * The output queue is bounded: once more than play_queue_high KB wait
+ * for a slow player, frames are shed until a key frame finds the queue
+ * below play_queue_low KB, so the player resyncs on a decodable frame
+ * instead of the server buffering without limit.
+ *
+ * "VOD <recording> [<sec>[.<frac>]]\r\n" plays a sort or segment
+ * recording instead, from the key frame at or before the time given.  The
+ * payload is queued as file segments, so libevent sends it with
+ * sendfile() straight from the page cache, a little at a time as the
+ * player drains it.
+ */
+struct gmp_client {
+    struct bufferevent *bev;        /*!< written by the ingest worker, so created thread safe */
+    volatile size_t queued;         /*!< output bytes waiting, kept by gmp_client_output_cb() */
+    char addr[32];                  /*!< "ip:port" of the player */
+    struct gmp_channel *channel;    /*!< NULL until the player sent PLAY */
+    int closing;                    /*!< close once the output is written */
+    struct timeval start;
+    enum gmp_client_state state;
+    unsigned int frames;            /*!< frames queued to the player */
+    uint64_t bytes;                 /*!< bytes queued to the player */
+    unsigned int lags;              /*!< times the queue went over the high watermark */
+    unsigned int dropped;           /*!< frames shed while lagging */
+    uint64_t dropped_bytes;
+    size_t queued_max;              /*!< largest queue seen, bytes */
+    struct timeval lag_start;       /*!< when the current lag started */
+    int64_t lag_ms;                 /*!< total time spent lagging, ms */
+    struct css_vod *vod;            /*!< recording played, NULL for live players */
+    struct evbuffer_file_segment *vod_seg;
+    int vod_frame;                  /*!< next frame to queue */
+    off_t vod_pos;                  /*!< next package of that frame */
+    char vod_name[64];
+};
+
+//按流名称索引的播放频道
+static struct ao2_container *gmp_channels;
+//所有播放连接
+static struct ao2_container *gmp_clients;
+static struct event_base *gmp_play_base;
+static pthread_t gmp_play_thread = CSS_PTHREADT_NULL;
+//录制写线程, 接收线程只向它排队, 不直接写盘
+static struct css_recorder *gmp_recorder;
+//录制参数
+static int gmp_record_chunk = DEFAULT_GMP_RECORD_CHUNK;
+static int gmp_record_chunks = DEFAULT_GMP_RECORD_CHUNKS;
+static int gmp_record_prealloc;
+static int gmp_record_direct;
+static int gmp_record_flush = DEFAULT_GMP_RECORD_FLUSH;
+static int gmp_record_es;
+//分段录制时长(秒), 0 表示不分段
+static int gmp_record_segment;
+//流统计写入日志的间隔(秒), 0 表示不写
+static int gmp_stats_interval;
+//流多久没有数据后释放(秒), 0 表示不释放
+static int gmp_stream_idle = DEFAULT_GMP_STREAM_IDLE;
+//播放端口, 0 表示不提供播放
+static int gmp_play_port = DEFAULT_GMP_PLAY_PORT;
+//播放端发送队列高低水位(KB)
+static int gmp_play_queue_high = DEFAULT_GMP_PLAY_QUEUE_HIGH;
+static int gmp_play_queue_low = DEFAULT_GMP_PLAY_QUEUE_LOW;
+//缓存最近关键帧组, 新播放端可立即开始
+static int gmp_gop_cache = 1;
+static int gmp_gop_frames = DEFAULT_GMP_GOP_FRAMES;
+static int gmp_gop_size = DEFAULT_GMP_GOP_SIZE;
+
+static int frame_pool_grow(struct frame_pool *pool)
 {
-    struct event_base *base = user_data;
-    struct bufferevent *bev;
+    struct frame_slab *slab;
+    int i;
 
-    bev = bufferevent_socket_new(base, fd, BEV_OPT_CLOSE_ON_FREE);
-    if (!bev) {
-            fprintf(stderr, "Error constructing bufferevent!");
-            event_base_loopbreak(base);
-            return;
+    if (!(slab = css_malloc(sizeof(*slab)))) {
+        return -1;
     }
-    bufferevent_setcb(bev, NULL, conn_writecb, conn_eventcb, NULL);
-    bufferevent_enable(bev, EV_WRITE);
-    bufferevent_disable(bev, EV_READ);
+    slab->next = pool->slabs;
+    pool->slabs = slab;
 
-    bufferevent_write(bev, MESSAGE, strlen(MESSAGE));
+    for (i = 0; i < GMP_POOL_SLAB_BLOCKS; i++) {
+        slab->blocks[i].pool = pool;
+        CSS_LIST_INSERT_HEAD(&pool->freelist, &slab->blocks[i], frame_block_list);
+    }
+    pool->total += GMP_POOL_SLAB_BLOCKS;
+    pool->available += GMP_POOL_SLAB_BLOCKS;
+
+    return 0;
 }
 
-static void conn_writecb(struct bufferevent *bev, void *user_data)
+static int frame_pool_init(struct frame_pool *pool, int blocks)
 {
-    struct evbuffer *output = bufferevent_get_output(bev);
-    if (evbuffer_get_length(output) == 0) {
-            printf("flushed answer\n");
-            bufferevent_free(bev);
+    memset(pool, 0, sizeof(*pool));
+    CSS_LIST_HEAD_INIT_NOLOCK(&pool->freelist);
+
+    while (pool->total < blocks) {
+        if (frame_pool_grow(pool)) {
+            return -1;
+        }
     }
+    return 0;
 }
 
-static void conn_eventcb(struct bufferevent *bev, short events, void *user_data)
+static void frame_pool_destroy(struct frame_pool *pool)
 {
-    if (events & BEV_EVENT_EOF) {
-            printf("Connection closed.\n");
-    } else if (events & BEV_EVENT_ERROR) {
-           // printf("Got an error on the connection: %s\n", strerror(errno));/*XXX win32*/
+    struct frame_slab *slab;
+
+    while ((slab = pool->slabs)) {
+        pool->slabs = slab->next;
+        css_free(slab);
     }
-    /* None of the other events can happen here, since we haven't enabled
-     * timeouts */
-    bufferevent_free(bev);
+    CSS_LIST_HEAD_INIT_NOLOCK(&pool->freelist);
+    pool->total = pool->available = 0;
 }
 
-static void signal_cb(evutil_socket_t sig, short events, void *user_data)
+/*! \brief Take a block from the pool, ready to receive GMP_MTU bytes */
+static struct frame_block *frame_pool_get(struct frame_pool *pool)
 {
-    struct event_base *base = user_data;
-    struct timeval delay = { 2, 0 };
+    struct frame_block *frame;
+
+    if (!pool->available && frame_pool_grow(pool)) {
+        return NULL;
+    }
+
+    frame = CSS_LIST_REMOVE_HEAD(&pool->freelist, frame_block_list);
+    pool->available--;
 
-    printf("Caught an interrupt signal; exiting cleanly in two seconds.\n");
+    frame->dataptr = frame->data;
+    frame->datalen = 0;
 
-    event_base_loopexit(base, &delay);
+    return frame;
 }
 
-void *css_monitor_init(void *data)
+void free_frame(struct frame_block * frame){
+    struct frame_pool *pool;
+
+    if (frame) {
+        frame->dataptr = NULL;
+        pool = frame->pool;
+        CSS_LIST_INSERT_HEAD(&pool->freelist, frame, frame_block_list);
+        pool->available++;
+    }   
+}
+
+static void gmp_frame_pool_init(void)
 {
-    int port = 9999;
-    struct event_base *base;
-    struct evconnlistener *listener;
-    struct event *signal_event;
-    struct sockaddr_in sin;
+    int i;
 
-    base = event_base_new();
-    if (!base) {
-        fprintf(stderr, "Could not initialize libevent!\n");
-        return NULL;
+    for (i = 0; i < GMP_FRAME_CLASSES; i++) {
+        CSS_LIST_HEAD_INIT(&gmp_frame_classes[i].free);
+        gmp_frame_classes[i].count = 0;
     }
+}
 
-    memset(&sin, 0, sizeof(sin));
-    sin.sin_family = AF_INET;
-    sin.sin_port = htons(port);
-
-    listener = evconnlistener_new_bind(base, listener_cb, (void *)base,
-        LEV_OPT_REUSEABLE|LEV_OPT_CLOSE_ON_FREE, -1,
-        (struct sockaddr*)&sin,
-        sizeof(sin));
+/*! \brief Get a frame buffer of at least \a size bytes */
+static struct gmp_frame_buf *gmp_frame_buf_get(size_t size)
+{
+    struct gmp_frame_buf *buf = NULL;
+    int cls = 0;
 
-    if (!listener) {
-        fprintf(stderr, "Could not create a listener!\n");
-        return NULL;
+    while (cls < GMP_FRAME_CLASSES && ((size_t) 1 << (cls + GMP_FRAME_MIN_SHIFT)) < size) {
+        cls++;
     }
 
-    signal_event = evsignal_new(base, SIGINT, signal_cb, (void *)base);
+    if (cls < GMP_FRAME_CLASSES) {
+        CSS_LIST_LOCK(&gmp_frame_classes[cls].free);
+        if ((buf = CSS_LIST_REMOVE_HEAD(&gmp_frame_classes[cls].free, list))) {
+            gmp_frame_classes[cls].count--;
+        }
+        CSS_LIST_UNLOCK(&gmp_frame_classes[cls].free);
+        if (buf) {
+            return buf;
+        }
+        size = (size_t) 1 << (cls + GMP_FRAME_MIN_SHIFT);
+    } else {
+        cls = -1;
+    }
 
-    if (!signal_event || event_add(signal_event, NULL)<0) {
-            fprintf(stderr, "Could not create/add a signal event!\n");
-            return NULL;
+    if (!(buf = css_malloc(sizeof(*buf) + size))) {
+        return NULL;
     }
+    buf->cls = cls;
+    buf->size = size;
 
-    event_base_dispatch(base);
+    return buf;
+}
 
-    evconnlistener_free(listener);
-    event_free(signal_event);
-    event_base_free(base);
+static void gmp_frame_buf_put(struct gmp_frame_buf *buf)
+{
+    struct gmp_frame_class *fc;
 
-    css_log(LOG_NOTICE,"css monitor done!\n");
+    if (buf->cls < 0) {
+        css_free(buf);
+        return;
+    }
+
+    fc = &gmp_frame_classes[buf->cls];
+    CSS_LIST_LOCK(&fc->free);
+    if (fc->count < GMP_FRAME_POOL_MAX) {
+        CSS_LIST_INSERT_HEAD(&fc->free, buf, list);
+        fc->count++;
+        buf = NULL;
+    }
+    CSS_LIST_UNLOCK(&fc->free);
 
+    if (buf) {
+        css_free(buf);
+    }
 }
 
-void free_frame(struct frame_block * frame){
-    if (frame) {
-        if (frame->dataptr) {
-            free(frame->dataptr);
-        }   
-        free(frame);
-    }   
+static void gmp_frame_destroy(void *obj)
+{
+    struct gmp_frame *frame = obj;
+
+    if (frame->buf) {
+        gmp_frame_buf_put(frame->buf);
+        frame->buf = NULL;
+    }
 }
 
-/*submit the gmh h264 package from old UR to cur UR */
-int submit_gmh_h264_package(int old_espect_seq, int espect_seq)
-{   
-    if (old_espect_seq == espect_seq) return 1;
-    long cur_ts = 0;
-    int last_seq = 0;
-    struct frame_block * first_addr = NULL;
-    struct frame_block * frame_piece;
-    int res;
-    FILE *file = sortfile;
+/*! \brief Append \a len bytes to a frame, moving it to a larger buffer if needed */
+static int gmp_frame_append(struct gmp_frame *frame, const char *data, size_t len)
+{
+    struct gmp_frame_buf *buf;
 
-    //上一帧小于当前帧，加入缓冲buff
-    if (old_espect_seq < espect_seq) {
-        int i = old_espect_seq;
-        for (; i<espect_seq; i++) {
-            int j = OFF_SET(i);
-            if (reception_buffer[j]) {
-                CSS_LIST_INSERT_TAIL(&framepq, reception_buffer[j], frame_block_list);
-                reception_buffer[j] = 0;
-            }
+    if (!frame->buf || frame->len + len > frame->buf->size) {
+        if (!(buf = gmp_frame_buf_get(MAX(frame->len + len, frame->buf ? frame->buf->size * 2 : 0)))) {
+            return -1;
         }
-    //上一帧大于当前帧，加入缓冲区
-    } else {
-        espect_seq += SEQ_MAX;
-        int i = old_espect_seq;
-        for (; i<espect_seq; i++) {
-            int j = OFF_SET_SEQ(i);
-            int k = OFF_SET(j);
-            if (reception_buffer[k]) {
-                CSS_LIST_INSERT_TAIL(&framepq, reception_buffer[k], frame_block_list);
-                reception_buffer[k] = 0;
-            }
+        if (frame->buf) {
+            memcpy(buf->data, frame->buf->data, frame->len);
+            gmp_frame_buf_put(frame->buf);
         }
-    }   
- 
-    frame_piece = CSS_LIST_FIRST(&framepq);
- 
-    while (frame_piece) {
-        char *pdata = frame_piece->dataptr;
-        int datalen = frame_piece->datalen;
-        struct frame_block * new_frame = frame_piece->frame_block_list.next;
-        
-        if (!(res = fwrite(pdata,sizeof(char),datalen,file))) {
-            css_log(LOG_WARNING,"fwrite error :%d , %s, seq %d \n", res, strerror(errno), frame_piece->seq);
-        }
-        
-        if (frame_piece->seq != (lastseq+1)) {
-             css_log(LOG_ERROR,"==========\n==========\n=======\n=====\n=================LAST SEQ:%d======CUR SEQ:%d===========\n", lastseq, frame_piece->seq);
-        }
-        
-        css_log(LOG_NOTICE,"GET OUT FRAME SEQ:%d\n", frame_piece->seq);
-        
-        lastseq = frame_piece->seq;
-        
-        CSS_LIST_REMOVE(&framepq,frame_piece,frame_block_list);
-        free_frame(frame_piece);
-        frame_piece = new_frame;  
+        frame->buf = buf;
     }
-    
+
+    memcpy(frame->buf->data + frame->len, data, len);
+    frame->len += len;
+
     return 0;
 }
 
-int gmh_h264_package_build(char *buf)
+/*! \brief Pick the release deadline of a stream from its statistics */
+static void gmp_stream_update_depth(struct gmp_stream *stream)
 {
-    int offset_seq = 0;
-    struct frame_block *frame_block_ptr = NULL;
-    unsigned int seqno, ptrlen, timestamp_s, timestamp_ns;  
-    unsigned char *gmpheader = (unsigned char *)buf;
-    struct timeval tv_timer;
-    
-    //解析媒体类型
-    if(gmpheader[5] == 0x00) {
-        //css_log(LOG_NOTICE, "REC BUF[5] TYEP 0X00 h264\n");
-    } else {
-        css_log(LOG_ERROR, "REC BUF[5] TYPE NOT h264 %02x\n", gmpheader[5]);
+    unsigned int target, sum = 0;
+    int b, depth;
+
+    if (gmp_reorder_mode != GMP_REORDER_ADAPTIVE) {
+        stream->depth = gmp_reorder_timeout;
+        return;
     }
-    
-    //包号
-    seqno = (*(unsigned int *)(gmpheader+11));
-    
-    offset_seq = OFF_SET(seqno);
-    
-    //mb mean the bottom of the window                
-    int uh_seq = (max_seq - seqno + SEQ_MAX) % SEQ_MAX;
-    int win_bottom = (max_seq - REORDERING_WINDOW_SIZE + SEQ_MAX) % SEQ_MAX; 
-    int seq_wb = (seqno - win_bottom + SEQ_MAX) % SEQ_MAX;
-    int ur_wb = (espect_seq - win_bottom + SEQ_MAX) % SEQ_MAX;
-    
-   // css_log(LOG_WARNING, "uh_seq:%d, win_bot:%d, seq_wb:%d, ur_wb:%d off_seq:%d\n", uh_seq,win_bottom,seq_wb,ur_wb,offset_seq);
-    //css_log(LOG_WARNING, "UH:%d, win:%d, seq_wb:%d, ur_wb:%d\n", uh_seq,win_bottom,seq_wb,ur_wb);
-    
-    //包长度
-    ptrlen = ((*(unsigned int *)(gmpheader+15)));
-    //时间戳
-    timestamp_s = (*(unsigned int *)(gmpheader+19));
-    timestamp_ns = (*(unsigned int *)(gmpheader+23));
-    //报文类型
-    int p_type;
-    //64
-    if(gmpheader[6] == 0x40){
-        p_type = gmp_h264_media_type_frame_begin;
-    //65
-    } else if(gmpheader[6] == 0x41) {
-        p_type = gmp_h264_media_type_frame_other;
-    //66
-    } else if(gmpheader[6] == 0x42) {
-        p_type = gmp_h264_media_type_frame_end;
-    //67
-    } else if(gmpheader[6] == 0x43) {
-        p_type = gmp_h264_media_type_frame_only;
-    } else {
-        css_log(LOG_ERROR, "can not parse package type %02x\n", buf[6]);
-        return -1;
+
+    //到达抖动决定下限
+    depth = MAX(gmp_reorder_min, GMP_JITTER_FACTOR * (int) (stream->jitter >> 4) / 1000);
+
+    //目标百分位的缺包在此时间内补齐
+    if (stream->gap_samples >= GMP_GAP_MIN_SAMPLES) {
+        target = (stream->gap_samples * gmp_reorder_percentile + 99) / 100;
+        for (b = 0; b < GMP_GAP_BUCKETS; b++) {
+            if ((sum += stream->gap_hist[b]) >= target) {
+                break;
+            }
+        }
+        depth = MAX(depth, gmp_gap_bounds[MIN(b, GMP_GAP_BUCKETS - 1)]);
     }
-   // css_log(LOG_NOTICE, "Ptrlen:%d, Time_s:%d, Time_ns:%d, Ptype:%02x, SEQ:%d\n", ptrlen, timestamp_s, timestamp_ns, p_type, seqno);
-    
-    //落入窗体内的数据包
-    if (uh_seq < REORDERING_WINDOW_SIZE && seq_wb < ur_wb) {    
-        css_log(LOG_ERROR, "SEQ :%d OUT SORT WINDOWS\n", seqno);
-        return 0;
+
+    stream->depth = MIN(depth, gmp_reorder_timeout);
+}
+
+/*! \brief Record how long a gap took to fill (or how late its package came) */
+static void gmp_stream_gap_sample(struct gmp_stream *stream, int64_t ms)
+{
+    int b;
+
+    for (b = 0; b < GMP_GAP_BUCKETS - 1 && ms > gmp_gap_bounds[b]; b++) {
     }
-    
-    //分配缓冲包数量
-    if(!reception_buffer){
-        if(!(reception_buffer = calloc(RECEPTION_BUFFER_LENGTH, sizeof(struct frame_block*)))){
-            css_log(LOG_ERROR, "calloc reception buffer failed\n");
+    stream->gap_hist[b]++;
+
+    if (++stream->gap_samples >= GMP_GAP_DECAY) {
+        stream->gap_samples = 0;
+        for (b = 0; b < GMP_GAP_BUCKETS; b++) {
+            stream->gap_hist[b] >>= 1;
+            stream->gap_samples += stream->gap_hist[b];
         }
     }
- 
-    //分配内存存储buf数据
-    if (!reception_buffer[offset_seq]) {                    
-        frame_block_ptr = (struct frame_block *)calloc(1, sizeof(struct frame_block));
-        if (!frame_block_ptr) {
-            css_log(LOG_WARNING, "struct frame_block alloca failed!\n");
-            return -1;
+
+    gmp_stream_update_depth(stream);
+}
+
+/*! \brief Update the interarrival jitter with one package, RFC 3550 A.8 */
+static void gmp_stream_jitter_sample(struct gmp_stream *stream, const struct timeval *now, unsigned int ts, unsigned int tns)
+{
+    int64_t transit, d;
+
+    transit = (int64_t) now->tv_sec * 1000000 + now->tv_usec - ((int64_t) ts * 1000000 + tns / 1000);
+
+    if (stream->have_transit) {
+        d = transit - stream->last_transit;
+        if (d < 0) {
+            d = -d;
         }
-        
-        frame_block_ptr->seq = seqno; 
-        frame_block_ptr->ts = timestamp_s;
-        frame_block_ptr->tns = timestamp_ns;
-        frame_block_ptr->datalen = ptrlen;
-        frame_block_ptr->frame_type = p_type;
-        frame_block_ptr->dataptr = (char *)calloc(ptrlen, sizeof(char));
-        
-        if (!frame_block_ptr->dataptr) {
-            css_log(LOG_WARNING, "struct frame_block's dataptr alloca failed!\n");
-            free(frame_block_ptr);
-            return -1;
+        if (d > INT_MAX) {
+            d = INT_MAX;
         }
-        
-        char *pdata = (char *)buf; 
-        memcpy(frame_block_ptr->dataptr, pdata, ptrlen);
+        stream->jitter += (unsigned int) d - ((stream->jitter + 8) >> 4);
+    }
+    stream->last_transit = transit;
+    stream->have_transit = 1;
+}
 
-        //
-        reception_buffer[offset_seq] = frame_block_ptr;
+/*! \brief Start waiting for a gap: note the time and arm the flush timer */
+static void gmp_stream_arm(struct gmp_stream *stream)
+{
+    struct timeval tv = css_tv(stream->depth / 1000, (stream->depth % 1000) * 1000);
 
-        //判断是否落入排序窗
-        if (uh_seq < REORDERING_WINDOW_SIZE) {
+    event_base_gettimeofday_cached(event_get_base(stream->flush_ev), &stream->order_timer);
+    stream->time_seq = stream->max_seq;
+    evtimer_add(stream->flush_ev, &tv);
+}
 
-            //seq< uh && seq = ur, put ur~next_ur(Less than uh)
-            if (seqno == espect_seq) {
-                old_espect_seq = espect_seq;
-                int i = OFF_SET_SEQ(espect_seq + 1);
-                win_bottom = (max_seq - REORDERING_WINDOW_SIZE + SEQ_MAX) % SEQ_MAX;
-                int i_wb = (i - win_bottom + SEQ_MAX) % SEQ_MAX;
-                int uh_wb = (max_seq - win_bottom + SEQ_MAX) % SEQ_MAX;
-                for (; i_wb <= uh_wb; i++) {                                    
-                    int j = OFF_SET_SEQ(i);             
-                    int k = OFF_SET(j);
-                    if (!reception_buffer[k]) {
-                        espect_seq = j;
-                        break;
-                    }   
-                }
-                //加入共享缓冲区
-                submit_gmh_h264_package(old_espect_seq, espect_seq);
-            } 
-            //                  
-        } else {
-            //                  
-            int max_tmp = seqno + 1;
-            max_seq = OFF_SET_SEQ(max_tmp);
+static int gmp_client_hash(const void *obj, const int flags)
+{
+    return (int)(((uintptr_t) obj >> 4) & INT_MAX);
+}
 
-            int uh_ur = (max_seq - espect_seq + SEQ_MAX) % SEQ_MAX;                        
-            if (uh_ur < REORDERING_WINDOW_SIZE) {//UR at inside of reordering window
+static int gmp_channel_hash(const void *obj, const int flags)
+{
+    const struct gmp_channel *channel = obj;
 
-                //seq > uh && seq = ur, put ur~next_ur(Less than uh)
-                if (seqno == espect_seq) {                              
-                    old_espect_seq = espect_seq;
-                    int i = espect_seq + 1;
-                    win_bottom = (max_seq - REORDERING_WINDOW_SIZE + SEQ_MAX) % SEQ_MAX;
-                    int i_wb = (i - win_bottom + SEQ_MAX) % SEQ_MAX;
-                    int uh_wb = (max_seq - win_bottom + SEQ_MAX) % SEQ_MAX;
-                    for (; i_wb <= uh_wb; i++) {                                
-                        int j = OFF_SET_SEQ(i);
-                        int k = OFF_SET(j);
-                        if (!reception_buffer[k]) {
-                            espect_seq = j;
-                            break;
-                        }   
-                    }
-                    //加入共享缓冲区
-                    submit_gmh_h264_package(old_espect_seq, espect_seq);
-                } 
-            } else {//UR at outside of reordering window
-                old_espect_seq = espect_seq;
-                int i = (max_seq - REORDERING_WINDOW_SIZE + SEQ_MAX) % SEQ_MAX;
-                win_bottom = (max_seq - REORDERING_WINDOW_SIZE + SEQ_MAX) % SEQ_MAX;
-                int i_wb = (i - win_bottom + SEQ_MAX) % SEQ_MAX;
-                int uh_wb = (max_seq - win_bottom + SEQ_MAX) % SEQ_MAX;
-                for (; i_wb <= uh_wb; i++) {                            
-                    int j = OFF_SET_SEQ(i);
-                    int k = OFF_SET(j);
+    return css_str_hash(channel->name);
+}
+
+static int gmp_channel_cmp(void *obj, void *arg, int flags)
+{
+    const struct gmp_channel *c1 = obj, *c2 = arg;
+
+    return !strcmp(c1->name, c2->name) ? CMP_MATCH | CMP_STOP : 0;
+}
+
+/*! \brief Forget the cached GOP, the caller holds the clients lock */
+static void gmp_gop_clear(struct gmp_channel *channel)
+{
+    while (channel->gop_count) {
+        ao2_ref(channel->gop[--channel->gop_count], -1);
+    }
+    channel->gop_bytes = 0;
+}
+
+/*!
+ * \brief Add an ordered frame to the GOP cache, the caller holds the clients lock.
+ *
+ * A key frame starts a new GOP, unless the cache only holds the parameter
+ * sets leading it.  A GOP that outgrows the limits is dropped, the cache
+ * stays empty until the next key frame.
+ */
+static void gmp_gop_add(struct gmp_channel *channel, struct gmp_frame *frame)
+{
+    if (frame->key && (!channel->gop_count || channel->gop[channel->gop_count - 1]->slice)) {
+        gmp_gop_clear(channel);
+    } else if (!channel->gop_count) {
+        //还没有关键帧, 缓存的帧无法解码
+        return;
+    }
+
+    if (!channel->gop && !(channel->gop = css_calloc(gmp_gop_frames, sizeof(*channel->gop)))) {
+        return;
+    }
+
+    if (channel->gop_count == gmp_gop_frames || channel->gop_bytes + frame->len > (size_t) gmp_gop_size * 1024) {
+        gmp_gop_clear(channel);
+        return;
+    }
+
+    ao2_ref(frame, +1);
+    channel->gop[channel->gop_count++] = frame;
+    channel->gop_bytes += frame->len;
+}
+
+static void gmp_channel_destroy(void *obj)
+{
+    struct gmp_channel *channel = obj;
+
+    gmp_gop_clear(channel);
+    if (channel->gop) {
+        css_free(channel->gop);
+        channel->gop = NULL;
+    }
+
+    if (channel->clients) {
+        ao2_ref(channel->clients, -1);
+        channel->clients = NULL;
+    }
+}
+
+/*!
+ * \brief Find the channel of a stream name, creating it on first use.
+ *
+ * \return a referenced channel, give it back with gmp_channel_put().
+ */
+static struct gmp_channel *gmp_channel_get(const char *name)
+{
+    struct gmp_channel tmp, *channel;
+
+    css_copy_string(tmp.name, name, sizeof(tmp.name));
+
+    ao2_lock(gmp_channels);
+    if (!(channel = ao2_find(gmp_channels, &tmp, OBJ_POINTER))) {
+        if (!(channel = ao2_alloc(sizeof(*channel), gmp_channel_destroy))) {
+            ao2_unlock(gmp_channels);
+            return NULL;
+        }
+        css_copy_string(channel->name, name, sizeof(channel->name));
+        if (!(channel->clients = ao2_container_alloc(GMP_CLIENT_BUCKETS, gmp_client_hash, NULL))) {
+            ao2_unlock(gmp_channels);
+            ao2_ref(channel, -1);
+            return NULL;
+        }
+        ao2_link(gmp_channels, channel);
+    }
+    channel->users++;
+    ao2_unlock(gmp_channels);
+
+    return channel;
+}
+
+static void gmp_channel_put(struct gmp_channel *channel)
+{
+    ao2_lock(gmp_channels);
+    if (!--channel->users) {
+        ao2_unlink(gmp_channels, channel);
+    }
+    ao2_unlock(gmp_channels);
+    ao2_ref(channel, -1);
+}
+
+/*! \brief evbuffer cleanup of a frame queued by reference: the player has it sent */
+static void gmp_frame_release(const void *data, size_t len, void *arg)
+{
+    ao2_ref(arg, -1);
+}
+
+static void gmp_client_queue(struct gmp_client *client, struct evbuffer *output, struct gmp_frame *frame)
+{
+    //所有播放端共享同一帧缓冲, 只增加引用
+    ao2_ref(frame, +1);
+    if (evbuffer_add_reference(output, frame->buf->data, frame->len, gmp_frame_release, frame)) {
+        ao2_ref(frame, -1);
+        return;
+    }
+    client->frames++;
+    client->bytes += frame->len;
+}
+
+/*!
+ * \brief Start a new player on the cached GOP, the caller holds the clients lock.
+ *
+ * \retval the number of frames queued, 0 if nothing is cached and the
+ * player has to wait for the next key frame.
+ */
+static int gmp_client_prime(struct gmp_client *client, struct gmp_channel *channel)
+{
+    struct evbuffer *output = bufferevent_get_output(client->bev);
+    int i;
+
+    for (i = 0; i < channel->gop_count; i++) {
+        gmp_client_queue(client, output, channel->gop[i]);
+    }
+    if (channel->gop_count) {
+        client->state = GMP_CLIENT_SYNC;
+    }
+
+    return channel->gop_count;
+}
+
+/*!
+ * \brief Queue a frame to one player, shedding it if the player lags.
+ *
+ * Runs on the worker owning the stream, under the lock of the channel
+ * player container.
+ */
+static int gmp_client_send_frame(void *obj, void *arg, int flags)
+{
+    struct gmp_client *client = obj;
+    struct gmp_frame *frame = arg;
+    struct evbuffer *output = bufferevent_get_output(client->bev);
+    size_t queued = evbuffer_get_length(output);
+
+    if (queued > client->queued_max) {
+        client->queued_max = queued;
+    }
+
+    switch (client->state) {
+    case GMP_CLIENT_WAIT:
+        //从关键帧开始发送, 之前的帧无法解码
+        if (!frame->key) {
+            return 0;
+        }
+        client->state = GMP_CLIENT_SYNC;
+        break;
+    case GMP_CLIENT_SYNC:
+        if (queued + frame->len <= (size_t) gmp_play_queue_high * 1024) {
+            break;
+        }
+        //播放端跟不上, 丢弃到下一个关键帧
+        client->state = GMP_CLIENT_LAG;
+        client->lag_start = css_tvnow();
+        client->lags++;
+        client->dropped++;
+        client->dropped_bytes += frame->len;
+        return 0;
+    case GMP_CLIENT_LAG:
+        if (!frame->key || queued > (size_t) gmp_play_queue_low * 1024) {
+            client->dropped++;
+            client->dropped_bytes += frame->len;
+            return 0;
+        }
+        client->state = GMP_CLIENT_SYNC;
+        client->lag_ms += css_tvdiff_ms(css_tvnow(), client->lag_start);
+        break;
+    }
+
+    gmp_client_queue(client, output, frame);
+
+    return 0;
+}
+
+static int gmp_stream_hash(const void *obj, const int flags)
+{
+    const struct gmp_stream *stream = obj;
+
+    return (int)((stream->addr.sin_addr.s_addr ^ ((unsigned int) stream->addr.sin_port << 16) ^ stream->stream_id) & INT_MAX);
+}
+
+static int gmp_stream_cmp(void *obj, void *arg, int flags)
+{
+    const struct gmp_stream *s1 = obj, *s2 = arg;
+
+    return (s1->addr.sin_addr.s_addr == s2->addr.sin_addr.s_addr &&
+            s1->addr.sin_port == s2->addr.sin_port &&
+            s1->stream_id == s2->stream_id) ? CMP_MATCH | CMP_STOP : 0;
+}
+
+/*! \brief Close the current segment */
+static void gmp_stream_segment_close(struct gmp_stream *stream)
+{
+    if (stream->seg_dropped) {
+        css_log(LOG_WARNING, "gmp stream %s: %u frames did not fit in segment %u and were not recorded\n",
+                stream->name, stream->seg_dropped, stream->seg_start);
+    }
+    css_recorder_close(stream->seg);
+    css_recorder_close(stream->seg_index);
+    stream->seg = stream->seg_index = NULL;
+}
+
+/*!
+ * \brief Release what only the owning worker may touch, before the stream is unlinked.
+ *
+ * The package blocks go back to the unlocked pool of the worker, the timer
+ * lives on its base and the sinks belong to its recorder queue.  The CLI
+ * can hold the last reference of an unlinked stream, so none of this may
+ * wait for the destructor.
+ */
+static void gmp_stream_release(struct gmp_stream *stream)
+{
+    struct frame_block *frame;
+    int i;
+
+    for (i = 0; i < RECEPTION_BUFFER_LENGTH; i++) {
+        free_frame(stream->reception_buffer[i]);
+        stream->reception_buffer[i] = NULL;
+    }
+    while ((frame = CSS_LIST_REMOVE_HEAD(&stream->framepq, frame_block_list))) {
+        free_frame(frame);
+    }
+    if (stream->flush_ev) {
+        event_free(stream->flush_ev);
+        stream->flush_ev = NULL;
+    }
+    if (stream->sink) {
+        css_recorder_close(stream->sink);
+        stream->sink = NULL;
+    }
+    if (stream->es) {
+        css_recorder_close(stream->es);
+        stream->es = NULL;
+    }
+    if (stream->seg) {
+        gmp_stream_segment_close(stream);
+    }
+}
+
+/*! \brief Stream destructor, runs on whichever thread drops the last reference */
+static void gmp_stream_destroy(void *obj)
+{
+    struct gmp_stream *stream = obj;
+
+    if (stream->partial) {
+        ao2_ref(stream->partial, -1);
+        stream->partial = NULL;
+    }
+    if (stream->channel) {
+        //编码器重连后旧的关键帧组不能再用
+        ao2_lock(stream->channel->clients);
+        gmp_gop_clear(stream->channel);
+        ao2_unlock(stream->channel->clients);
+        gmp_channel_put(stream->channel);
+        stream->channel = NULL;
+    }
+}
+
+/*!
+ * \brief Find the stream a datagram belongs to, creating it on first sight.
+ *
+ * \return a referenced stream, the caller must ao2_ref(stream, -1) it.
+ */
+static struct gmp_stream *gmp_stream_get(struct gmp_worker *worker, const struct sockaddr_in *addr, unsigned int stream_id)
+{
+    struct gmp_stream tmp, *stream;
+    char filename[PATH_MAX];
+
+    tmp.addr = *addr;
+    tmp.stream_id = stream_id;
+
+    if ((stream = ao2_find(worker->streams, &tmp, OBJ_POINTER))) {
+        return stream;
+    }
+
+    if (!(stream = ao2_alloc(sizeof(*stream), gmp_stream_destroy))) {
+        css_log(LOG_ERROR, "gmp stream alloca failed!\n");
+        return NULL;
+    }
+
+    stream->addr = *addr;
+    stream->stream_id = stream_id;
+    stream->pool = &worker->pool;
+    stream->worker = worker->index;
+    event_base_gettimeofday_cached(worker->base, &stream->last_seen);
+    gmp_stream_update_depth(stream);
+    snprintf(stream->name, sizeof(stream->name), "%s:%d/%u",
+            css_inet_ntoa(addr->sin_addr), ntohs(addr->sin_port), stream_id);
+    CSS_LIST_HEAD_INIT_NOLOCK(&stream->framepq);
+
+    if (!(stream->flush_ev = evtimer_new(worker->base, gmp_stream_flush_cb, stream))) {
+        css_log(LOG_ERROR, "gmp stream %s timer alloca failed!\n", stream->name);
+        ao2_ref(stream, -1);
+        return NULL;
+    }
+
+    snprintf(filename, sizeof(filename), "%s/sort-%s-%d-%u.h264",
+            sortpathname, css_inet_ntoa(addr->sin_addr), ntohs(addr->sin_port), stream_id);
+    if (!(stream->sink = css_recorder_open(gmp_recorder, worker->index, filename))) {
+        css_log(LOG_ERROR, "gmp stream %s open %s failed\n", stream->name, filename);
+        gmp_stream_release(stream);
+        ao2_ref(stream, -1);
+        return NULL;
+    }
+
+    if (gmp_record_es) {
+        snprintf(filename, sizeof(filename), "%s/es-%s-%d-%u.h264",
+                sortpathname, css_inet_ntoa(addr->sin_addr), ntohs(addr->sin_port), stream_id);
+        if (!(stream->es = css_recorder_open(gmp_recorder, worker->index, filename))) {
+            css_log(LOG_WARNING, "gmp stream %s open %s failed, frames are not recorded\n", stream->name, filename);
+        }
+    }
+
+    if (gmp_channels && !(stream->channel = gmp_channel_get(stream->name))) {
+        css_log(LOG_WARNING, "gmp stream %s channel alloca failed, it can not be played\n", stream->name);
+    }
+
+    ao2_link(worker->streams, stream);
+    css_log(LOG_NOTICE, "new gmp stream %s on worker %d\n", stream->name, worker->index);
+
+    return stream;
+}
+
+/*!
+ * \brief Tell whether an Annex B frame starts a decodable sequence.
+ *
+ * A frame with parameter sets but no slice is a key frame too when it
+ * carries an SPS, the encoder sends the IDR picture right after it.
+ */
+static void gmp_frame_scan(struct gmp_frame *frame)
+{
+    unsigned int info = css_h264_frame_info((unsigned char *) frame->buf->data, frame->len);
+
+    frame->slice = (info & CSS_H264_HAS_SLICE) ? 1 : 0;
+    frame->key = frame->slice ? (info & CSS_H264_HAS_IDR) != 0 : (info & CSS_H264_HAS_SPS) != 0;
+}
+
+/*! \brief Start a new recording segment with a key frame */
+static int gmp_stream_segment_open(struct gmp_stream *stream, struct gmp_frame *frame)
+{
+    struct css_segment_header hdr;
+    char filename[PATH_MAX];
+
+    snprintf(filename, sizeof(filename), "%s/seg-%s-%d-%u-%u.h264", sortpathname,
+            css_inet_ntoa(stream->addr.sin_addr), ntohs(stream->addr.sin_port), stream->stream_id, frame->ts);
+    if (!(stream->seg = css_recorder_open(gmp_recorder, stream->worker, filename))) {
+        return -1;
+    }
+
+    snprintf(filename, sizeof(filename), "%s/seg-%s-%d-%u-%u.idx", sortpathname,
+            css_inet_ntoa(stream->addr.sin_addr), ntohs(stream->addr.sin_port), stream->stream_id, frame->ts);
+    if (!(stream->seg_index = css_recorder_open(gmp_recorder, stream->worker, filename))) {
+        css_recorder_close(stream->seg);
+        stream->seg = NULL;
+        return -1;
+    }
+    //续写已有的索引时不再写文件头
+    if (!css_recorder_tell(stream->seg_index)) {
+        css_segment_header_init(&hdr);
+        css_recorder_write(stream->seg_index, &hdr, sizeof(hdr));
+    }
+    stream->seg_start = frame->ts;
+    stream->seg_dropped = 0;
+
+    return 0;
+}
+
+/*!
+ * \brief Record a frame to the current segment and index it.
+ *
+ * A new segment starts at the first key frame record_segment seconds
+ * after the start of the current one, so every segment can be decoded
+ * on its own.  It starts earlier when the segment nears the 4 GiB its
+ * index can address; a frame that still does not fit is counted, not
+ * recorded.
+ */
+static void gmp_stream_segment_write(struct gmp_stream *stream, struct gmp_frame *frame)
+{
+    struct css_segment_frame entry;
+    struct css_segment_record rec;
+
+    //同一秒内换段会打开同名文件续写, 要等到下一秒
+    if (stream->seg && frame->key && (frame->ts - stream->seg_start >= (unsigned int) gmp_record_segment ||
+        (css_recorder_tell(stream->seg) >= GMP_SEGMENT_ROTATE_SIZE && frame->ts != stream->seg_start))) {
+        gmp_stream_segment_close(stream);
+    }
+    if (!stream->seg && (!frame->key || gmp_stream_segment_open(stream, frame))) {
+        return;
+    }
+
+    entry.sec = frame->ts;
+    entry.nsec = frame->tns;
+    entry.offset = css_recorder_tell(stream->seg);
+    entry.size = frame->len;
+    entry.idr = frame->key;
+    if (entry.offset + frame->len > UINT32_MAX || frame->len > CSS_SEGMENT_SIZE_MAX) {
+        stream->seg_dropped++;
+        return;
+    }
+    //写入不完整的帧不进索引
+    if (css_recorder_write(stream->seg, frame->buf->data, frame->len)) {
+        return;
+    }
+    css_segment_record_pack(&rec, &entry);
+    css_recorder_write(stream->seg_index, &rec, sizeof(rec));
+}
+
+/*! \brief A complete frame leaves the assembly stage */
+static void gmp_stream_frame_out(struct gmp_stream *stream, struct gmp_frame *frame)
+{
+    stream->stats.frames++;
+    gmp_frame_scan(frame);
+
+    if (gmp_record_segment) {
+        gmp_stream_segment_write(stream, frame);
+    }
+
+    if (stream->es) {
+        css_recorder_write(stream->es, frame->buf->data, frame->len);
+    }
+
+    if (stream->channel) {
+        //缓存与分发在同一把锁内, 新播放端不会重复或漏掉帧
+        ao2_lock(stream->channel->clients);
+        if (gmp_gop_cache) {
+            gmp_gop_add(stream->channel, frame);
+        }
+        if (ao2_container_count(stream->channel->clients)) {
+            ao2_callback(stream->channel->clients, OBJ_NODATA, gmp_client_send_frame, frame);
+        }
+        ao2_unlock(stream->channel->clients);
+    }
+}
+
+static void gmp_stream_frame_drop(struct gmp_stream *stream)
+{
+    if (stream->partial) {
+        stream->stats.frames_dropped++;
+        ao2_ref(stream->partial, -1);
+        stream->partial = NULL;
+    }
+}
+
+/*!
+ * \brief Assembly stage: join the ordered packages of a stream into frames.
+ *
+ * begin/other/end packages are concatenated without their GMP headers;
+ * a frame that misses a package (sequence gap, or a new begin/only
+ * package before its end) is dropped whole.
+ */
+static void gmp_stream_assemble(struct gmp_stream *stream, struct frame_block *pkg)
+{
+    struct gmp_frame *frame;
+    const char *payload = pkg->dataptr + GMP_HEADER_LEN;
+    size_t len = pkg->datalen > GMP_HEADER_LEN ? pkg->datalen - GMP_HEADER_LEN : 0;
+
+    switch (pkg->frame_type) {
+    case gmp_h264_media_type_frame_begin:
+    case gmp_h264_media_type_frame_only:
+        gmp_stream_frame_drop(stream);
+        if (!(frame = ao2_alloc(sizeof(*frame), gmp_frame_destroy))) {
+            stream->stats.frames_dropped++;
+            return;
+        }
+        frame->ts = pkg->ts;
+        frame->tns = pkg->tns;
+        frame->first_seq = frame->last_seq = pkg->seq;
+        if (gmp_frame_append(frame, payload, len)) {
+            ao2_ref(frame, -1);
+            stream->stats.frames_dropped++;
+            return;
+        }
+        if (pkg->frame_type == gmp_h264_media_type_frame_only) {
+            gmp_stream_frame_out(stream, frame);
+            ao2_ref(frame, -1);
+        } else {
+            stream->partial = frame;
+        }
+        break;
+    case gmp_h264_media_type_frame_other:
+    case gmp_h264_media_type_frame_end:
+        if (!(frame = stream->partial)) {
+            //开始包丢失, 等下一个开始包
+            break;
+        }
+        if (OFF_SET_SEQ(frame->last_seq + 1) != pkg->seq || gmp_frame_append(frame, payload, len)) {
+            gmp_stream_frame_drop(stream);
+            break;
+        }
+        frame->last_seq = pkg->seq;
+        if (pkg->frame_type == gmp_h264_media_type_frame_end) {
+            stream->partial = NULL;
+            gmp_stream_frame_out(stream, frame);
+            ao2_ref(frame, -1);
+        }
+        break;
+    }
+}
+
+/*!
+ * \brief Hand the sorted packages of a stream to the recorder and the
+ * assembly stage, and give them back to the pool.
+ */
+static void gmp_stream_write(struct gmp_stream *stream)
+{
+    struct frame_block *frame;
+
+    while ((frame = CSS_LIST_REMOVE_HEAD(&stream->framepq, frame_block_list))) {
+        css_recorder_write(stream->sink, frame->dataptr, frame->datalen);
+        gmp_stream_assemble(stream, frame);
+        free_frame(frame);
+    }
+}
+
+/*submit the gmh h264 package from old UR to cur UR */
+int submit_gmh_h264_package(struct gmp_stream *stream, int old_espect_seq, int espect_seq)
+{   
+    if (old_espect_seq == espect_seq) return 1;
+    struct frame_block * frame_piece;
+    struct frame_block **reception_buffer = stream->reception_buffer;
+
+    //上一帧小于当前帧，加入缓冲buff
+    if (old_espect_seq < espect_seq) {
+        int i = old_espect_seq;
+        for (; i<espect_seq; i++) {
+            int j = OFF_SET(i);
+            if (reception_buffer[j]) {
+                CSS_LIST_INSERT_TAIL(&stream->framepq, reception_buffer[j], frame_block_list);
+                reception_buffer[j] = 0;
+            }
+        }
+    //上一帧大于当前帧，加入缓冲区
+    } else {
+        espect_seq += SEQ_MAX;
+        int i = old_espect_seq;
+        for (; i<espect_seq; i++) {
+            int j = OFF_SET_SEQ(i);
+            int k = OFF_SET(j);
+            if (reception_buffer[k]) {
+                CSS_LIST_INSERT_TAIL(&stream->framepq, reception_buffer[k], frame_block_list);
+                reception_buffer[k] = 0;
+            }
+        }
+    }   
+ 
+    //只计数, 不在热路径上写日志
+    CSS_LIST_TRAVERSE(&stream->framepq, frame_piece, frame_block_list) {
+        if (stream->stats.packets && frame_piece->seq != OFF_SET_SEQ(stream->lastseq + 1)) {
+            stream->stats.gaps++;
+            stream->stats.lost += (frame_piece->seq - stream->lastseq - 1 + SEQ_MAX) % SEQ_MAX;
+        }
+        stream->stats.packets++;
+        stream->lastseq = frame_piece->seq;
+    }
+
+    gmp_stream_write(stream);
+    
+    return 0;
+}
+
+/*!
+ * \brief Reorder timeout of a stream: give up on the missing packages.
+ *
+ * Armed when the stream starts waiting for a gap, so a stalled source
+ * still gets its buffered packages out.  Runs on the worker loop that
+ * owns the stream.
+ */
+static void gmp_stream_flush_cb(evutil_socket_t fd, short events, void *arg)
+{
+    struct gmp_stream *stream = arg;
+    struct frame_block **reception_buffer = stream->reception_buffer;
+
+    if (!stream->t_Recordering) {
+        return;
+    }
+
+    stream->old_espect_seq = stream->espect_seq;
+
+    int i = stream->espect_seq;
+    //计时开始时就已缺的包等够了, 全部放弃
+    if ((stream->time_seq - i + SEQ_MAX) % SEQ_MAX < REORDERING_WINDOW_SIZE) {
+        i = stream->time_seq;
+    } else {
+        while (i != stream->max_seq && !reception_buffer[OFF_SET(i)]) {
+            i = OFF_SET_SEQ(i + 1);
+        }
+    }
+    //放出其后连续到达的包
+    while (i != stream->max_seq && reception_buffer[OFF_SET(i)]) {
+        i = OFF_SET_SEQ(i + 1);
+    }
+    stream->espect_seq = i;
+
+    //加入共享缓冲区
+    submit_gmh_h264_package(stream, stream->old_espect_seq, stream->espect_seq);
+
+    //记下放弃的缺包, 之后迟到的包计入补包延迟
+    stream->flush_gap = stream->order_timer;
+    stream->flush_from = stream->old_espect_seq;
+    stream->flush_to = stream->espect_seq;
+
+    //还有包在等待则重新计时
+    if (stream->espect_seq != stream->max_seq) {
+        gmp_stream_arm(stream);
+    } else {
+        stream->t_Recordering = 0;
+        stream->order_timer.tv_sec = 0;
+        stream->order_timer.tv_usec = 0;
+        stream->time_seq = 0;
+    }
+}
+
+/*!
+ * \brief Put a received package into the reorder window of its stream.
+ *
+ * The block is linked into its slot as is; it belongs to the stream from
+ * here on and is given back to the pool when rejected.
+ *
+ * \param hdr the package header, already checked by css_gmp_parse()
+ */
+int gmh_h264_package_build(struct gmp_stream *stream, struct frame_block *frame_block_ptr, const struct css_gmp_header *hdr)
+{
+    int offset_seq = 0;
+    struct frame_block **reception_buffer = stream->reception_buffer;
+    unsigned int seqno, ptrlen, timestamp_s, timestamp_ns;  
+    struct timeval now;
+    
+    //包号
+    seqno = hdr->seq;
+    
+    offset_seq = OFF_SET(seqno);
+    
+    //mb mean the bottom of the window                
+    int uh_seq = (stream->max_seq - seqno + SEQ_MAX) % SEQ_MAX;
+    int win_bottom = (stream->max_seq - REORDERING_WINDOW_SIZE + SEQ_MAX) % SEQ_MAX; 
+    int seq_wb = (seqno - win_bottom + SEQ_MAX) % SEQ_MAX;
+    int ur_wb = (stream->espect_seq - win_bottom + SEQ_MAX) % SEQ_MAX;
+    
+    //包长度
+    ptrlen = hdr->length;
+    //时间戳
+    timestamp_s = hdr->sec;
+    timestamp_ns = hdr->nsec;
+    //报文类型, 取值与 gmp_h264_media_type 相同
+    int p_type = hdr->type;
+
+    //只装配 H.264; 其他媒体的包仍占着包号, 照常排序, 每个流只记一次日志
+    if (hdr->media != CSS_GMP_MEDIA_H264) {
+        if (!stream->stats.foreign++) {
+            css_log(LOG_WARNING, "gmp stream %s carries media type %02x, only H.264 is assembled\n",
+                    stream->name, hdr->media);
+        }
+        p_type = gmp_h264_media_type_foreign;
+    }
+
+    event_base_gettimeofday_cached(event_get_base(stream->flush_ev), &now);
+    stream->last_seen = now;
+    gmp_stream_jitter_sample(stream, &now, timestamp_s, timestamp_ns);
+    
+    //落入窗体内的数据包
+    if (uh_seq < REORDERING_WINDOW_SIZE && seq_wb < ur_wb) {    
+        stream->stats.late++;
+        //超时放弃后才到的包, 说明等待时间不够
+        if (!css_tvzero(stream->flush_gap) &&
+            (seqno - stream->flush_from + SEQ_MAX) % SEQ_MAX < (stream->flush_to - stream->flush_from + SEQ_MAX) % SEQ_MAX) {
+            gmp_stream_gap_sample(stream, css_tvdiff_ms(now, stream->flush_gap));
+        }
+        free_frame(frame_block_ptr);
+        return 0;
+    }
+ 
+    //接收块直接挂入排序槽
+    if (!reception_buffer[offset_seq]) {                    
+        //比已收到的最大包号还早, 记录乱序距离
+        if (uh_seq > 1 && uh_seq < REORDERING_WINDOW_SIZE) {
+            int distance = uh_seq - 1;
+
+            stream->reordered++;
+            stream->reorder += distance - ((stream->reorder + 8) >> 4);
+            if (distance > stream->reorder_max) {
+                stream->reorder_max = distance;
+            }
+        }
+
+        frame_block_ptr->seq = seqno; 
+        frame_block_ptr->ts = timestamp_s;
+        frame_block_ptr->tns = timestamp_ns;
+        frame_block_ptr->datalen = ptrlen;
+        frame_block_ptr->frame_type = p_type;
+
+        //
+        reception_buffer[offset_seq] = frame_block_ptr;
+
+        //判断是否落入排序窗, uh_seq 为 0 是紧接最大包号的新包
+        if (uh_seq && uh_seq < REORDERING_WINDOW_SIZE) {
+
+            //seq< uh && seq = ur, put ur~next_ur(Less than uh)
+            if (seqno == stream->espect_seq) {
+                stream->old_espect_seq = stream->espect_seq;
+                int i = OFF_SET_SEQ(stream->espect_seq + 1);
+                win_bottom = (stream->max_seq - REORDERING_WINDOW_SIZE + SEQ_MAX) % SEQ_MAX;
+                int i_wb = (i - win_bottom + SEQ_MAX) % SEQ_MAX;
+                int uh_wb = (stream->max_seq - win_bottom + SEQ_MAX) % SEQ_MAX;
+                for (; i_wb <= uh_wb; i++) {                                    
+                    int j = OFF_SET_SEQ(i);             
+                    int k = OFF_SET(j);
+                    if (!reception_buffer[k]) {
+                        stream->espect_seq = j;
+                        break;
+                    }   
+                }
+                //加入共享缓冲区
+                submit_gmh_h264_package(stream, stream->old_espect_seq, stream->espect_seq);
+            } 
+            //                  
+        } else {
+            //                  
+            int max_tmp = seqno + 1;
+            stream->max_seq = OFF_SET_SEQ(max_tmp);
+
+            int uh_ur = (stream->max_seq - stream->espect_seq + SEQ_MAX) % SEQ_MAX;                        
+            if (uh_ur < REORDERING_WINDOW_SIZE) {//UR at inside of reordering window
+
+                //seq > uh && seq = ur, put ur~next_ur(Less than uh)
+                if (seqno == stream->espect_seq) {                              
+                    stream->old_espect_seq = stream->espect_seq;
+                    int i = stream->espect_seq + 1;
+                    win_bottom = (stream->max_seq - REORDERING_WINDOW_SIZE + SEQ_MAX) % SEQ_MAX;
+                    int i_wb = (i - win_bottom + SEQ_MAX) % SEQ_MAX;
+                    int uh_wb = (stream->max_seq - win_bottom + SEQ_MAX) % SEQ_MAX;
+                    for (; i_wb <= uh_wb; i++) {                                
+                        int j = OFF_SET_SEQ(i);
+                        int k = OFF_SET(j);
+                        if (!reception_buffer[k]) {
+                            stream->espect_seq = j;
+                            break;
+                        }   
+                    }
+                    //加入共享缓冲区
+                    submit_gmh_h264_package(stream, stream->old_espect_seq, stream->espect_seq);
+                } 
+            } else {//UR at outside of reordering window
+                stream->old_espect_seq = stream->espect_seq;
+                int i = (stream->max_seq - REORDERING_WINDOW_SIZE + SEQ_MAX) % SEQ_MAX;
+                win_bottom = (stream->max_seq - REORDERING_WINDOW_SIZE + SEQ_MAX) % SEQ_MAX;
+                int i_wb = (i - win_bottom + SEQ_MAX) % SEQ_MAX;
+                int uh_wb = (stream->max_seq - win_bottom + SEQ_MAX) % SEQ_MAX;
+                for (; i_wb <= uh_wb; i++) {                            
+                    int j = OFF_SET_SEQ(i);
+                    int k = OFF_SET(j);
                     if (!reception_buffer[k]) {
-                        espect_seq = j;
+                        stream->espect_seq = j;
                         break;
                     }
                 }
-                //加入共享缓冲区
-                submit_gmh_h264_package(old_espect_seq, espect_seq);
+                //加入共享缓冲区
+                submit_gmh_h264_package(stream, stream->old_espect_seq, stream->espect_seq);
+            }
+        }                   
+
+        if (stream->t_Recordering) {
+            //          
+            win_bottom = (stream->max_seq - REORDERING_WINDOW_SIZE + SEQ_MAX) % SEQ_MAX;
+            int ux_wb = (stream->time_seq - win_bottom  + SEQ_MAX) % SEQ_MAX;
+            int ur_wb = (stream->espect_seq - win_bottom + SEQ_MAX) % SEQ_MAX;
+            int uh_ux = (stream->max_seq - stream->time_seq + SEQ_MAX) % SEQ_MAX;
+            if (ur_wb >= ux_wb || (uh_ux >= REORDERING_WINDOW_SIZE && stream->max_seq != stream->time_seq)) {                            
+                if (ur_wb >= ux_wb) {
+                    gmp_stream_gap_sample(stream, css_tvdiff_ms(now, stream->order_timer));
+                }
+                stream->t_Recordering = 0;
+                stream->order_timer.tv_sec = 0;
+                stream->order_timer.tv_usec = 0;
+                stream->time_seq = 0;
+                evtimer_del(stream->flush_ev);
+            }
+        } else {
+            //                  
+            win_bottom = (stream->max_seq - REORDERING_WINDOW_SIZE + SEQ_MAX) % SEQ_MAX;
+            int ur_wb = (stream->espect_seq - win_bottom + SEQ_MAX)%SEQ_MAX;
+            //
+            if (ur_wb < REORDERING_WINDOW_SIZE) {
+                stream->t_Recordering = 1;
+                gmp_stream_arm(stream);
+            }
+        }           
+    } else {
+        //重复包
+        stream->stats.dups++;
+        free_frame(frame_block_ptr);
+    }
+    return 0;
+}
+
+static void gmp_rx_ring_free(struct gmp_rx_ring *ring)
+{
+    int i;
+
+    if (!ring) {
+        return;
+    }
+    if (ring->blocks) {
+        for (i = 0; i < ring->size; i++) {
+            free_frame(ring->blocks[i]);
+        }
+    }
+    css_free(ring->msgs);
+    css_free(ring->iovs);
+    css_free(ring->addrs);
+    css_free(ring->blocks);
+    css_free(ring->controls);
+    css_free(ring);
+}
+
+/*!
+ * \brief Give every empty slot of the ring a block to receive into.
+ * \return the number of leading slots ready for recvmmsg()
+ */
+static int gmp_rx_ring_fill(struct gmp_rx_ring *ring, struct frame_pool *pool)
+{
+    int i;
+
+    for (i = 0; i < ring->size; i++) {
+        if (!ring->blocks[i]) {
+            if (!(ring->blocks[i] = frame_pool_get(pool))) {
+                break;
+            }
+            ring->iovs[i].iov_base = ring->blocks[i]->data;
+            ring->iovs[i].iov_len = sizeof(ring->blocks[i]->data);
+        }
+        ring->msgs[i].msg_hdr.msg_namelen = sizeof(ring->addrs[i]);
+        ring->msgs[i].msg_hdr.msg_controllen = GMP_CMSG_SPACE;
+    }
+
+    return i;
+}
+
+static struct gmp_rx_ring *gmp_rx_ring_alloc(int size, struct frame_pool *pool)
+{
+    struct gmp_rx_ring *ring;
+    int i;
+
+    if (!(ring = css_calloc(1, sizeof(*ring)))) {
+        return NULL;
+    }
+    ring->size = size;
+    if (!(ring->msgs = css_calloc(size, sizeof(*ring->msgs))) ||
+        !(ring->iovs = css_calloc(size, sizeof(*ring->iovs))) ||
+        !(ring->addrs = css_calloc(size, sizeof(*ring->addrs))) ||
+        !(ring->blocks = css_calloc(size, sizeof(*ring->blocks))) ||
+        !(ring->controls = css_calloc(size, GMP_CMSG_SPACE))) {
+        gmp_rx_ring_free(ring);
+        return NULL;
+    }
+
+    for (i = 0; i < size; i++) {
+        ring->msgs[i].msg_hdr.msg_iov = &ring->iovs[i];
+        ring->msgs[i].msg_hdr.msg_iovlen = 1;
+        ring->msgs[i].msg_hdr.msg_name = &ring->addrs[i];
+        ring->msgs[i].msg_hdr.msg_control = ring->controls + i * GMP_CMSG_SPACE;
+    }
+
+    if (gmp_rx_ring_fill(ring, pool) < size) {
+        gmp_rx_ring_free(ring);
+        return NULL;
+    }
+
+    return ring;
+}
+
+/*!
+ * \brief Hand one received package to the reorder stage.
+ *
+ * \param frame block the datagram was received into, datalen set to the
+ *        received length.  Ownership passes to the stream, or back to the
+ *        pool if the package is dropped.
+ * \param cache last stream seen by the caller; consecutive datagrams of the
+ *        same source skip the container lookup.  The caller owns the
+ *        reference left in *cache and must drop it when done.
+ *
+ * \return the css_gmp_parse() result, the package was dropped unless it
+ * is CSS_GMP_PARSE_OK.  Counted by the caller, not logged: a bad sender
+ * can fill the log at line rate.
+ */
+static int gmp_ingest(struct gmp_worker *worker, const struct sockaddr_in *addr, struct frame_block *frame, struct gmp_stream **cache)
+{
+    struct gmp_stream *stream = *cache;
+    struct css_gmp_header hdr;
+    unsigned int stream_id;
+    int res;
+
+    //包头检查通过前不访问包内容
+    if ((res = css_gmp_parse(frame->dataptr, frame->datalen, &hdr)) != CSS_GMP_PARSE_OK) {
+        free_frame(frame);
+        return res;
+    }
+
+    //流ID
+    stream_id = hdr.stream_id;
+
+    //缓存的流可能已因空闲被移除 (定时器已释放)
+    if (!stream || !stream->flush_ev || stream->stream_id != stream_id ||
+        stream->addr.sin_addr.s_addr != addr->sin_addr.s_addr ||
+        stream->addr.sin_port != addr->sin_port) {
+        if (stream) {
+            ao2_ref(stream, -1);
+        }
+        if (!(*cache = stream = gmp_stream_get(worker, addr, stream_id))) {
+            free_frame(frame);
+            return CSS_GMP_PARSE_OK;
+        }
+    }
+
+    gmh_h264_package_build(stream, frame, &hdr);
+
+    return CSS_GMP_PARSE_OK;
+}
+
+/*!
+ * \brief Count a received datagram and read its control messages.
+ *
+ * SO_TIMESTAMPNS carries when the kernel received the datagram, so \a now
+ * minus that is the time it waited in the socket and for the worker.
+ * SO_RXQ_OVFL carries how many datagrams the socket dropped so far
+ * because its receive buffer was full; a rise there means lost sequence
+ * numbers are ours, not the network's.
+ */
+static void gmp_socket_account(struct gmp_socket *sock, struct msghdr *msg, size_t len, const struct timespec *now)
+{
+    struct gmp_socket_stats *stats = &sock->stats;
+    struct cmsghdr *cmsg;
+    struct timespec ts;
+    int64_t us;
+    uint32_t drops;
+    int bucket;
+
+    stats->datagrams++;
+    stats->bytes += len;
+
+    for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET) {
+            continue;
+        }
+        if (cmsg->cmsg_type == SO_TIMESTAMPNS) {
+            memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+            us = ((int64_t) (now->tv_sec - ts.tv_sec) * 1000000000 + (now->tv_nsec - ts.tv_nsec)) / 1000;
+            //系统时间被调整时可能为负
+            if (us < 0) {
+                us = 0;
+            }
+            for (bucket = 0; bucket < GMP_LATENCY_BUCKETS - 1 && us >= (1LL << bucket); bucket++);
+            stats->latency[bucket]++;
+            stats->latency_sum += us;
+            if (us > stats->latency_max) {
+                stats->latency_max = us > UINT_MAX ? UINT_MAX : us;
+            }
+            stats->stamped++;
+        } else if (cmsg->cmsg_type == SO_RXQ_OVFL) {
+            memcpy(&drops, CMSG_DATA(cmsg), sizeof(drops));
+            stats->drops = drops;
+        }
+    }
+}
+
+/*! \brief Bytes waiting in the receive queue of a socket, -1 if the kernel can not tell */
+static int gmp_socket_queued(struct gmp_socket *sock, int *rcvbuf)
+{
+#ifdef SO_MEMINFO
+    uint32_t meminfo[SK_MEMINFO_VARS];
+    socklen_t len = sizeof(meminfo);
+
+    if (!getsockopt(sock->fd, SOL_SOCKET, SO_MEMINFO, meminfo, &len)) {
+        if (rcvbuf) {
+            *rcvbuf = meminfo[SK_MEMINFO_RCVBUF];
+        }
+        return meminfo[SK_MEMINFO_RMEM_ALLOC];
+    }
+#endif
+    return -1;
+}
+
+void onRead(int iCliFd, short iEvent, void *arg)
+{
+    struct gmp_socket *sock = arg;
+    struct gmp_worker *worker = sock->worker;
+    int iLen, res;
+    struct frame_block *frame;
+    struct sockaddr_in addrClient;
+    struct gmp_stream *stream = NULL;
+    unsigned char control[GMP_CMSG_SPACE];
+    struct iovec iov;
+    struct msghdr msg = {
+        .msg_name = &addrClient,
+        .msg_namelen = sizeof(addrClient),
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control,
+        .msg_controllen = sizeof(control),
+    };
+    struct timespec now;
+
+    if (!(frame = frame_pool_get(&worker->pool))) {
+        //内存耗尽时每次唤醒都会到这里, 不在接收线程格式化日志
+        css_log_fast(LOG_WARNING, "gmp worker %d: struct frame_block alloca failed!\n", worker->index);
+        return;
+    }
+
+    //iLen = recv(iCliFd, buf, 8192, 0);
+    iov.iov_base = frame->data;
+    iov.iov_len = sizeof(frame->data);
+    iLen = recvmsg(iCliFd, &msg, MSG_TRUNC);
+
+    if(iLen <= 0)
+    {
+        free_frame(frame);
+        if (iLen < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+            return;
+        }
+        css_log(LOG_ERROR, "Client closed\n");
+        // event_del(pEvRead);
+        // event_free(pEvRead);
+        // close(iCliFd);
+        return;
+    }
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    sock->stats.batches++;
+    gmp_socket_account(sock, &msg, MIN(iLen, sizeof(frame->data)), &now);
+
+    //只计数, 不在接收循环里写日志
+    if (iLen > sizeof(frame->data)) {
+        sock->stats.truncated++;
+        iLen = sizeof(frame->data);
+    }
+
+    css_recorder_write(worker->normal, frame->data, iLen);
+
+    frame->datalen = iLen;
+    if ((res = gmp_ingest(worker, &addrClient, frame, &stream)) != CSS_GMP_PARSE_OK) {
+        sock->stats.rejected[-res]++;
+    }
+
+    if (stream) {
+        ao2_ref(stream, -1);
+    }
+}
+
+/*! \brief Batched receive: drain up to ring->size datagrams per wakeup */
+static void onReadBatch(int iCliFd, short iEvent, void *arg)
+{
+    struct gmp_socket *sock = arg;
+    struct gmp_worker *worker = sock->worker;
+    struct gmp_rx_ring *ring = worker->ring;
+    struct gmp_stream *stream = NULL;
+    struct frame_block *frame;
+    struct timespec now;
+    int i, count, ready, res;
+
+    if (!(ready = gmp_rx_ring_fill(ring, &worker->pool))) {
+        //内存耗尽时每次唤醒都会到这里, 不在接收线程格式化日志
+        css_log_fast(LOG_WARNING, "gmp worker %d: struct frame_block alloca failed!\n", worker->index);
+        return;
+    }
+
+    if ((count = recvmmsg(iCliFd, ring->msgs, ready, MSG_DONTWAIT, NULL)) <= 0) {
+        if (count < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            css_log(LOG_ERROR, "recvmmsg failed: %s\n", strerror(errno));
+        }
+        return;
+    }
+
+    //一次取时间, 供本批所有包计算内核到用户态的延迟
+    clock_gettime(CLOCK_REALTIME, &now);
+    sock->stats.batches++;
+    if (count == ready) {
+        sock->stats.batches_full++;
+    }
+
+    for (i = 0; i < count; i++) {
+        gmp_socket_account(sock, &ring->msgs[i].msg_hdr, ring->msgs[i].msg_len, &now);
+        frame = ring->blocks[i];
+        ring->blocks[i] = NULL;
+        css_recorder_write(worker->normal, frame->data, ring->msgs[i].msg_len);
+        if (ring->msgs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+            sock->stats.truncated++;
+        }
+        frame->datalen = ring->msgs[i].msg_len;
+        if ((res = gmp_ingest(worker, &ring->addrs[i], frame, &stream)) != CSS_GMP_PARSE_OK) {
+            sock->stats.rejected[-res]++;
+        }
+    }
+
+    if (stream) {
+        ao2_ref(stream, -1);
+    }
+}
+
+/*!
+ * \brief Parse an endpoint, "<ip>:<port>[,<option>=<value>...]".
+ *
+ * Options: interface=<ip> to join a group on, source=<ip> (repeatable)
+ * for a source specific join, rcvbuf=<KB>.
+ *
+ * \retval 0 on success, -1 if the value is not an endpoint (logged)
+ */
+static int gmp_endpoint_parse(struct gmp_endpoint *ep, const char *value, int lineno)
+{
+    char buf[256], *opts, *addr, *port, *opt, *val;
+    int portno;
+
+    memset(ep, 0, sizeof(*ep));
+    css_copy_string(buf, value, sizeof(buf));
+    opts = buf;
+    addr = css_strip(strsep(&opts, ","));
+
+    if (!(port = strrchr(addr, ':')) || sscanf(port + 1, "%30d", &portno) != 1 || portno < 1 || portno > 65535) {
+        css_log(LOG_WARNING, "Invalid endpoint '%s' at line %d of %s, expected <ip>:<port>\n", value, lineno, GMP_CONFIG_FILE);
+        return -1;
+    }
+    *port = '\0';
+    ep->addr.sin_family = AF_INET;
+    ep->addr.sin_port = htons(portno);
+    if (!inet_aton(addr, &ep->addr.sin_addr)) {
+        css_log(LOG_WARNING, "Invalid endpoint address '%s' at line %d of %s\n", addr, lineno, GMP_CONFIG_FILE);
+        return -1;
+    }
+    ep->multicast = IN_MULTICAST(ntohl(ep->addr.sin_addr.s_addr));
+    snprintf(ep->name, sizeof(ep->name), "%s:%d", addr, portno);
+
+    while ((opt = strsep(&opts, ","))) {
+        val = opt;
+        opt = css_strip(strsep(&val, "="));
+        val = val ? css_strip(val) : "";
+        if (!strcasecmp(opt, "rcvbuf")) {
+            if (css_parse_arg(val, PARSE_INT32 | PARSE_IN_RANGE, &ep->rcvbuf, 0, GMP_RCVBUF_MAX)) {
+                css_log(LOG_WARNING, "Invalid rcvbuf '%s' for endpoint %s at line %d of %s, using the system default\n",
+                        val, ep->name, lineno, GMP_CONFIG_FILE);
+                ep->rcvbuf = 0;
+            }
+        } else if (!strcasecmp(opt, "interface")) {
+            if (!inet_aton(val, &ep->interface)) {
+                css_log(LOG_WARNING, "Invalid interface '%s' for endpoint %s at line %d of %s\n", val, ep->name, lineno, GMP_CONFIG_FILE);
+                return -1;
+            }
+        } else if (!strcasecmp(opt, "source")) {
+            if (ep->nsources == GMP_ENDPOINT_SOURCES_MAX) {
+                css_log(LOG_WARNING, "Endpoint %s at line %d of %s has more than %d sources\n",
+                        ep->name, lineno, GMP_CONFIG_FILE, GMP_ENDPOINT_SOURCES_MAX);
+                return -1;
+            }
+            if (!inet_aton(val, &ep->sources[ep->nsources])) {
+                css_log(LOG_WARNING, "Invalid source '%s' for endpoint %s at line %d of %s\n", val, ep->name, lineno, GMP_CONFIG_FILE);
+                return -1;
+            }
+            ep->nsources++;
+        } else {
+            css_log(LOG_WARNING, "Unknown endpoint option '%s' at line %d of %s\n", opt, lineno, GMP_CONFIG_FILE);
+        }
+    }
+
+    if (!ep->multicast && (ep->nsources || ep->interface.s_addr)) {
+        css_log(LOG_WARNING, "Endpoint %s at line %d of %s is not a multicast group, source and interface ignored\n",
+                ep->name, lineno, GMP_CONFIG_FILE);
+        ep->nsources = 0;
+        ep->interface.s_addr = INADDR_ANY;
+    }
+
+    return 0;
+}
+
+static void gmp_readconfig(void)
+{
+    struct css_config *cfg;
+    struct css_variable *v;
+    struct css_flags config_flags = { 0 };
+
+    gmp_recv_batch = DEFAULT_GMP_RECV_BATCH;
+    gmp_worker_count = DEFAULT_GMP_WORKERS;
+    gmp_worker_affinity = 1;
+    gmp_reorder_timeout = DEFAULT_GMP_REORDER_TIMEOUT;
+    gmp_reorder_mode = GMP_REORDER_FIXED;
+    gmp_reorder_min = DEFAULT_GMP_REORDER_MIN;
+    gmp_reorder_percentile = DEFAULT_GMP_REORDER_PERCENTILE;
+    gmp_record_chunk = DEFAULT_GMP_RECORD_CHUNK;
+    gmp_record_chunks = DEFAULT_GMP_RECORD_CHUNKS;
+    gmp_record_prealloc = 0;
+    gmp_record_direct = 0;
+    gmp_record_flush = DEFAULT_GMP_RECORD_FLUSH;
+    gmp_record_es = 0;
+    gmp_record_segment = 0;
+    gmp_stats_interval = 0;
+    gmp_stream_idle = DEFAULT_GMP_STREAM_IDLE;
+    gmp_play_port = DEFAULT_GMP_PLAY_PORT;
+    gmp_play_queue_high = DEFAULT_GMP_PLAY_QUEUE_HIGH;
+    gmp_play_queue_low = DEFAULT_GMP_PLAY_QUEUE_LOW;
+    gmp_gop_cache = 1;
+    gmp_gop_frames = DEFAULT_GMP_GOP_FRAMES;
+    gmp_gop_size = DEFAULT_GMP_GOP_SIZE;
+    gmp_endpoint_count = 0;
+
+    cfg = css_config_load2(GMP_CONFIG_FILE, "css_monitor", config_flags);
+    if (cfg == CONFIG_STATUS_FILEMISSING || cfg == CONFIG_STATUS_FILEUNCHANGED || cfg == CONFIG_STATUS_FILEINVALID) {
+        goto endpoints;
+    }
+
+    for (v = css_variable_browse(cfg, "gmp"); v; v = v->next) {
+        if (!strcasecmp(v->name, "endpoint")) {
+            if (gmp_endpoint_count == GMP_ENDPOINTS_MAX) {
+                css_log(LOG_WARNING, "More than %d endpoints in %s, line %d ignored\n", GMP_ENDPOINTS_MAX, GMP_CONFIG_FILE, v->lineno);
+            } else if (!gmp_endpoint_parse(&gmp_endpoints[gmp_endpoint_count], v->value, v->lineno)) {
+                gmp_endpoint_count++;
+            }
+        } else if (!strcasecmp(v->name, "recv_batch")) {
+            if (css_parse_arg(v->value, PARSE_INT32 | PARSE_IN_RANGE, &gmp_recv_batch, 1, GMP_RECV_BATCH_MAX)) {
+                css_log(LOG_WARNING, "Invalid recv_batch '%s' at line %d of %s, using %d\n",
+                        v->value, v->lineno, GMP_CONFIG_FILE, DEFAULT_GMP_RECV_BATCH);
+                gmp_recv_batch = DEFAULT_GMP_RECV_BATCH;
+            }
+        } else if (!strcasecmp(v->name, "workers")) {
+            if (css_parse_arg(v->value, PARSE_INT32 | PARSE_IN_RANGE, &gmp_worker_count, 0, GMP_WORKERS_MAX)) {
+                css_log(LOG_WARNING, "Invalid workers '%s' at line %d of %s, using %d\n",
+                        v->value, v->lineno, GMP_CONFIG_FILE, DEFAULT_GMP_WORKERS);
+                gmp_worker_count = DEFAULT_GMP_WORKERS;
+            }
+        } else if (!strcasecmp(v->name, "cpu_affinity")) {
+            gmp_worker_affinity = css_true(v->value);
+        } else if (!strcasecmp(v->name, "reorder_timeout")) {
+            if (css_parse_arg(v->value, PARSE_INT32 | PARSE_IN_RANGE, &gmp_reorder_timeout, 1, GMP_REORDER_TIMEOUT_MAX)) {
+                css_log(LOG_WARNING, "Invalid reorder_timeout '%s' at line %d of %s, using %d\n",
+                        v->value, v->lineno, GMP_CONFIG_FILE, DEFAULT_GMP_REORDER_TIMEOUT);
+                gmp_reorder_timeout = DEFAULT_GMP_REORDER_TIMEOUT;
+            }
+        } else if (!strcasecmp(v->name, "reorder_mode")) {
+            if (!strcasecmp(v->value, "adaptive")) {
+                gmp_reorder_mode = GMP_REORDER_ADAPTIVE;
+            } else if (!strcasecmp(v->value, "fixed")) {
+                gmp_reorder_mode = GMP_REORDER_FIXED;
+            } else {
+                css_log(LOG_WARNING, "Invalid reorder_mode '%s' at line %d of %s, using fixed\n",
+                        v->value, v->lineno, GMP_CONFIG_FILE);
+            }
+        } else if (!strcasecmp(v->name, "reorder_min")) {
+            if (css_parse_arg(v->value, PARSE_INT32 | PARSE_IN_RANGE, &gmp_reorder_min, 1, GMP_REORDER_TIMEOUT_MAX)) {
+                css_log(LOG_WARNING, "Invalid reorder_min '%s' at line %d of %s, using %d\n",
+                        v->value, v->lineno, GMP_CONFIG_FILE, DEFAULT_GMP_REORDER_MIN);
+                gmp_reorder_min = DEFAULT_GMP_REORDER_MIN;
+            }
+        } else if (!strcasecmp(v->name, "reorder_percentile")) {
+            if (css_parse_arg(v->value, PARSE_INT32 | PARSE_IN_RANGE, &gmp_reorder_percentile, 1, 100)) {
+                css_log(LOG_WARNING, "Invalid reorder_percentile '%s' at line %d of %s, using %d\n",
+                        v->value, v->lineno, GMP_CONFIG_FILE, DEFAULT_GMP_REORDER_PERCENTILE);
+                gmp_reorder_percentile = DEFAULT_GMP_REORDER_PERCENTILE;
+            }
+        } else if (!strcasecmp(v->name, "record_chunk")) {
+            if (css_parse_arg(v->value, PARSE_INT32 | PARSE_IN_RANGE, &gmp_record_chunk, 4, 65536)) {
+                css_log(LOG_WARNING, "Invalid record_chunk '%s' at line %d of %s, using %d\n",
+                        v->value, v->lineno, GMP_CONFIG_FILE, DEFAULT_GMP_RECORD_CHUNK);
+                gmp_record_chunk = DEFAULT_GMP_RECORD_CHUNK;
+            }
+        } else if (!strcasecmp(v->name, "record_chunks")) {
+            if (css_parse_arg(v->value, PARSE_INT32 | PARSE_IN_RANGE, &gmp_record_chunks, 2, 65536)) {
+                css_log(LOG_WARNING, "Invalid record_chunks '%s' at line %d of %s, using %d\n",
+                        v->value, v->lineno, GMP_CONFIG_FILE, DEFAULT_GMP_RECORD_CHUNKS);
+                gmp_record_chunks = DEFAULT_GMP_RECORD_CHUNKS;
+            }
+        } else if (!strcasecmp(v->name, "record_prealloc")) {
+            if (css_parse_arg(v->value, PARSE_INT32 | PARSE_IN_RANGE, &gmp_record_prealloc, 0, 4096)) {
+                css_log(LOG_WARNING, "Invalid record_prealloc '%s' at line %d of %s, disabled\n",
+                        v->value, v->lineno, GMP_CONFIG_FILE);
+                gmp_record_prealloc = 0;
+            }
+        } else if (!strcasecmp(v->name, "record_es")) {
+            gmp_record_es = css_true(v->value);
+        } else if (!strcasecmp(v->name, "record_segment")) {
+            if (css_parse_arg(v->value, PARSE_INT32 | PARSE_IN_RANGE, &gmp_record_segment, 0, GMP_RECORD_SEGMENT_MAX)) {
+                css_log(LOG_WARNING, "Invalid record_segment '%s' at line %d of %s, not segmenting\n",
+                        v->value, v->lineno, GMP_CONFIG_FILE);
+                gmp_record_segment = 0;
+            }
+        } else if (!strcasecmp(v->name, "record_direct")) {
+            gmp_record_direct = css_true(v->value);
+        } else if (!strcasecmp(v->name, "play_port")) {
+            if (css_parse_arg(v->value, PARSE_INT32 | PARSE_IN_RANGE, &gmp_play_port, 0, 65535)) {
+                css_log(LOG_WARNING, "Invalid play_port '%s' at line %d of %s, using %d\n",
+                        v->value, v->lineno, GMP_CONFIG_FILE, DEFAULT_GMP_PLAY_PORT);
+                gmp_play_port = DEFAULT_GMP_PLAY_PORT;
+            }
+        } else if (!strcasecmp(v->name, "play_queue_high")) {
+            if (css_parse_arg(v->value, PARSE_INT32 | PARSE_IN_RANGE, &gmp_play_queue_high, 1, GMP_PLAY_QUEUE_MAX)) {
+                css_log(LOG_WARNING, "Invalid play_queue_high '%s' at line %d of %s, using %d\n",
+                        v->value, v->lineno, GMP_CONFIG_FILE, DEFAULT_GMP_PLAY_QUEUE_HIGH);
+                gmp_play_queue_high = DEFAULT_GMP_PLAY_QUEUE_HIGH;
+            }
+        } else if (!strcasecmp(v->name, "play_queue_low")) {
+            if (css_parse_arg(v->value, PARSE_INT32 | PARSE_IN_RANGE, &gmp_play_queue_low, 0, GMP_PLAY_QUEUE_MAX)) {
+                css_log(LOG_WARNING, "Invalid play_queue_low '%s' at line %d of %s, using %d\n",
+                        v->value, v->lineno, GMP_CONFIG_FILE, DEFAULT_GMP_PLAY_QUEUE_LOW);
+                gmp_play_queue_low = DEFAULT_GMP_PLAY_QUEUE_LOW;
+            }
+        } else if (!strcasecmp(v->name, "gop_cache")) {
+            gmp_gop_cache = css_true(v->value);
+        } else if (!strcasecmp(v->name, "gop_cache_frames")) {
+            if (css_parse_arg(v->value, PARSE_INT32 | PARSE_IN_RANGE, &gmp_gop_frames, 1, GMP_GOP_FRAMES_MAX)) {
+                css_log(LOG_WARNING, "Invalid gop_cache_frames '%s' at line %d of %s, using %d\n",
+                        v->value, v->lineno, GMP_CONFIG_FILE, DEFAULT_GMP_GOP_FRAMES);
+                gmp_gop_frames = DEFAULT_GMP_GOP_FRAMES;
+            }
+        } else if (!strcasecmp(v->name, "gop_cache_size")) {
+            if (css_parse_arg(v->value, PARSE_INT32 | PARSE_IN_RANGE, &gmp_gop_size, 1, GMP_PLAY_QUEUE_MAX)) {
+                css_log(LOG_WARNING, "Invalid gop_cache_size '%s' at line %d of %s, using %d\n",
+                        v->value, v->lineno, GMP_CONFIG_FILE, DEFAULT_GMP_GOP_SIZE);
+                gmp_gop_size = DEFAULT_GMP_GOP_SIZE;
+            }
+        } else if (!strcasecmp(v->name, "stats_interval")) {
+            if (css_parse_arg(v->value, PARSE_INT32 | PARSE_IN_RANGE, &gmp_stats_interval, 0, GMP_STATS_INTERVAL_MAX)) {
+                css_log(LOG_WARNING, "Invalid stats_interval '%s' at line %d of %s, disabled\n",
+                        v->value, v->lineno, GMP_CONFIG_FILE);
+                gmp_stats_interval = 0;
+            }
+        } else if (!strcasecmp(v->name, "stream_idle")) {
+            if (css_parse_arg(v->value, PARSE_INT32 | PARSE_IN_RANGE, &gmp_stream_idle, 0, GMP_STREAM_IDLE_MAX)) {
+                css_log(LOG_WARNING, "Invalid stream_idle '%s' at line %d of %s, using %d\n",
+                        v->value, v->lineno, GMP_CONFIG_FILE, DEFAULT_GMP_STREAM_IDLE);
+                gmp_stream_idle = DEFAULT_GMP_STREAM_IDLE;
+            }
+        } else if (!strcasecmp(v->name, "record_flush")) {
+            if (css_parse_arg(v->value, PARSE_INT32 | PARSE_IN_RANGE, &gmp_record_flush, 1, GMP_REORDER_TIMEOUT_MAX)) {
+                css_log(LOG_WARNING, "Invalid record_flush '%s' at line %d of %s, using %d\n",
+                        v->value, v->lineno, GMP_CONFIG_FILE, DEFAULT_GMP_RECORD_FLUSH);
+                gmp_record_flush = DEFAULT_GMP_RECORD_FLUSH;
+            }
+        }
+    }
+
+    css_config_destroy(cfg);
+
+    if (gmp_play_queue_low > gmp_play_queue_high) {
+        css_log(LOG_WARNING, "play_queue_low %d is above play_queue_high %d, using %d\n",
+                gmp_play_queue_low, gmp_play_queue_high, gmp_play_queue_high);
+        gmp_play_queue_low = gmp_play_queue_high;
+    }
+
+endpoints:
+    if (!gmp_endpoint_count && !gmp_endpoint_parse(&gmp_endpoints[0], DEFAULT_GMP_ENDPOINT, 0)) {
+        gmp_endpoint_count = 1;
+    }
+}
+
+static int gmp_stream_flush_sink(void *obj, void *arg, int flags)
+{
+    struct gmp_stream *stream = obj;
+    const struct timeval *now = arg;
+
+    //编码器换源端口重连后旧流不再有数据, 放出窗口中剩余的包后释放
+    if (gmp_stream_idle && css_tvdiff_ms(*now, stream->last_seen) >= (int64_t) gmp_stream_idle * 1000) {
+        while (stream->t_Recordering) {
+            gmp_stream_flush_cb(-1, 0, stream);
+        }
+        css_log(LOG_NOTICE, "gmp stream %s idle for %d s, removed\n", stream->name, gmp_stream_idle);
+        gmp_stream_release(stream);
+        return CMP_MATCH;
+    }
+
+    css_recorder_flush(stream->sink);
+    if (stream->es) {
+        css_recorder_flush(stream->es);
+    }
+
+    return 0;
+}
+
+/*!
+ * \brief Periodically push partly filled recording chunks of a worker to the
+ * writer, and drop the streams that went idle.
+ */
+static void gmp_worker_flush_cb(evutil_socket_t fd, short events, void *arg)
+{
+    struct gmp_worker *worker = arg;
+    struct timeval now;
+    int i, queued;
+
+    //顺便采样接收队列深度
+    for (i = 0; i < worker->nsocks; i++) {
+        if ((queued = gmp_socket_queued(&worker->socks[i], NULL)) > (int) worker->socks[i].stats.queue_peak) {
+            worker->socks[i].stats.queue_peak = queued;
+        }
+    }
+
+    css_recorder_flush(worker->normal);
+    event_base_gettimeofday_cached(worker->base, &now);
+    ao2_callback(worker->streams, OBJ_NODATA | OBJ_MULTIPLE | OBJ_UNLINK, gmp_stream_flush_sink, &now);
+}
+
+static int gmp_stream_sample_stats(void *obj, void *arg, int flags)
+{
+    struct gmp_stream *stream = obj;
+    struct gmp_stream_stats *cur = &stream->stats, *last = &stream->sampled;
+
+    if (cur->packets == last->packets && cur->dups == last->dups && cur->late == last->late &&
+        cur->foreign == last->foreign) {
+        return 0;
+    }
+
+    css_log(LOG_NOTICE, "gmp stream %s: %u packets out, %u gaps (%u lost), %u duplicates, %u late, %u frames, %u frames dropped, %u not H.264\n",
+            stream->name, cur->packets - last->packets, cur->gaps - last->gaps, cur->lost - last->lost,
+            cur->dups - last->dups, cur->late - last->late,
+            cur->frames - last->frames, cur->frames_dropped - last->frames_dropped, cur->foreign - last->foreign);
+    *last = *cur;
+
+    return 0;
+}
+
+/*! \brief Write what every stream of a worker did since the last sample to the log */
+static void gmp_worker_stats_cb(evutil_socket_t fd, short events, void *arg)
+{
+    struct gmp_worker *worker = arg;
+    struct gmp_socket_stats *stats;
+    int i, r;
+
+    for (i = 0; i < worker->nsocks; i++) {
+        stats = &worker->socks[i].stats;
+        if (stats->drops != stats->drops_sampled) {
+            css_log(LOG_WARNING, "gmp endpoint %s worker %d: receive buffer overflowed, %u datagrams dropped by the kernel\n",
+                    worker->socks[i].endpoint->name, worker->index, stats->drops - stats->drops_sampled);
+            stats->drops_sampled = stats->drops;
+        }
+        if (stats->truncated != stats->truncated_sampled) {
+            css_log(LOG_WARNING, "gmp endpoint %s worker %d: %u datagrams longer than %d bytes truncated\n",
+                    worker->socks[i].endpoint->name, worker->index, stats->truncated - stats->truncated_sampled, GMP_MTU);
+            stats->truncated_sampled = stats->truncated;
+        }
+        for (r = 1; r < CSS_GMP_PARSE_RESULTS; r++) {
+            if (stats->rejected[r] != stats->rejected_sampled[r]) {
+                css_log(LOG_WARNING, "gmp endpoint %s worker %d: %u datagrams dropped: %s\n",
+                        worker->socks[i].endpoint->name, worker->index, stats->rejected[r] - stats->rejected_sampled[r],
+                        css_gmp_parse_str(-r));
+                stats->rejected_sampled[r] = stats->rejected[r];
+            }
+        }
+    }
+
+    ao2_callback(worker->streams, OBJ_NODATA, gmp_stream_sample_stats, NULL);
+}
+
+static int gmp_stream_release_cb(void *obj, void *arg, int flags)
+{
+    gmp_stream_release(obj);
+
+    return CMP_MATCH;
+}
+
+static void gmp_worker_destroy(struct gmp_worker *worker)
+{
+    int i;
+
+    for (i = 0; i < worker->nsocks; i++) {
+        if (worker->socks[i].ev) {
+            event_free(worker->socks[i].ev);
+        }
+        //关闭套接字同时退出组播组
+        if (worker->socks[i].fd > -1) {
+            close(worker->socks[i].fd);
+        }
+    }
+    worker->nsocks = 0;
+    if (worker->flush_ev) {
+        event_free(worker->flush_ev);
+        worker->flush_ev = NULL;
+    }
+    if (worker->stats_ev) {
+        event_free(worker->stats_ev);
+        worker->stats_ev = NULL;
+    }
+    //stream timers live on the worker base, free them first
+    if (worker->streams) {
+        ao2_callback(worker->streams, OBJ_NODATA | OBJ_MULTIPLE | OBJ_UNLINK, gmp_stream_release_cb, NULL);
+        ao2_ref(worker->streams, -1);
+        worker->streams = NULL;
+    }
+    if (worker->base) {
+        event_base_free(worker->base);
+        worker->base = NULL;
+    }
+    gmp_rx_ring_free(worker->ring);
+    worker->ring = NULL;
+    if (worker->normal) {
+        css_recorder_close(worker->normal);
+        worker->normal = NULL;
+    }
+    //streams hand their packages back above, the pool goes last
+    frame_pool_destroy(&worker->pool);
+}
+
+/*!
+ * \brief Open the socket of an endpoint for a worker and join its groups.
+ * \retval 0 on success, -1 on failure (the socket is closed).
+ */
+static int gmp_socket_open(struct gmp_worker *worker, struct gmp_socket *sock)
+{
+    struct gmp_endpoint *ep = sock->endpoint;
+    struct timeval timeout = {1,0};
+    int flag = 1, size;
+    socklen_t len = sizeof(size);
+    int i;
+
+    if((sock->fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+       css_log(LOG_ERROR, "css monitor worker %d init socket failed\n", worker->index);
+       return -1;
+    }
+
+    if (setsockopt(sock->fd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(int)) < 0) {
+        css_log(LOG_ERROR, "css monitor worker %d setsockopt SO_REUSEADDR failed\n", worker->index);
+        goto failed;
+    }
+
+    //多个接收线程共享同一端口, 由内核按流哈希分发
+    if (!ep->multicast && setsockopt(sock->fd, SOL_SOCKET, SO_REUSEPORT, &flag, sizeof(int)) < 0) {
+        css_log(LOG_ERROR, "css monitor worker %d setsockopt SO_REUSEPORT failed: %s\n", worker->index, strerror(errno));
+        goto failed;
+    }
+
+    if(setsockopt(sock->fd,SOL_SOCKET,SO_RCVTIMEO,(char *)&timeout,sizeof(timeout))<0) {
+        css_log(LOG_ERROR, "css monitor worker %d setsockopt SO_RCVTIMEO failed\n", worker->index);
+        goto failed;
+    }
+
+    if (ep->rcvbuf) {
+        size = ep->rcvbuf * 1024;
+        //超过 rmem_max 需要 CAP_NET_ADMIN
+        if (setsockopt(sock->fd, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) < 0) {
+            setsockopt(sock->fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+        }
+        //内核记录的是两倍的请求值
+        if (!getsockopt(sock->fd, SOL_SOCKET, SO_RCVBUF, &size, &len) && size / 2 < ep->rcvbuf * 1024) {
+            css_log(LOG_WARNING, "css monitor endpoint %s receive buffer is %d KB, not %d KB, raise net.core.rmem_max\n",
+                    ep->name, size / 2 / 1024, ep->rcvbuf);
+        }
+    }
+
+    //每个包带上内核接收时间和套接字累计丢包数
+    if (setsockopt(sock->fd, SOL_SOCKET, SO_TIMESTAMPNS, &flag, sizeof(flag)) < 0) {
+        css_log(LOG_WARNING, "css monitor endpoint %s setsockopt SO_TIMESTAMPNS failed: %s\n", ep->name, strerror(errno));
+    }
+    if (setsockopt(sock->fd, SOL_SOCKET, SO_RXQ_OVFL, &flag, sizeof(flag)) < 0) {
+        css_log(LOG_WARNING, "css monitor endpoint %s setsockopt SO_RXQ_OVFL failed: %s\n", ep->name, strerror(errno));
+    }
+
+    evutil_make_socket_nonblocking(sock->fd);
+
+    if (bind(sock->fd, (struct sockaddr*)&ep->addr, sizeof(ep->addr)) < 0 ) {
+        css_log(LOG_ERROR, "css monitor worker %d bind %s failed: %s\n",
+                worker->index, ep->name, strerror(errno));
+        goto failed;
+    }
+
+    if (ep->multicast) {
+        flag = 0;
+        //只接收本套接字加入的组, 不接收同端口其他组的数据
+        if (setsockopt(sock->fd, IPPROTO_IP, IP_MULTICAST_ALL, &flag, sizeof(flag)) < 0) {
+            css_log(LOG_WARNING, "css monitor endpoint %s setsockopt IP_MULTICAST_ALL failed: %s\n", ep->name, strerror(errno));
+        }
+        if (!ep->nsources) {
+            struct ip_mreq mreq;
+
+            mreq.imr_multiaddr = ep->addr.sin_addr;
+            mreq.imr_interface = ep->interface;
+            if (setsockopt(sock->fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0) {
+                css_log(LOG_ERROR, "css monitor endpoint %s join failed: %s\n", ep->name, strerror(errno));
+                goto failed;
+            }
+        }
+        for (i = 0; i < ep->nsources; i++) {
+            struct ip_mreq_source mreq;
+
+            mreq.imr_multiaddr = ep->addr.sin_addr;
+            mreq.imr_interface = ep->interface;
+            mreq.imr_sourceaddr = ep->sources[i];
+            if (setsockopt(sock->fd, IPPROTO_IP, IP_ADD_SOURCE_MEMBERSHIP, &mreq, sizeof(mreq)) < 0) {
+                css_log(LOG_ERROR, "css monitor endpoint %s join source %s failed: %s\n",
+                        ep->name, css_inet_ntoa(ep->sources[i]), strerror(errno));
+                goto failed;
+            }
+        }
+    }
+
+    sock->ev = event_new(worker->base, sock->fd, EV_READ|EV_PERSIST,
+            worker->ring ? onReadBatch : onRead, sock);
+    if (!sock->ev || event_add(sock->ev, NULL) == -1) {
+        css_log(LOG_ERROR, "css monitor worker %d event add failed\n", worker->index);
+        goto failed;
+    }
+
+    return 0;
+
+failed:
+    close(sock->fd);
+    sock->fd = -1;
+    return -1;
+}
+
+/*!
+ * \brief Set up one worker: event base, endpoint sockets and receive ring.
+ * \retval 0 on success, -1 on failure (the worker is left destroyable).
+ */
+static int gmp_worker_init(struct gmp_worker *worker, int index)
+{
+    struct timeval flush = css_tv(gmp_record_flush / 1000, (gmp_record_flush % 1000) * 1000);
+    struct gmp_socket *sock;
+    int ncpus, i;
+
+    worker->index = index;
+    worker->cpu = -1;
+    worker->thread = CSS_PTHREADT_NULL;
+
+    if (!(worker->streams = ao2_container_alloc(GMP_STREAM_BUCKETS, gmp_stream_hash, gmp_stream_cmp))) {
+        css_log(LOG_ERROR, "css monitor worker %d stream container failed\n", index);
+        return -1;
+    }
+
+    //预分配一个接收缓冲的包
+    if (frame_pool_init(&worker->pool, RECEPTION_BUFFER_LENGTH)) {
+        css_log(LOG_ERROR, "css monitor worker %d package pool failed\n", index);
+        return -1;
+    }
+
+    if (!(worker->base = event_base_new())) {
+        css_log(LOG_ERROR, "css monitor worker %d init event failed\n", index);
+        return -1;
+    }
+
+    if (!(worker->normal = css_recorder_open(gmp_recorder, index, pathname))) {
+        css_log(LOG_ERROR, "css monitor worker %d open %s failed\n", index, pathname);
+        return -1;
+    }
+
+    worker->flush_ev = event_new(worker->base, -1, EV_PERSIST, gmp_worker_flush_cb, worker);
+    if (!worker->flush_ev || event_add(worker->flush_ev, &flush) == -1) {
+        css_log(LOG_ERROR, "css monitor worker %d flush timer failed\n", index);
+        return -1;
+    }
+
+    if (gmp_stats_interval) {
+        struct timeval interval = css_tv(gmp_stats_interval, 0);
+
+        worker->stats_ev = event_new(worker->base, -1, EV_PERSIST, gmp_worker_stats_cb, worker);
+        if (!worker->stats_ev || event_add(worker->stats_ev, &interval) == -1) {
+            css_log(LOG_WARNING, "css monitor worker %d stats timer failed, stats are not logged\n", index);
+        }
+    }
+
+    if (gmp_recv_batch > 1 && !(worker->ring = gmp_rx_ring_alloc(gmp_recv_batch, &worker->pool))) {
+        css_log(LOG_WARNING, "css monitor worker %d batch ring failed, receive one package per wakeup\n", index);
+    }
+
+    for (i = 0; i < gmp_endpoint_count; i++) {
+        //组播地址只由一个接收线程加入
+        if (gmp_endpoints[i].multicast && i % gmp_worker_count != index) {
+            continue;
+        }
+        sock = &worker->socks[worker->nsocks++];
+        sock->endpoint = &gmp_endpoints[i];
+        sock->worker = worker;
+        if (gmp_socket_open(worker, sock)) {
+            return -1;
+        }
+        css_log(LOG_NOTICE, "css monitor worker %d receives on %s%s\n", index, gmp_endpoints[i].name,
+                gmp_endpoints[i].multicast ? (gmp_endpoints[i].nsources ? " (source specific multicast)" : " (multicast)") : "");
+    }
+
+    if (gmp_worker_affinity && (ncpus = sysconf(_SC_NPROCESSORS_ONLN)) > 0) {
+        worker->cpu = index % ncpus;
+    }
+
+    return 0;
+}
+
+static void *gmp_worker_run(void *data)
+{
+    struct gmp_worker *worker = data;
+
+    if (worker->cpu > -1) {
+        cpu_set_t cpus;
+
+        CPU_ZERO(&cpus);
+        CPU_SET(worker->cpu, &cpus);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus)) {
+            css_log(LOG_WARNING, "css monitor worker %d can not pin to cpu %d\n", worker->index, worker->cpu);
+            worker->cpu = -1;
+        }
+    }
+
+    css_log(LOG_NOTICE, "css monitor worker %d running on cpu %d\n", worker->index, worker->cpu);
+
+    event_base_dispatch(worker->base);
+
+    return NULL;
+}
+
+/*!
+ * \brief Parse a GMP time, "<sec>[.<fraction>]".
+ * \retval 0 on success, -1 if \a s is not a time
+ */
+static int gmp_parse_time(const char *s, unsigned int *sec, unsigned int *nsec)
+{
+    char frac[10] = "";
+    int i;
+
+    if (sscanf(s, "%u.%9[0-9]", sec, frac) < 1) {
+        return -1;
+    }
+    //小数部分补足到纳秒
+    for (i = strlen(frac); i < 9; i++) {
+        frac[i] = '0';
+    }
+    frac[9] = '\0';
+    *nsec = strtoul(frac, NULL, 10);
+
+    return 0;
+}
+
+static void gmp_client_destroy(void *obj)
+{
+    struct gmp_client *client = obj;
+
+    if (client->vod_seg) {
+        //已排队的数据各自持有文件段的引用
+        evbuffer_file_segment_free(client->vod_seg);
+    }
+    if (client->vod) {
+        css_vod_close(client->vod);
+    }
+}
+
+/*!
+ * \brief Queue the next frames of a recording, up to GMP_VOD_FILL bytes.
+ *
+ * Only the package payloads are queued, as file ranges, so the player
+ * gets the same elementary stream as a live one.  Adjacent payloads are
+ * queued as one range.  In a sort recording every payload follows a GMP
+ * header, so each package is a range (and a sendfile()) of its own; the
+ * frames of a segment recording follow each other, so a whole fill goes
+ * out as a single range.
+ *
+ * \retval 1 once the whole recording is queued
+ */
+static int gmp_client_vod_fill(struct gmp_client *client)
+{
+    struct evbuffer *output = bufferevent_get_output(client->bev);
+    const struct css_vod_frame *frame;
+    off_t payload, start = 0;
+    size_t len, run = 0, queued = evbuffer_get_length(output);
+    int res = 0;
+
+    while (queued < GMP_VOD_FILL) {
+        if (!(frame = css_vod_frame(client->vod, client->vod_frame))) {
+            res = 1;
+            break;
+        }
+        if (client->vod_pos < frame->offset) {
+            client->vod_pos = frame->offset;
+        }
+        while ((len = css_vod_next_package(client->vod, frame, &client->vod_pos, &payload))) {
+            client->bytes += len;
+            queued += len;
+            //紧接上一段则合并
+            if (run && start + run == payload) {
+                run += len;
+                continue;
+            }
+            if (run && evbuffer_add_file_segment(output, client->vod_seg, start, run)) {
+                return -1;
+            }
+            start = payload;
+            run = len;
+        }
+        client->vod_frame++;
+        client->frames++;
+    }
+
+    if (run && evbuffer_add_file_segment(output, client->vod_seg, start, run)) {
+        return -1;
+    }
+
+    return res;
+}
+
+/*!
+ * \brief Start playing a recording, "VOD <recording> [<sec>[.<fraction>]]".
+ *
+ * Only files in the sort recording directory can be played.
+ */
+static void gmp_client_vod(struct gmp_client *client, char *args)
+{
+    struct evbuffer *output = bufferevent_get_output(client->bev);
+    const struct css_vod_frame *frame;
+    char filename[256], *name, *time;
+    unsigned int sec = 0, nsec = 0;
+    int start;
+
+    name = strsep(&args, " ");
+    time = args ? css_strip(args) : NULL;
+    if (css_strlen_zero(name) || (!css_strlen_zero(time) && gmp_parse_time(time, &sec, &nsec))) {
+        evbuffer_add_printf(output, "ERR usage: VOD <recording> [<sec>[.<fraction>]]\r\n");
+        client->closing = 1;
+        return;
+    }
+    if (strchr(name, '/') || name[0] == '.') {
+        evbuffer_add_printf(output, "ERR bad recording name\r\n");
+        client->closing = 1;
+        return;
+    }
+
+    snprintf(filename, sizeof(filename), "%s/%s", sortpathname, name);
+    if (!(client->vod = css_vod_open(filename))) {
+        evbuffer_add_printf(output, "ERR can not open %s\r\n", name);
+        client->closing = 1;
+        return;
+    }
+    if ((start = css_vod_seek(client->vod, sec, nsec)) < 0) {
+        evbuffer_add_printf(output, "ERR %s holds no key frame\r\n", name);
+        client->closing = 1;
+        return;
+    }
+    //文件段拥有自己的描述符, 发送中的数据不依赖点播对象
+    if (!(client->vod_seg = evbuffer_file_segment_new(dup(css_vod_fd(client->vod)), 0,
+            css_vod_size(client->vod), EVBUF_FS_CLOSE_ON_FREE))) {
+        evbuffer_add_printf(output, "ERR out of memory\r\n");
+        client->closing = 1;
+        return;
+    }
+
+    css_copy_string(client->vod_name, name, sizeof(client->vod_name));
+    client->vod_frame = start;
+    frame = css_vod_frame(client->vod, start);
+    evbuffer_add_printf(output, "OK %s %d %u.%09u\r\n", name, css_vod_count(client->vod) - start, frame->sec, frame->nsec);
+    css_log(LOG_NOTICE, "gmp player %s plays recording %s from frame %d at %u.%09u\n",
+            client->addr, name, start, frame->sec, frame->nsec);
+
+    bufferevent_set_timeouts(client->bev, NULL, NULL);
+    //待发送数据降到低水位时写回调继续排队
+    bufferevent_setwatermark(client->bev, EV_WRITE, GMP_VOD_LOW, 0);
+    if (gmp_client_vod_fill(client)) {
+        client->closing = 1;
+    }
+}
+
+/*!
+ * \brief Drop a player: stop feeding it and free its connection.
+ *
+ * Frames still queued by reference are released by bufferevent_free().
+ * Must not be called under a container lock or the bufferevent lock:
+ * the ingest workers take the bufferevent lock under the channel player
+ * container lock.
+ */
+static void gmp_client_close(struct gmp_client *client)
+{
+    if (client->channel) {
+        //解除订阅后接收线程不再访问该连接
+        ao2_unlink(client->channel->clients, client);
+        gmp_channel_put(client->channel);
+        client->channel = NULL;
+    }
+    ao2_unlink(gmp_clients, client);
+    bufferevent_free(client->bev);
+    client->bev = NULL;
+    ao2_ref(client, -1);
+}
+
+static void conn_readcb(struct bufferevent *bev, void *user_data)
+{
+    struct gmp_client *client = user_data;
+    struct evbuffer *input = bufferevent_get_input(bev);
+    struct evbuffer *output = bufferevent_get_output(bev);
+    struct gmp_channel *channel;
+    char *line, *args, *cmd;
+    int primed;
+
+    if (client->channel || client->vod || client->closing) {
+        //播放开始后忽略播放端发来的数据
+        evbuffer_drain(input, evbuffer_get_length(input));
+        return;
+    }
+
+    if (!(line = evbuffer_readln(input, NULL, EVBUFFER_EOL_CRLF))) {
+        if (evbuffer_get_length(input) > GMP_PLAY_LINE_MAX) {
+            css_log(LOG_WARNING, "gmp player %s request too long\n", client->addr);
+            gmp_client_close(client);
+        }
+        return;
+    }
+
+    args = line;
+    cmd = strsep(&args, " ");
+    if (!strcasecmp(cmd, "VOD")) {
+        gmp_client_vod(client, args);
+    } else if (strcasecmp(cmd, "PLAY") || !args || css_strlen_zero(args = css_strip(args))) {
+        evbuffer_add_printf(output, "ERR usage: PLAY <stream>\r\n");
+        client->closing = 1;
+    } else if (!(channel = gmp_channel_get(args))) {
+        evbuffer_add_printf(output, "ERR out of memory\r\n");
+        client->closing = 1;
+    } else {
+        //先写应答, 再加入频道, 保证应答在第一帧之前
+        client->channel = channel;
+        evbuffer_add_printf(output, "OK %s\r\n", channel->name);
+        bufferevent_set_timeouts(bev, NULL, NULL);
+        ao2_lock(channel->clients);
+        primed = gmp_client_prime(client, channel);
+        ao2_link(channel->clients, client);
+        ao2_unlock(channel->clients);
+        css_log(LOG_NOTICE, "gmp player %s plays %s, %d cached frame%s\n", client->addr, channel->name, primed, ESS(primed));
+    }
+    css_free(line);
+}
+
+static void conn_writecb(struct bufferevent *bev, void *user_data)
+{
+    struct gmp_client *client = user_data;
+
+    if (client->vod && !client->closing && gmp_client_vod_fill(client)) {
+        //整个录制已排队, 发送完后关闭
+        client->closing = 1;
+    }
+    if (client->closing && !evbuffer_get_length(bufferevent_get_output(bev))) {
+        gmp_client_close(client);
+    }
+}
+
+/*!
+ * \brief Output buffer callback, runs under the bufferevent lock.
+ *
+ * Keeps the queue length where the CLI can read it without taking the
+ * bufferevent lock under the player container lock.
+ */
+static void gmp_client_output_cb(struct evbuffer *buffer, const struct evbuffer_cb_info *info, void *arg)
+{
+    struct gmp_client *client = arg;
+
+    client->queued = info->orig_size + info->n_added - info->n_deleted;
+}
+
+static void conn_eventcb(struct bufferevent *bev, short events, void *user_data)
+{
+    struct gmp_client *client = user_data;
+
+    if (events & BEV_EVENT_EOF) {
+        css_log(LOG_NOTICE, "gmp player %s closed\n", client->addr);
+    } else if (events & BEV_EVENT_TIMEOUT) {
+        css_log(LOG_NOTICE, "gmp player %s sent no request\n", client->addr);
+    } else if (events & BEV_EVENT_ERROR) {
+        css_log(LOG_NOTICE, "gmp player %s error: %s\n", client->addr,
+                evutil_socket_error_to_string(EVUTIL_SOCKET_ERROR()));
+    }
+    gmp_client_close(client);
+}
+
+static void listener_cb(struct evconnlistener *listener, evutil_socket_t fd,
+    struct sockaddr *sa, int socklen, void *user_data)
+{
+    struct event_base *base = user_data;
+    struct sockaddr_in *sin = (struct sockaddr_in *) sa;
+    struct timeval timeout = { GMP_PLAY_REQUEST_TIMEOUT, 0 };
+    struct gmp_client *client;
+
+    if (!(client = ao2_alloc(sizeof(*client), gmp_client_destroy))) {
+        evutil_closesocket(fd);
+        return;
+    }
+    snprintf(client->addr, sizeof(client->addr), "%s:%d", css_inet_ntoa(sin->sin_addr), ntohs(sin->sin_port));
+    client->start = css_tvnow();
+
+    //接收线程直接向连接写帧, 必须线程安全; 接收线程先锁频道再锁连接,
+    //回调里要锁频道和连接容器, 所以回调不能持有连接锁
+    if (!(client->bev = bufferevent_socket_new(base, fd, BEV_OPT_CLOSE_ON_FREE | BEV_OPT_THREADSAFE |
+            BEV_OPT_DEFER_CALLBACKS | BEV_OPT_UNLOCK_CALLBACKS))) {
+        css_log(LOG_ERROR, "gmp player %s bufferevent failed\n", client->addr);
+        evutil_closesocket(fd);
+        ao2_ref(client, -1);
+        return;
+    }
+    bufferevent_setcb(client->bev, conn_readcb, conn_writecb, conn_eventcb, client);
+    evbuffer_add_cb(bufferevent_get_output(client->bev), gmp_client_output_cb, client);
+    bufferevent_set_timeouts(client->bev, &timeout, NULL);
+    bufferevent_enable(client->bev, EV_READ | EV_WRITE);
+
+    //连接本身持有一个引用, 容器持有另一个
+    ao2_link(gmp_clients, client);
+}
+
+/*! \brief Play port thread: accept players and write their queued frames */
+void *css_monitor_init(void *data)
+{
+    struct evconnlistener *listener;
+    struct sockaddr_in sin;
+
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_port = htons(gmp_play_port);
+
+    listener = evconnlistener_new_bind(gmp_play_base, listener_cb, (void *)gmp_play_base,
+        LEV_OPT_REUSEABLE|LEV_OPT_CLOSE_ON_FREE|LEV_OPT_THREADSAFE, -1,
+        (struct sockaddr*)&sin,
+        sizeof(sin));
+
+    if (!listener) {
+        css_log(LOG_ERROR, "css monitor can not listen on play port %d: %s\n", gmp_play_port, strerror(errno));
+        return NULL;
+    }
+
+    css_log(LOG_NOTICE, "css monitor play port %d\n", gmp_play_port);
+
+    event_base_dispatch(gmp_play_base);
+
+    evconnlistener_free(listener);
+
+    css_log(LOG_NOTICE,"css monitor done!\n");
+
+    return NULL;
+}
+
+/*! \brief Start the play port thread, playing is off if this fails */
+static void gmp_play_start(void)
+{
+    if (!(gmp_channels = ao2_container_alloc(GMP_CHANNEL_BUCKETS, gmp_channel_hash, gmp_channel_cmp)) ||
+        !(gmp_clients = ao2_container_alloc(GMP_CLIENT_BUCKETS, gmp_client_hash, NULL)) ||
+        !(gmp_play_base = event_base_new())) {
+        css_log(LOG_ERROR, "css monitor play init failed, playing is off\n");
+        goto failed;
+    }
+
+    if (css_pthread_create_background(&gmp_play_thread, NULL, css_monitor_init, NULL)) {
+        css_log(LOG_ERROR, "css monitor play thread start failed, playing is off\n");
+        gmp_play_thread = CSS_PTHREADT_NULL;
+        goto failed;
+    }
+
+    return;
+
+failed:
+    if (gmp_play_base) {
+        event_base_free(gmp_play_base);
+        gmp_play_base = NULL;
+    }
+    if (gmp_clients) {
+        ao2_ref(gmp_clients, -1);
+        gmp_clients = NULL;
+    }
+    if (gmp_channels) {
+        ao2_ref(gmp_channels, -1);
+        gmp_channels = NULL;
+    }
+}
+
+/*! \brief Stop the play port thread and drop every player, after the workers are gone */
+static void gmp_play_stop(void)
+{
+    struct ao2_iterator i;
+    struct gmp_client *client;
+
+    if (gmp_play_thread == CSS_PTHREADT_NULL) {
+        return;
+    }
+
+    event_base_loopbreak(gmp_play_base);
+    pthread_join(gmp_play_thread, NULL);
+    gmp_play_thread = CSS_PTHREADT_NULL;
+
+    //逐个摘下后在容器锁外关闭
+    i = ao2_iterator_init(gmp_clients, AO2_ITERATOR_UNLINK);
+    while ((client = ao2_iterator_next(&i))) {
+        gmp_client_close(client);
+        //容器的引用
+        ao2_ref(client, -1);
+    }
+    ao2_iterator_destroy(&i);
+    //排着的延迟回调还持有连接, 跑一轮让它们释放
+    event_base_loop(gmp_play_base, EVLOOP_NONBLOCK);
+    event_base_free(gmp_play_base);
+    gmp_play_base = NULL;
+    ao2_ref(gmp_clients, -1);
+    gmp_clients = NULL;
+    ao2_ref(gmp_channels, -1);
+    gmp_channels = NULL;
+}
+
+/*! \brief CLI command to show the arrival jitter and release deadline of every stream */
+static char *handle_gmp_show_jitter(struct css_cli_entry *e, int cmd, struct css_cli_args *a)
+{
+#define FORMAT  "%-32.32s %-6.6s %-11.11s %-9.9s %-7.7s %-8.8s %-9.9s\n"
+#define FORMAT2 "%-32.32s %-6d %4u.%03u    %-9u %-7d %-8u %-9d\n"
+    struct ao2_iterator i;
+    struct gmp_stream *stream;
+    unsigned int jitter;
+    int w, count = 0;
+
+    switch (cmd) {
+    case CLI_INIT:
+        e->command = "gmp show jitter";
+        e->usage =
+            "Usage: gmp show jitter\n"
+            "       Show the interarrival jitter, reorder distance and\n"
+            "       reorder release deadline of every GMP stream.\n";
+        return NULL;
+    case CLI_GENERATE:
+        return NULL;
+    }
+
+    if (a->argc != 3) {
+        return CLI_SHOWUSAGE;
+    }
+
+    css_cli(a->fd, "Reorder mode: %s, timeout %d ms, min %d ms, percentile %d\n",
+            gmp_reorder_mode == GMP_REORDER_ADAPTIVE ? "adaptive" : "fixed",
+            gmp_reorder_timeout, gmp_reorder_min, gmp_reorder_percentile);
+    css_cli(a->fd, FORMAT, "Stream", "Worker", "Jitter(ms)", "Reordered", "MaxDist", "Samples", "Depth(ms)");
+
+    for (w = 0; gmp_workers && w < gmp_worker_count; w++) {
+        if (!gmp_workers[w].streams) {
+            continue;
+        }
+        i = ao2_iterator_init(gmp_workers[w].streams, 0);
+        while ((stream = ao2_iterator_next(&i))) {
+            jitter = stream->jitter >> 4;
+            css_cli(a->fd, FORMAT2, stream->name, w, jitter / 1000, jitter % 1000,
+                    stream->reordered, stream->reorder_max, stream->gap_samples, stream->depth);
+            count++;
+            ao2_ref(stream, -1);
+        }
+        ao2_iterator_destroy(&i);
+    }
+
+    css_cli(a->fd, "%d gmp stream%s\n", count, ESS(count));
+
+    return CLI_SUCCESS;
+#undef FORMAT
+#undef FORMAT2
+}
+
+/*! \brief CLI command to show the ordered output counters of every stream */
+static char *handle_gmp_show_stats(struct css_cli_entry *e, int cmd, struct css_cli_args *a)
+{
+#define FORMAT  "%-32.32s %-6.6s %-10.10s %-8.8s %-8.8s %-8.8s %-8.8s %-9.9s %-8.8s %-8.8s\n"
+#define FORMAT2 "%-32.32s %-6d %-10u %-8u %-8u %-8u %-8u %-9u %-8u %-8u\n"
+    struct ao2_iterator i;
+    struct gmp_stream *stream;
+    struct gmp_stream_stats stats;
+    int w, count = 0;
+
+    switch (cmd) {
+    case CLI_INIT:
+        e->command = "gmp show stats";
+        e->usage =
+            "Usage: gmp show stats\n"
+            "       Show the packages put out, gaps, lost, duplicate and late\n"
+            "       packages and the frames assembled of every GMP stream.\n"
+            "       NotH264 counts packages of another media type, which are\n"
+            "       recorded but left out of the frames.\n";
+        return NULL;
+    case CLI_GENERATE:
+        return NULL;
+    }
+
+    if (a->argc != 3) {
+        return CLI_SHOWUSAGE;
+    }
+
+    css_cli(a->fd, FORMAT, "Stream", "Worker", "Packets", "Gaps", "Lost", "Dups", "Late", "Frames", "Dropped", "NotH264");
+
+    for (w = 0; gmp_workers && w < gmp_worker_count; w++) {
+        if (!gmp_workers[w].streams) {
+            continue;
+        }
+        i = ao2_iterator_init(gmp_workers[w].streams, 0);
+        while ((stream = ao2_iterator_next(&i))) {
+            stats = stream->stats;
+            css_cli(a->fd, FORMAT2, stream->name, w, stats.packets, stats.gaps, stats.lost,
+                    stats.dups, stats.late, stats.frames, stats.frames_dropped, stats.foreign);
+            count++;
+            ao2_ref(stream, -1);
+        }
+        ao2_iterator_destroy(&i);
+    }
+
+    css_cli(a->fd, "%d gmp stream%s\n", count, ESS(count));
+
+    return CLI_SUCCESS;
+#undef FORMAT
+#undef FORMAT2
+}
+
+static int gmp_client_show(void *obj, void *arg, int flags)
+{
+#define FORMAT2 "%-21.21s %-28.28s %-5.5s %-8d %-9u %-12llu %-9zu %-9zu %-5u %-8u %-9lld\n"
+    static const char * const states[] = {
+        [GMP_CLIENT_WAIT] = "wait",
+        [GMP_CLIENT_SYNC] = "sync",
+        [GMP_CLIENT_LAG] = "lag",
+    };
+    struct gmp_client *client = obj;
+    int fd = *(int *) arg;
+    struct timeval now = css_tvnow();
+    int64_t lag_ms = client->lag_ms;
+
+    if (client->state == GMP_CLIENT_LAG) {
+        lag_ms += css_tvdiff_ms(now, client->lag_start);
+    }
+
+    css_cli(fd, FORMAT2, client->addr,
+            client->channel ? client->channel->name : client->vod ? client->vod_name : "(no request)",
+            client->channel ? states[client->state] : client->vod ? "vod" : "-",
+            (int) (css_tvdiff_ms(now, client->start) / 1000), client->frames,
+            (unsigned long long) client->bytes, client->queued / 1024,
+            client->queued_max / 1024, client->lags, client->dropped, (long long) lag_ms);
+
+    return 0;
+#undef FORMAT2
+}
+
+/*! \brief CLI command to show the players connected to the play port */
+static char *handle_gmp_show_players(struct css_cli_entry *e, int cmd, struct css_cli_args *a)
+{
+#define FORMAT  "%-21.21s %-28.28s %-5.5s %-8.8s %-9.9s %-12.12s %-9.9s %-9.9s %-5.5s %-8.8s %-9.9s\n"
+    int fd = a->fd, count;
+
+    switch (cmd) {
+    case CLI_INIT:
+        e->command = "gmp show players";
+        e->usage =
+            "Usage: gmp show players\n"
+            "       Show the players connected to the play port, the stream\n"
+            "       they watch, what was queued to them and how often they\n"
+            "       fell behind and had frames shed.\n";
+        return NULL;
+    case CLI_GENERATE:
+        return NULL;
+    }
+
+    if (a->argc != 3) {
+        return CLI_SHOWUSAGE;
+    }
+
+    if (!gmp_clients) {
+        css_cli(a->fd, "Playing is off\n");
+        return CLI_SUCCESS;
+    }
+
+    css_cli(a->fd, "Play port %d, queue high %d KB, low %d KB\n", gmp_play_port, gmp_play_queue_high, gmp_play_queue_low);
+    css_cli(a->fd, FORMAT, "Player", "Stream", "State", "Time(s)", "Frames", "Bytes", "Queue(KB)", "Max(KB)",
+            "Lags", "Dropped", "Lag(ms)");
+    //在容器锁内只读连接自己的字段, 不碰 bufferevent
+    ao2_callback(gmp_clients, OBJ_NODATA, gmp_client_show, &fd);
+    count = ao2_container_count(gmp_clients);
+    css_cli(a->fd, "%d gmp player%s\n", count, ESS(count));
+
+    return CLI_SUCCESS;
+#undef FORMAT
+}
+
+/*! \brief CLI command to show the play channels and their cached GOP */
+static char *handle_gmp_show_channels(struct css_cli_entry *e, int cmd, struct css_cli_args *a)
+{
+#define FORMAT  "%-32.32s %-8.8s %-10.10s %-10.10s\n"
+#define FORMAT2 "%-32.32s %-8d %-10d %-10zu\n"
+    struct ao2_iterator i;
+    struct gmp_channel *channel;
+    int players, frames, count;
+    size_t bytes;
+
+    switch (cmd) {
+    case CLI_INIT:
+        e->command = "gmp show channels";
+        e->usage =
+            "Usage: gmp show channels\n"
+            "       Show the streams that can be played, their players and\n"
+            "       the GOP cached to start new players.\n";
+        return NULL;
+    case CLI_GENERATE:
+        return NULL;
+    }
+
+    if (a->argc != 3) {
+        return CLI_SHOWUSAGE;
+    }
+
+    if (!gmp_channels) {
+        css_cli(a->fd, "Playing is off\n");
+        return CLI_SUCCESS;
+    }
+
+    css_cli(a->fd, "GOP cache %s, at most %d frames, %d KB\n", gmp_gop_cache ? "on" : "off", gmp_gop_frames, gmp_gop_size);
+    css_cli(a->fd, FORMAT, "Stream", "Players", "GOP", "GOP(KB)");
+
+    i = ao2_iterator_init(gmp_channels, 0);
+    while ((channel = ao2_iterator_next(&i))) {
+        ao2_lock(channel->clients);
+        players = ao2_container_count(channel->clients);
+        frames = channel->gop_count;
+        bytes = channel->gop_bytes;
+        ao2_unlock(channel->clients);
+        css_cli(a->fd, FORMAT2, channel->name, players, frames, bytes / 1024);
+        ao2_ref(channel, -1);
+    }
+    ao2_iterator_destroy(&i);
+
+    count = ao2_container_count(gmp_channels);
+    css_cli(a->fd, "%d gmp channel%s\n", count, ESS(count));
+
+    return CLI_SUCCESS;
+#undef FORMAT
+#undef FORMAT2
+}
+
+/*! \brief CLI command to show the kernel side of the ingest sockets */
+static char *handle_gmp_show_sockets(struct css_cli_entry *e, int cmd, struct css_cli_args *a)
+{
+#define FORMAT  "%-21.21s %-6.6s %-11.11s %-8.8s %-8.8s %-8.8s %-9.9s %-8.8s %-8.8s %-10.10s %-9.9s %-9.9s\n"
+#define FORMAT2 "%-21.21s %-6d %-11llu %-8u %-8u %-8u %-9s %-8u %-8s %-10u %-9llu %-9u\n"
+    struct gmp_socket *sock;
+    struct gmp_socket_stats *stats;
+    char queue[16], rcvbuf[16], line[256];
+    int w, i, b, queued, size, count = 0, histogram;
+    unsigned int rejected;
+    size_t pos;
+
+    switch (cmd) {
+    case CLI_INIT:
+        e->command = "gmp show sockets";
+        e->usage =
+            "Usage: gmp show sockets [histogram]\n"
+            "       Show every ingest socket: datagrams received, datagrams\n"
+            "       the kernel dropped because the receive buffer was full,\n"
+            "       datagrams truncated to the package size, datagrams\n"
+            "       whose header did not parse (Bad, broken down by reason),\n"
+            "       the receive queue now and at its largest, batches that\n"
+            "       filled every slot and the time from kernel receive to\n"
+            "       the worker.  A gap in the sequence numbers of a stream\n"
+            "       without a rise in Drops was lost before this host.\n"
+            "       With histogram, also show the latency distribution.\n";
+        return NULL;
+    case CLI_GENERATE:
+        return NULL;
+    }
+
+    if (a->argc < 3 || a->argc > 4 || (a->argc == 4 && strcasecmp(a->argv[3], "histogram"))) {
+        return CLI_SHOWUSAGE;
+    }
+    histogram = a->argc == 4;
+
+    if (!gmp_workers) {
+        css_cli(a->fd, "GMP ingest is not running\n");
+        return CLI_SUCCESS;
+    }
+
+    css_cli(a->fd, FORMAT, "Endpoint", "Worker", "Datagrams", "Drops", "Trunc", "Bad", "Queue(KB)", "Peak(KB)", "Buf(KB)",
+            "Full", "Avg(us)", "Max(us)");
+    for (w = 0; w < gmp_worker_count; w++) {
+        for (i = 0; i < gmp_workers[w].nsocks; i++) {
+            sock = &gmp_workers[w].socks[i];
+            stats = &sock->stats;
+            size = -1;
+            if ((queued = gmp_socket_queued(sock, &size)) < 0) {
+                css_copy_string(queue, "-", sizeof(queue));
+            } else {
+                snprintf(queue, sizeof(queue), "%d", queued / 1024);
+            }
+            if (size < 0) {
+                css_copy_string(rcvbuf, "-", sizeof(rcvbuf));
+            } else {
+                snprintf(rcvbuf, sizeof(rcvbuf), "%d", size / 1024);
+            }
+            for (rejected = 0, b = 1; b < CSS_GMP_PARSE_RESULTS; b++) {
+                rejected += stats->rejected[b];
+            }
+            css_cli(a->fd, FORMAT2, sock->endpoint->name, w, (unsigned long long) stats->datagrams, stats->drops,
+                    stats->truncated, rejected, queue, stats->queue_peak / 1024, rcvbuf, stats->batches_full,
+                    stats->stamped ? (unsigned long long) (stats->latency_sum / stats->stamped) : 0ULL, stats->latency_max);
+            if (rejected) {
+                pos = snprintf(line, sizeof(line), "    bad");
+                for (b = 1; b < CSS_GMP_PARSE_RESULTS; b++) {
+                    if (stats->rejected[b] && pos < sizeof(line)) {
+                        pos += snprintf(line + pos, sizeof(line) - pos, " %s:%u", css_gmp_parse_str(-b), stats->rejected[b]);
+                    }
+                }
+                css_cli(a->fd, "%s\n", line);
             }
-        }                   
- 
-        //                      
-        win_bottom = (max_seq - REORDERING_WINDOW_SIZE + SEQ_MAX) % SEQ_MAX;
-        int ur_wb = (espect_seq - win_bottom + SEQ_MAX)%SEQ_MAX;
-
-        if (t_Recordering) {
-            //          
-            win_bottom = (max_seq - REORDERING_WINDOW_SIZE + SEQ_MAX) % SEQ_MAX;
-            int ux_wb = (time_seq - win_bottom  + SEQ_MAX) % SEQ_MAX;
-            int ur_wb = (espect_seq - win_bottom + SEQ_MAX) % SEQ_MAX;
-            int uh_ux = (max_seq - time_seq + SEQ_MAX) % SEQ_MAX;
-            if (ur_wb >= ux_wb || (uh_ux >= REORDERING_WINDOW_SIZE && max_seq != time_seq)) {                            
-                t_Recordering = 0;
-                order_timer.tv_sec = 0;
-                order_timer.tv_usec = 0;
-                time_seq = 0;
+            if (histogram && stats->stamped) {
+                pos = snprintf(line, sizeof(line), "    us");
+                for (b = 0; b < GMP_LATENCY_BUCKETS; b++) {
+                    if (stats->latency[b] && pos < sizeof(line)) {
+                        pos += snprintf(line + pos, sizeof(line) - pos, " %s%lld:%u",
+                                b < GMP_LATENCY_BUCKETS - 1 ? "<" : ">=", 1LL << MIN(b, GMP_LATENCY_BUCKETS - 2), stats->latency[b]);
+                    }
+                }
+                css_cli(a->fd, "%s\n", line);
             }
+            count++;
+        }
+    }
+    css_cli(a->fd, "%d ingest socket%s\n", count, ESS(count));
+
+    return CLI_SUCCESS;
+#undef FORMAT
+#undef FORMAT2
+}
+
+/*! \brief CLI command to look a time up in a segment index */
+static char *handle_gmp_seek(struct css_cli_entry *e, int cmd, struct css_cli_args *a)
+{
+    struct css_segment_index *index;
+    struct css_segment_frame frame, last;
+    unsigned int sec, nsec;
+    int i, count;
+
+    switch (cmd) {
+    case CLI_INIT:
+        e->command = "gmp seek";
+        e->usage =
+            "Usage: gmp seek <index> <sec>[.<fraction>]\n"
+            "       Find where playing a recording segment at the given GMP\n"
+            "       time has to start: the IDR frame at or before it, with\n"
+            "       its offset in the segment file.\n";
+        return NULL;
+    case CLI_GENERATE:
+        return NULL;
+    }
+
+    if (a->argc != 4 || gmp_parse_time(a->argv[3], &sec, &nsec)) {
+        return CLI_SHOWUSAGE;
+    }
+
+    if (!(index = css_segment_index_open(a->argv[2]))) {
+        css_cli(a->fd, "Can not open segment index %s\n", a->argv[2]);
+        return CLI_FAILURE;
+    }
+
+    count = css_segment_index_count(index);
+    if (!count) {
+        css_cli(a->fd, "%s holds no frame\n", a->argv[2]);
+    } else {
+        css_segment_index_get(index, 0, &frame);
+        css_segment_index_get(index, count - 1, &last);
+        css_cli(a->fd, "%d frame%s from %u.%09u to %u.%09u\n", count, ESS(count), frame.sec, frame.nsec, last.sec, last.nsec);
+        if ((i = css_segment_index_seek(index, sec, nsec, 1)) < 0) {
+            css_cli(a->fd, "%u.%09u is before the segment\n", sec, nsec);
         } else {
-            //                  
-            win_bottom = (max_seq - REORDERING_WINDOW_SIZE + SEQ_MAX) % SEQ_MAX;
-            int ur_wb = (espect_seq - win_bottom + SEQ_MAX)%SEQ_MAX;
-            //
-            if (ur_wb < REORDERING_WINDOW_SIZE) {
-                t_Recordering = 1;
-                gettimeofday(&order_timer, NULL);
-                //order_timer = time(NULL);
-                time_seq = max_seq;
-            }
-        }           
-        
-        gettimeofday(&tv_timer, NULL);
-        
-        if (t_Recordering && (((tv_timer.tv_sec - order_timer.tv_sec) >1) || (((tv_timer.tv_sec - order_timer.tv_sec) == 1)&&((tv_timer.tv_usec - order_timer.tv_usec) >1000)))) {
-            old_espect_seq = espect_seq;
-
-            int i = time_seq + 1;
-            win_bottom = (max_seq - REORDERING_WINDOW_SIZE + SEQ_MAX) % SEQ_MAX;
-            int i_wb = (i - win_bottom + SEQ_MAX) % SEQ_MAX;
-            int uh_wb = (max_seq - win_bottom + SEQ_MAX) % SEQ_MAX;
-            for (; i_wb <= uh_wb; i++) {                        
-                int j = OFF_SET(i);
-                if (!reception_buffer[j]) {
-                    espect_seq = OFF_SET_SEQ(i);
-                    break;
-                }   
-            }
-            //加入共享缓冲区
-            submit_gmh_h264_package(old_espect_seq, espect_seq);
-            win_bottom = (max_seq - REORDERING_WINDOW_SIZE + SEQ_MAX) % SEQ_MAX;
-            int ur_wb =  (espect_seq - win_bottom + SEQ_MAX) % SEQ_MAX;
-            if (ur_wb <= REORDERING_WINDOW_SIZE) {
-                gettimeofday(&order_timer, NULL);              
-                time_seq = max_seq;
-            } 
-        }                   
-    }   
-    return 0;
+            css_segment_index_get(index, i, &frame);
+            css_cli(a->fd, "Start at frame %d, %u.%09u, offset %lld, %zu bytes%s\n", i, frame.sec, frame.nsec,
+                    (long long) frame.offset, frame.size, frame.idr ? ", IDR" : "");
+        }
+    }
+    css_segment_index_close(index);
+
+    return CLI_SUCCESS;
 }
 
-void onRead(int iCliFd, short iEvent, void *arg)
+static struct css_cli_entry cli_gmp[] = {
+    CSS_CLI_DEFINE(handle_gmp_show_jitter, "Show GMP stream jitter and reorder depth"),
+    CSS_CLI_DEFINE(handle_gmp_show_stats, "Show GMP stream output counters"),
+    CSS_CLI_DEFINE(handle_gmp_show_players, "Show players of GMP streams"),
+    CSS_CLI_DEFINE(handle_gmp_show_channels, "Show GMP play channels and cached GOPs"),
+    CSS_CLI_DEFINE(handle_gmp_show_sockets, "Show GMP ingest socket drops, queue and latency"),
+    CSS_CLI_DEFINE(handle_gmp_seek, "Find a time in a GMP recording segment"),
+};
+
+//离线回放使用的流缓存, 只在回放线程访问
+static struct gmp_stream *gmp_replay_stream;
+static unsigned int gmp_replay_fed;
+
+int css_monitor_replay_start(const char *outdir, int reorder_timeout)
 {
-    int iLen;
-    char buf[8192];
-    struct event *pEvRead = (struct event*)arg;
-    struct sockaddr addrClient;
-    socklen_t solen = sizeof(struct sockaddr);
-    int res;
+    if (gmp_workers) {
+        return -1;
+    }
 
-    //iLen = recv(iCliFd, buf, 8192, 0);
-    iLen = recvfrom(iCliFd, buf, 8192, 0, (struct sockaddr *)&addrClient, &solen);
+    gmp_reorder_timeout = reorder_timeout > 0 ? MIN(reorder_timeout, GMP_REORDER_TIMEOUT_MAX) : DEFAULT_GMP_REORDER_TIMEOUT;
+    gmp_reorder_mode = GMP_REORDER_FIXED;
+    gmp_worker_count = 1;
+    gmp_worker_affinity = 0;
+    //不打开任何套接字
+    gmp_endpoint_count = 0;
+    css_copy_string(sortpathname, outdir, sizeof(sortpathname));
+    snprintf(pathname, sizeof(pathname), "%s/normal.h264", outdir);
 
-    if(iLen <= 0)
-    {
-        css_log(LOG_ERROR, "Client closed\n");
-        // event_del(pEvRead);
-        // event_free(pEvRead);
-        // close(iCliFd);
+    gmp_frame_pool_init();
+    if (!(gmp_recorder = css_recorder_start(1, gmp_record_chunk * 1024, gmp_record_chunks, 0, 0))) {
+        return -1;
+    }
+    if (!(gmp_workers = css_calloc(1, sizeof(*gmp_workers))) || gmp_worker_init(&gmp_workers[0], 0)) {
+        css_monitor_replay_stop(NULL);
+        return -1;
+    }
+    gmp_replay_stream = NULL;
+    gmp_replay_fed = 0;
+
+    return 0;
+}
+
+void css_monitor_replay_feed(const struct sockaddr_in *from, const void *data, size_t len)
+{
+    struct gmp_worker *worker = &gmp_workers[0];
+    struct frame_block *frame;
+
+    if (!(frame = frame_pool_get(&worker->pool))) {
         return;
     }
-    
-    if (!(res = fwrite(buf,sizeof(char),iLen,normalfile))) {
-        css_log(LOG_WARNING,"fwrite error :%d , %s\n", res, strerror(errno));
+    len = MIN(len, sizeof(frame->data));
+    memcpy(frame->data, data, len);
+    css_recorder_write(worker->normal, frame->data, len);
+    frame->datalen = len;
+    gmp_ingest(worker, from, frame, &gmp_replay_stream);
+
+    //按真实时间运行到期的排序和录制定时器
+    if (!(++gmp_replay_fed % DEFAULT_GMP_RECV_BATCH)) {
+        event_base_loop(worker->base, EVLOOP_NONBLOCK);
     }
-    
-    gmh_h264_package_build(buf);
-     
+}
+
+static int gmp_replay_collect(void *obj, void *arg, int flags)
+{
+    struct gmp_stream *stream = obj;
+    struct css_monitor_replay_stats *stats = arg;
+
+    //放出窗口中剩余的包, 不再等待缺包
+    while (stream->t_Recordering) {
+        gmp_stream_flush_cb(-1, 0, stream);
+    }
+
+    if (stats) {
+        stats->streams++;
+        stats->packets += stream->stats.packets;
+        stats->gaps += stream->stats.gaps;
+        stats->lost += stream->stats.lost;
+        stats->dups += stream->stats.dups;
+        stats->late += stream->stats.late;
+        stats->frames += stream->stats.frames;
+        stats->frames_dropped += stream->stats.frames_dropped;
+    }
+
+    return 0;
+}
+
+void css_monitor_replay_stop(struct css_monitor_replay_stats *stats)
+{
+    if (stats) {
+        memset(stats, 0, sizeof(*stats));
+    }
+    if (gmp_replay_stream) {
+        ao2_ref(gmp_replay_stream, -1);
+        gmp_replay_stream = NULL;
+    }
+    if (gmp_workers) {
+        if (gmp_workers[0].streams) {
+            ao2_callback(gmp_workers[0].streams, OBJ_NODATA, gmp_replay_collect, stats);
+        }
+        gmp_worker_destroy(&gmp_workers[0]);
+        css_free(gmp_workers);
+        gmp_workers = NULL;
+    }
+    //等待写线程把录制写完
+    css_recorder_stop(gmp_recorder);
+    gmp_recorder = NULL;
 }
 
 void *css_monitor_udp_init(void *data)
 {
-    int iSvrFd;
-    int flag = 1;
-    struct sockaddr_in sSvrAddr;
-    struct event evListen;
-    //char host[32] = "237.196.234.112";
-    char host[32] = "192.168.10.82";
-    int port = 8080;
-    struct timeval timeout = {1,0};
-    struct ip_mreq mreq;
+    int i;
+
+    //播放连接由接收线程写入, libevent 需要加锁
+    if (evthread_use_pthreads()) {
+        css_log(LOG_ERROR, "css monitor libevent threading init failed\n");
+        return NULL;
+    }
+
+    gmp_readconfig();
+
+    if (!gmp_worker_count && (gmp_worker_count = sysconf(_SC_NPROCESSORS_ONLN)) < 1) {
+        gmp_worker_count = DEFAULT_GMP_WORKERS;
+    }
     
-    normalfile = fopen(pathname, "at+");
-    sortfile = fopen(sortpathname, "at+");
+    gmp_frame_pool_init();
+
+    gmp_recorder = css_recorder_start(gmp_worker_count, gmp_record_chunk * 1024, gmp_record_chunks,
+            (off_t) gmp_record_prealloc * 1024 * 1024, gmp_record_direct ? CSS_RECORDER_DIRECT : 0);
     
-    if(!normalfile || !sortfile) {
-        css_log(LOG_ERROR, "css monitor udp init open file failed\n");
-        return;
+    if(!gmp_recorder) {
+        css_log(LOG_ERROR, "css monitor udp init recorder failed\n");
+        return NULL;
     }
-    
-    if (event_init() == NULL) {
-        css_log(LOG_ERROR, "css monitor udp init event failed\n");
-        return;
+
+    if (!(gmp_workers = css_calloc(gmp_worker_count, sizeof(*gmp_workers)))) {
+        css_log(LOG_ERROR, "css monitor udp init workers failed\n");
+        css_recorder_stop(gmp_recorder);
+        gmp_recorder = NULL;
+        return NULL;
     }
     
-    if((iSvrFd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
-       css_log(LOG_ERROR, "css monitor udp init socket failed\n");
-       return;
+    for (i = 0; i < gmp_worker_count; i++) {
+        if (gmp_worker_init(&gmp_workers[i], i)) {
+            break;
+        }
     }
-    
-    if (setsockopt(iSvrFd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(int)) < 0) {
-        css_log(LOG_ERROR, "css monitor udp init setsockopt failed\n");
-        return;
+    if (i < gmp_worker_count) {
+        for (; i >= 0; i--) {
+            gmp_worker_destroy(&gmp_workers[i]);
+        }
+        css_free(gmp_workers);
+        gmp_workers = NULL;
+        css_recorder_stop(gmp_recorder);
+        gmp_recorder = NULL;
+        return NULL;
     }
-    
-    if(setsockopt(iSvrFd,SOL_SOCKET,SO_RCVTIMEO,(char *)&timeout,sizeof(timeout))<0)
-    {
-        perror("Reusing ADDR failed");    
-        return -1;   
+
+    css_log(LOG_NOTICE, "css monitor udp init %d endpoint%s, %d worker%s\n",
+            gmp_endpoint_count, ESS(gmp_endpoint_count), gmp_worker_count, ESS(gmp_worker_count));
+
+    if (gmp_play_port) {
+        gmp_play_start();
     }
-    
-    memset(&sSvrAddr, 0, sizeof(sSvrAddr));
-    sSvrAddr.sin_family = AF_INET;
-    sSvrAddr.sin_addr.s_addr = inet_addr(host);
-    sSvrAddr.sin_port = htons(port);
-    
-    if (bind(iSvrFd, (struct sockaddr*)&sSvrAddr, sizeof(sSvrAddr)) < 0 ) {
-        css_log(LOG_ERROR, "css monitor udp init bind failed\n");
-        return ;
-    } else {
-        css_log(LOG_NOTICE, "css monitor udp init bind %s : %d", host, port);
+
+    css_cli_register_multiple(cli_gmp, ARRAY_LEN(cli_gmp));
+
+    //worker 0 runs on this thread
+    for (i = 1; i < gmp_worker_count; i++) {
+        if (css_pthread_create_background(&gmp_workers[i].thread, NULL, gmp_worker_run, &gmp_workers[i])) {
+            css_log(LOG_ERROR, "css monitor worker %d thread start failed\n", i);
+            gmp_workers[i].thread = CSS_PTHREADT_NULL;
+        }
     }
-    
- //   mreq.imr_multiaddr.s_addr=inet_addr(host);    
- //   mreq.imr_interface.s_addr=htonl(INADDR_ANY);   
-    
- //   if (setsockopt(iSvrFd,IPPROTO_IP,IP_ADD_MEMBERSHIP,(char *)&mreq,sizeof(mreq)) < 0)     
-//    {    
- //       perror("setsockopt");  
- //       return -1;    
- //   }
-    
-    //base = event_base_new();
-    event_set(&evListen, iSvrFd, EV_READ|EV_PERSIST, &onRead, NULL);
-    
-   // event_base_set(base, &evListen);
-    if (event_add(&evListen, NULL) == -1) {
-        css_log(LOG_ERROR, "css monitor udp init event add failed\n");
+
+    gmp_worker_run(&gmp_workers[0]);
+
+    for (i = 1; i < gmp_worker_count; i++) {
+        if (gmp_workers[i].thread != CSS_PTHREADT_NULL) {
+            pthread_join(gmp_workers[i].thread, NULL);
+        }
     }
-   // event_base_dispatch(base);
-    
-    event_dispatch();
+    css_cli_unregister_multiple(cli_gmp, ARRAY_LEN(cli_gmp));
+
+    for (i = 0; i < gmp_worker_count; i++) {
+        gmp_worker_destroy(&gmp_workers[i]);
+    }
+    //流已释放频道, 再关闭播放端
+    gmp_play_stop();
+    //所有录制文件已关闭, 等写线程写完
+    css_recorder_stop(gmp_recorder);
+    gmp_recorder = NULL;
     
-    return;
-}
\ No newline at end of file
+    return NULL;
+}
@@ -0,0 +1,524 @@
+/*
+ * File:   css_recorder.c
+ * Author: root
+ *
+ * Asynchronous recording writer, see css_recorder.h.
+ *
+ * Each producer thread owns a pair of lock-free chunk stacks shared with the
+ * writer thread: filled chunks travel to the writer on the "full" stack and
+ * come back on the "free" stack once they are written.  The taking side
+ * always takes the whole stack, so a compare-and-swap on the pushing side
+ * is all it needs.  The writer parks on an eventfd and is only woken when a
+ * producer sees it parked.
+ *
+ * Every open sink may hold one partly filled chunk, so a queue may allocate
+ * one chunk per open sink on top of the chunks it may have in flight.
+ */
+#define _GNU_SOURCE /* fallocate(), O_DIRECT */
+
+#include "css_recorder.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <sys/uio.h>
+#include <sys/eventfd.h>
+
+#include "logger.h"
+#include "utils.h"
+
+#define RECORDER_IOV_MAX 64 //每次 writev() 最多合并的块数
+
+struct css_recorder_chunk {
+    struct css_recorder_sink *sink;
+    size_t len;
+    int last;                           /*!< the sink is closed after this chunk */
+    struct css_recorder_chunk *next;    /*!< spare list or the stack the chunk is on */
+    char *data;                         /*!< chunk_size bytes, page aligned */
+};
+
+struct css_recorder_queue {
+    struct css_recorder_chunk *volatile full;   /*!< producer -> writer, newest first */
+    struct css_recorder_chunk *volatile free;   /*!< writer -> producer */
+    struct css_recorder_chunk *spare;   /*!< chunks the producer took back itself */
+    struct css_recorder_chunk **all;    /*!< every chunk allocated for this queue */
+    int allocated;
+    int slots;                          /*!< size of all */
+    int sinks;                          /*!< open sinks, each may hold a partly filled chunk */
+    int overrun;                        /*!< currently dropping bytes */
+    unsigned long dropped;              /*!< bytes dropped in the current overrun */
+};
+
+struct css_recorder {
+    pthread_t thread;
+    int efd;                            /*!< wakes the parked writer */
+    volatile int parked;
+    volatile int stop;
+    int producers;
+    size_t chunk_size;
+    int chunks;
+    off_t prealloc;
+    unsigned int flags;
+    struct css_recorder_queue *queues;
+};
+
+struct css_recorder_sink {
+    struct css_recorder *rec;
+    struct css_recorder_queue *queue;
+    int fd;
+    int direct;                         /*!< fd is open with O_DIRECT */
+    char *filename;
+
+    /* producer side */
+    struct css_recorder_chunk *cur;     /*!< chunk being filled */
+    struct css_recorder_chunk closer;   /*!< empty chunk that carries the close */
+    off_t tell;                         /*!< file offset of the next byte accepted */
+
+    /* writer side */
+    off_t offset;                       /*!< end of the file */
+    off_t reserved;                     /*!< fallocate()d up to here */
+    int prealloc;                       /*!< fallocate() is usable on this file */
+    int error;                          /*!< a write error has been logged */
+};
+
+/*! \brief Push a chunk, only one thread may push onto a stack */
+static void recorder_stack_push(struct css_recorder_chunk *volatile *top, struct css_recorder_chunk *chunk)
+{
+    do {
+        chunk->next = *top;
+    } while (!__sync_bool_compare_and_swap(top, chunk->next, chunk));
+}
+
+/*! \brief Take the whole stack, newest chunk first */
+static struct css_recorder_chunk *recorder_stack_take(struct css_recorder_chunk *volatile *top)
+{
+    //整个取走, 推入方的 CAS 不会遇到 ABA
+    return *top ? __sync_lock_test_and_set(top, NULL) : NULL;
+}
+
+static void recorder_wake(struct css_recorder *rec)
+{
+    uint64_t one = 1;
+
+    __sync_synchronize();
+    if (rec->parked && write(rec->efd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        css_log(LOG_WARNING, "recorder wakeup failed: %s\n", strerror(errno));
+    }
+}
+
+/*! \brief Producer side: allocate one more chunk for a queue */
+static struct css_recorder_chunk *recorder_chunk_alloc(struct css_recorder *rec, struct css_recorder_queue *q)
+{
+    struct css_recorder_chunk *chunk, **all;
+    int slots;
+
+    if (q->allocated == q->slots) {
+        slots = q->slots * 2;
+        if (!(all = css_realloc(q->all, slots * sizeof(*all)))) {
+            return NULL;
+        }
+        q->all = all;
+        q->slots = slots;
+    }
+
+    if (!(chunk = css_calloc(1, sizeof(*chunk)))) {
+        return NULL;
+    }
+    if (posix_memalign((void **) &chunk->data, sysconf(_SC_PAGESIZE), rec->chunk_size)) {
+        css_free(chunk);
+        return NULL;
+    }
+
+    return q->all[q->allocated++] = chunk;
+}
+
+/*! \brief Producer side: a chunk to fill, or NULL if all chunks are in flight */
+static struct css_recorder_chunk *recorder_chunk_get(struct css_recorder *rec, struct css_recorder_queue *q)
+{
+    struct css_recorder_chunk *chunk;
+
+    if (!q->spare) {
+        q->spare = recorder_stack_take(&q->free);
+    }
+    if ((chunk = q->spare)) {
+        q->spare = chunk->next;
+    } else if (q->allocated < rec->chunks + q->sinks) {
+        //每个打开的 sink 可能占着一个未满的块, 不算在途
+        chunk = recorder_chunk_alloc(rec, q);
+    }
+
+    if (chunk) {
+        chunk->len = 0;
+        chunk->last = 0;
+        if (q->overrun) {
+            css_log(LOG_NOTICE, "recorder caught up, %lu bytes were dropped\n", q->dropped);
+            q->overrun = 0;
+            q->dropped = 0;
+        }
+    }
+
+    return chunk;
+}
+
+static void recorder_chunk_spare(struct css_recorder_queue *q, struct css_recorder_chunk *chunk)
+{
+    chunk->next = q->spare;
+    q->spare = chunk;
+}
+
+/*! \brief Producer side: hand the current chunk of a sink to the writer */
+static void recorder_queue_chunk(struct css_recorder_sink *sink)
+{
+    struct css_recorder_chunk *chunk = sink->cur;
+
+    sink->cur = NULL;
+    if (!chunk->len) {
+        recorder_chunk_spare(sink->queue, chunk);
+        return;
+    }
+
+    chunk->sink = sink;
+    recorder_stack_push(&sink->queue->full, chunk);
+    recorder_wake(sink->rec);
+}
+
+struct css_recorder_sink *css_recorder_open(struct css_recorder *rec, int producer, const char *filename)
+{
+    struct css_recorder_sink *sink;
+    int flags = O_WRONLY | O_CREAT | O_APPEND;
+
+    if (!(sink = css_calloc(1, sizeof(*sink)))) {
+        return NULL;
+    }
+    sink->rec = rec;
+    sink->queue = &rec->queues[producer];
+    sink->prealloc = rec->prealloc > 0;
+
+    if (rec->flags & CSS_RECORDER_DIRECT) {
+        if ((sink->fd = open(filename, flags | O_DIRECT, 0644)) > -1) {
+            sink->direct = 1;
+        } else if (errno == EINVAL) {
+            css_log(LOG_NOTICE, "%s does not support O_DIRECT, using buffered writes\n", filename);
+        }
+    }
+    if (!sink->direct && (sink->fd = open(filename, flags, 0644)) < 0) {
+        css_log(LOG_ERROR, "recorder open %s failed: %s\n", filename, strerror(errno));
+        css_free(sink);
+        return NULL;
+    }
+
+    sink->filename = css_strdup(filename);
+    sink->offset = sink->reserved = sink->tell = lseek(sink->fd, 0, SEEK_END);
+    sink->queue->sinks++;
+
+    return sink;
+}
+
+int css_recorder_write(struct css_recorder_sink *sink, const void *data, size_t len)
+{
+    struct css_recorder *rec = sink->rec;
+    const char *src = data;
+    size_t n;
+
+    //尽量不把一条记录拆到两个块里; O_DIRECT 只能写整块, 不提前排队
+    if (!sink->direct && sink->cur && sink->cur->len + len > rec->chunk_size && len <= rec->chunk_size) {
+        recorder_queue_chunk(sink);
+    }
+
+    while (len) {
+        if (!sink->cur && !(sink->cur = recorder_chunk_get(rec, sink->queue))) {
+            if (!sink->queue->overrun) {
+                css_log(LOG_WARNING, "recorder is behind on %s, dropping data\n", sink->filename);
+                sink->queue->overrun = 1;
+            }
+            sink->queue->dropped += len;
+            return -1;
+        }
+        n = MIN(len, rec->chunk_size - sink->cur->len);
+        memcpy(sink->cur->data + sink->cur->len, src, n);
+        sink->cur->len += n;
+        sink->tell += n;
+        src += n;
+        len -= n;
+        if (sink->cur->len == rec->chunk_size) {
+            recorder_queue_chunk(sink);
+        }
+    }
+
+    return 0;
+}
+
+off_t css_recorder_tell(struct css_recorder_sink *sink)
+{
+    return sink->tell;
+}
+
+void css_recorder_flush(struct css_recorder_sink *sink)
+{
+    if (sink->cur && sink->cur->len && !sink->direct) {
+        recorder_queue_chunk(sink);
+    }
+}
+
+void css_recorder_close(struct css_recorder_sink *sink)
+{
+    if (sink->cur) {
+        recorder_queue_chunk(sink);
+    }
+    sink->queue->sinks--;
+
+    sink->closer.sink = sink;
+    sink->closer.last = 1;
+    recorder_stack_push(&sink->queue->full, &sink->closer);
+    recorder_wake(sink->rec);
+}
+
+/*! \brief Writer side: write all of \a iov, going buffered if O_DIRECT refuses */
+static int recorder_writev(struct css_recorder_sink *sink, struct iovec *iov, int cnt)
+{
+    ssize_t res;
+
+    while (cnt) {
+        if ((res = writev(sink->fd, iov, cnt)) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            //O_DIRECT 要求块对齐, 不对齐时改回缓存写
+            if (errno == EINVAL && sink->direct) {
+                fcntl(sink->fd, F_SETFL, fcntl(sink->fd, F_GETFL) & ~O_DIRECT);
+                sink->direct = 0;
+                continue;
+            }
+            return -1;
+        }
+        sink->offset += res;
+        while (cnt && res >= iov->iov_len) {
+            res -= iov->iov_len;
+            iov++;
+            cnt--;
+        }
+        if (cnt) {
+            iov->iov_base = (char *) iov->iov_base + res;
+            iov->iov_len -= res;
+        }
+    }
+
+    return 0;
+}
+
+/*! \brief Writer side: write consecutive chunks of one sink with a single writev() */
+static void recorder_write_chunks(struct css_recorder *rec, struct css_recorder_chunk **chunks, int cnt)
+{
+    struct css_recorder_sink *sink = chunks[0]->sink;
+    struct iovec iov[RECORDER_IOV_MAX];
+    size_t len = 0;
+    int i;
+
+    for (i = 0; i < cnt; i++) {
+        iov[i].iov_base = chunks[i]->data;
+        iov[i].iov_len = chunks[i]->len;
+        len += chunks[i]->len;
+    }
+
+    if (sink->prealloc && sink->offset + len > sink->reserved) {
+        if (fallocate(sink->fd, FALLOC_FL_KEEP_SIZE, sink->offset, len + rec->prealloc)) {
+            sink->prealloc = 0;
+        } else {
+            sink->reserved = sink->offset + len + rec->prealloc;
+        }
+    }
+
+    //写完才能清除 O_DIRECT 的尾块
+    if (sink->direct && (len % sysconf(_SC_PAGESIZE))) {
+        fcntl(sink->fd, F_SETFL, fcntl(sink->fd, F_GETFL) & ~O_DIRECT);
+        sink->direct = 0;
+    }
+
+    if (recorder_writev(sink, iov, cnt)) {
+        if (!sink->error) {
+            css_log(LOG_WARNING, "recorder write %s failed: %s\n", sink->filename, strerror(errno));
+            sink->error = 1;
+        }
+    } else {
+        sink->error = 0;
+    }
+
+    for (i = 0; i < cnt; i++) {
+        recorder_stack_push(&sink->queue->free, chunks[i]);
+    }
+}
+
+static void recorder_sink_destroy(struct css_recorder_sink *sink)
+{
+    if (sink->fd > -1) {
+        close(sink->fd);
+    }
+    css_free(sink->filename);
+    css_free(sink);
+}
+
+/*! \brief Writer side: drain one queue, \return non-zero if anything was done */
+static int recorder_drain(struct css_recorder *rec, struct css_recorder_queue *q)
+{
+    struct css_recorder_chunk *batch[RECORDER_IOV_MAX], *chunk, *next, *list = NULL;
+    int cnt = 0;
+
+    //栈是后进先出, 翻转回入队顺序
+    for (chunk = recorder_stack_take(&q->full); chunk; chunk = next) {
+        next = chunk->next;
+        chunk->next = list;
+        list = chunk;
+    }
+    if (!list) {
+        return 0;
+    }
+
+    for (chunk = list; chunk; chunk = next) {
+        //写完的块会被推回 free 栈, 先取下一个
+        next = chunk->next;
+        if (cnt && (chunk->sink != batch[0]->sink || cnt == RECORDER_IOV_MAX)) {
+            recorder_write_chunks(rec, batch, cnt);
+            cnt = 0;
+        }
+        if (chunk->last) {
+            if (cnt) {
+                recorder_write_chunks(rec, batch, cnt);
+                cnt = 0;
+            }
+            recorder_sink_destroy(chunk->sink);
+            continue;
+        }
+        batch[cnt++] = chunk;
+    }
+    if (cnt) {
+        recorder_write_chunks(rec, batch, cnt);
+    }
+
+    return 1;
+}
+
+static void *recorder_thread(void *data)
+{
+    struct css_recorder *rec = data;
+    uint64_t count;
+    int i, busy;
+
+    for (;;) {
+        busy = 0;
+        for (i = 0; i < rec->producers; i++) {
+            busy |= recorder_drain(rec, &rec->queues[i]);
+        }
+        if (busy) {
+            continue;
+        }
+
+        //先声明要睡, 再检查一遍队列, 生产者看到 parked 才会唤醒
+        rec->parked = 1;
+        __sync_synchronize();
+        for (i = 0; i < rec->producers; i++) {
+            if (rec->queues[i].full) {
+                break;
+            }
+        }
+        if (i == rec->producers) {
+            if (rec->stop) {
+                break;
+            }
+            if (read(rec->efd, &count, sizeof(count)) < 0 && errno != EINTR) {
+                css_log(LOG_ERROR, "recorder wait failed: %s\n", strerror(errno));
+                break;
+            }
+        }
+        rec->parked = 0;
+    }
+
+    return NULL;
+}
+
+static void recorder_free(struct css_recorder *rec)
+{
+    struct css_recorder_queue *q;
+    int i, j;
+
+    for (i = 0; rec->queues && i < rec->producers; i++) {
+        q = &rec->queues[i];
+        for (j = 0; q->all && j < q->allocated; j++) {
+            free(q->all[j]->data);
+            css_free(q->all[j]);
+        }
+        css_free(q->all);
+    }
+    css_free(rec->queues);
+    if (rec->efd > -1) {
+        close(rec->efd);
+    }
+    css_free(rec);
+}
+
+struct css_recorder *css_recorder_start(int producers, size_t chunk_size, int chunks, off_t prealloc, unsigned int flags)
+{
+    struct css_recorder *rec;
+    long page = sysconf(_SC_PAGESIZE);
+    int i;
+
+    if (!(rec = css_calloc(1, sizeof(*rec)))) {
+        return NULL;
+    }
+    rec->efd = -1;
+    rec->thread = CSS_PTHREADT_NULL;
+    rec->producers = producers;
+    rec->chunk_size = (chunk_size + page - 1) / page * page;
+    rec->chunks = chunks;
+    rec->prealloc = prealloc;
+    rec->flags = flags;
+
+    if (!(rec->queues = css_calloc(producers, sizeof(*rec->queues)))) {
+        recorder_free(rec);
+        return NULL;
+    }
+    for (i = 0; i < producers; i++) {
+        //sink 多时按需加倍
+        if (!(rec->queues[i].all = css_calloc(chunks, sizeof(*rec->queues[i].all)))) {
+            recorder_free(rec);
+            return NULL;
+        }
+        rec->queues[i].slots = chunks;
+    }
+
+    if ((rec->efd = eventfd(0, 0)) < 0) {
+        css_log(LOG_ERROR, "recorder eventfd failed: %s\n", strerror(errno));
+        recorder_free(rec);
+        return NULL;
+    }
+
+    if (css_pthread_create_background(&rec->thread, NULL, recorder_thread, rec)) {
+        css_log(LOG_ERROR, "recorder thread start failed\n");
+        rec->thread = CSS_PTHREADT_NULL;
+        recorder_free(rec);
+        return NULL;
+    }
+
+    return rec;
+}
+
+void css_recorder_stop(struct css_recorder *rec)
+{
+    uint64_t one = 1;
+
+    if (!rec) {
+        return;
+    }
+
+    rec->stop = 1;
+    __sync_synchronize();
+    if (write(rec->efd, &one, sizeof(one)) < 0) {
+        css_log(LOG_WARNING, "recorder wakeup failed: %s\n", strerror(errno));
+    }
+    pthread_join(rec->thread, NULL);
+
+    recorder_free(rec);
+}
@@ -0,0 +1,145 @@
+/*
+ * File:   css_segment.c
+ * Author: root
+ *
+ * Segmented recording index, see css_segment.h.
+ */
+
+#include "css_segment.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <endian.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "logger.h"
+#include "utils.h"
+
+struct css_segment_index {
+    void *map;
+    size_t maplen;
+    const struct css_segment_record *records;
+    int count;
+};
+
+void css_segment_header_init(struct css_segment_header *hdr)
+{
+    memcpy(hdr->magic, CSS_SEGMENT_MAGIC, sizeof(hdr->magic));
+    hdr->version = htole32(CSS_SEGMENT_VERSION);
+    hdr->record_size = htole32(sizeof(struct css_segment_record));
+}
+
+void css_segment_record_pack(struct css_segment_record *rec, const struct css_segment_frame *frame)
+{
+    rec->sec = htole32(frame->sec);
+    rec->nsec = htole32(frame->nsec);
+    rec->offset = htole32((uint32_t) frame->offset);
+    rec->size = htole32((uint32_t) frame->size | (frame->idr ? CSS_SEGMENT_IDR : 0));
+}
+
+struct css_segment_index *css_segment_index_open(const char *filename)
+{
+    struct css_segment_index *index;
+    const struct css_segment_header *hdr;
+    struct stat st;
+    int fd;
+
+    if ((fd = open(filename, O_RDONLY)) < 0) {
+        css_log(LOG_WARNING, "segment index %s: %s\n", filename, strerror(errno));
+        return NULL;
+    }
+    if (fstat(fd, &st) || st.st_size < sizeof(*hdr)) {
+        css_log(LOG_WARNING, "segment index %s is too short\n", filename);
+        close(fd);
+        return NULL;
+    }
+    if (!(index = css_calloc(1, sizeof(*index)))) {
+        close(fd);
+        return NULL;
+    }
+
+    index->maplen = st.st_size;
+    index->map = mmap(NULL, index->maplen, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (index->map == MAP_FAILED) {
+        css_log(LOG_WARNING, "segment index %s mmap failed: %s\n", filename, strerror(errno));
+        css_free(index);
+        return NULL;
+    }
+
+    hdr = index->map;
+    if (memcmp(hdr->magic, CSS_SEGMENT_MAGIC, sizeof(hdr->magic)) ||
+        le32toh(hdr->version) != CSS_SEGMENT_VERSION ||
+        le32toh(hdr->record_size) != sizeof(struct css_segment_record)) {
+        css_log(LOG_WARNING, "%s is not a segment index\n", filename);
+        css_segment_index_close(index);
+        return NULL;
+    }
+
+    index->records = (const struct css_segment_record *) (hdr + 1);
+    index->count = (index->maplen - sizeof(*hdr)) / sizeof(struct css_segment_record);
+    //查找按时间二分, 顺序读取只在回退到关键帧时发生
+    madvise(index->map, index->maplen, MADV_RANDOM);
+
+    return index;
+}
+
+void css_segment_index_close(struct css_segment_index *index)
+{
+    munmap(index->map, index->maplen);
+    css_free(index);
+}
+
+int css_segment_index_count(struct css_segment_index *index)
+{
+    return index->count;
+}
+
+int css_segment_index_get(struct css_segment_index *index, int i, struct css_segment_frame *frame)
+{
+    const struct css_segment_record *rec;
+    uint32_t size;
+
+    if (i < 0 || i >= index->count) {
+        return -1;
+    }
+
+    rec = &index->records[i];
+    size = le32toh(rec->size);
+    frame->sec = le32toh(rec->sec);
+    frame->nsec = le32toh(rec->nsec);
+    frame->offset = le32toh(rec->offset);
+    frame->size = size & CSS_SEGMENT_SIZE_MAX;
+    frame->idr = (size & CSS_SEGMENT_IDR) ? 1 : 0;
+
+    return 0;
+}
+
+int css_segment_index_seek(struct css_segment_index *index, unsigned int sec, unsigned int nsec, int idr)
+{
+    const struct css_segment_record *rec;
+    int lo = 0, hi = index->count, mid;
+    unsigned int s;
+
+    //找第一个晚于目标时间的帧
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        rec = &index->records[mid];
+        s = le32toh(rec->sec);
+        if (s < sec || (s == sec && le32toh(rec->nsec) <= nsec)) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    //回退到所依赖的关键帧
+    for (lo--; idr && lo >= 0 && !(le32toh(index->records[lo].size) & CSS_SEGMENT_IDR); lo--);
+
+    return lo;
+}
@@ -0,0 +1,315 @@
+/*
+ * File:   css_vod.c
+ * Author: root
+ *
+ * Playback of recorded GMP streams, see css_vod.h.
+ */
+
+#include "css_vod.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "logger.h"
+#include "utils.h"
+#include "css_gmp.h"
+#include "css_h264.h"
+#include "css_segment.h"
+
+#define VOD_TABLE_GROW 4096 //帧表每次扩充的帧数
+
+struct css_vod {
+    int fd;
+    const unsigned char *map;
+    size_t maplen;
+    off_t size;                     /*!< bytes covered by the table */
+    int es;                         /*!< a segment: frames without GMP headers */
+    struct css_vod_frame *frames;
+    int count;
+    int alloc;
+};
+
+static int vod_frame_add(struct css_vod *vod, const struct css_vod_frame *frame)
+{
+    struct css_vod_frame *frames;
+
+    if (vod->count == vod->alloc) {
+        if (!(frames = css_realloc(vod->frames, (vod->alloc + VOD_TABLE_GROW) * sizeof(*frames)))) {
+            return -1;
+        }
+        vod->frames = frames;
+        vod->alloc += VOD_TABLE_GROW;
+    }
+    vod->frames[vod->count++] = *frame;
+
+    return 0;
+}
+
+static int vod_frame_key(const unsigned char *payload, size_t len)
+{
+    unsigned int info = css_h264_frame_info(payload, len);
+
+    return (info & CSS_H264_HAS_SLICE) ? (info & CSS_H264_HAS_IDR) != 0 : (info & CSS_H264_HAS_SPS) != 0;
+}
+
+/*!
+ * \brief Scan the package headers once and collect the complete frames.
+ *
+ * Same rules as the live assembly: a frame is a begin package, the other
+ * packages in sequence and an end package, or a single only package.
+ */
+static int vod_scan(struct css_vod *vod, const char *filename)
+{
+    struct css_gmp_header hdr;
+    struct css_vod_frame cur;
+    size_t pos = 0;
+    unsigned int last_seq = 0;
+    int open = 0, res;
+
+    while (pos < vod->maplen) {
+        res = css_gmp_parse(vod->map + pos, vod->maplen - pos, &hdr);
+        if (res == CSS_GMP_PARSE_SHORT || res == CSS_GMP_PARSE_TRUNCATED) {
+            //最后一个包还在写入
+            break;
+        }
+        if (res == CSS_GMP_PARSE_LENGTH) {
+            css_log(LOG_WARNING, "%s: damaged package header at %zu, playing up to there\n", filename, pos);
+            break;
+        }
+        if (res != CSS_GMP_PARSE_OK) {
+            //包长度可信, 跳过这个包
+            hdr.type = 0;
+        }
+
+        switch (hdr.type) {
+        case CSS_GMP_FRAME_BEGIN:
+        case CSS_GMP_FRAME_ONLY:
+            cur.sec = hdr.sec;
+            cur.nsec = hdr.nsec;
+            cur.offset = pos;
+            cur.end = pos + hdr.length;
+            cur.packages = 1;
+            cur.key = vod_frame_key(vod->map + pos + CSS_GMP_HEADER_LEN, hdr.length - CSS_GMP_HEADER_LEN);
+            open = hdr.type == CSS_GMP_FRAME_BEGIN;
+            if (!open && vod_frame_add(vod, &cur)) {
+                return -1;
+            }
+            break;
+        case CSS_GMP_FRAME_OTHER:
+        case CSS_GMP_FRAME_END:
+            if (!open || hdr.seq != (last_seq + 1) % CSS_GMP_SEQ_MAX) {
+                open = 0;
+                break;
+            }
+            cur.end = pos + hdr.length;
+            cur.packages++;
+            if (hdr.type == CSS_GMP_FRAME_END) {
+                open = 0;
+                if (vod_frame_add(vod, &cur)) {
+                    return -1;
+                }
+            }
+            break;
+        default:
+            open = 0;
+            break;
+        }
+
+        last_seq = hdr.seq;
+        pos += hdr.length;
+    }
+
+    vod->size = pos;
+
+    return 0;
+}
+
+/*!
+ * \brief Build the frame table of a segment from its index.
+ *
+ * \retval 1 if \a filename is a segment with an index
+ * \retval 0 if it is not, -1 on failure
+ */
+static int vod_segment_load(struct css_vod *vod, const char *filename, off_t filesize)
+{
+    struct css_segment_index *index;
+    struct css_segment_frame entry;
+    struct css_vod_frame cur;
+    char idxname[PATH_MAX];
+    size_t len = strlen(filename);
+    int i, res = 1;
+
+    if (len < 5 || len >= sizeof(idxname) || strcmp(filename + len - 5, ".h264")) {
+        return 0;
+    }
+    snprintf(idxname, sizeof(idxname), "%.*s.idx", (int) len - 5, filename);
+    if (access(idxname, F_OK)) {
+        return 0;
+    }
+    if (!(index = css_segment_index_open(idxname))) {
+        return -1;
+    }
+
+    for (i = 0; !css_segment_index_get(index, i, &entry); i++) {
+        //索引可能比段文件先写到盘上
+        if (entry.offset + entry.size > filesize) {
+            break;
+        }
+        cur.sec = entry.sec;
+        cur.nsec = entry.nsec;
+        cur.offset = entry.offset;
+        cur.end = entry.offset + entry.size;
+        cur.packages = 1;
+        cur.key = entry.idr;
+        if (vod_frame_add(vod, &cur)) {
+            res = -1;
+            break;
+        }
+        vod->size = cur.end;
+    }
+    css_segment_index_close(index);
+    vod->es = 1;
+
+    return res;
+}
+
+struct css_vod *css_vod_open(const char *filename)
+{
+    struct css_vod *vod;
+    struct stat st;
+    int res;
+
+    if (!(vod = css_calloc(1, sizeof(*vod)))) {
+        return NULL;
+    }
+
+    if ((vod->fd = open(filename, O_RDONLY)) < 0) {
+        css_log(LOG_WARNING, "vod open %s failed: %s\n", filename, strerror(errno));
+        css_free(vod);
+        return NULL;
+    }
+    if (fstat(vod->fd, &st) || !st.st_size) {
+        css_log(LOG_WARNING, "vod %s is empty\n", filename);
+        css_vod_close(vod);
+        return NULL;
+    }
+
+    //分段录制按索引建表, 不用映射文件
+    if ((res = vod_segment_load(vod, filename, st.st_size))) {
+        if (res < 0) {
+            css_log(LOG_ERROR, "vod %s frame table load failed\n", filename);
+            css_vod_close(vod);
+            return NULL;
+        }
+        return vod;
+    }
+
+    vod->maplen = st.st_size;
+    if ((vod->map = mmap(NULL, vod->maplen, PROT_READ, MAP_SHARED, vod->fd, 0)) == MAP_FAILED) {
+        css_log(LOG_WARNING, "vod mmap %s failed: %s\n", filename, strerror(errno));
+        vod->map = NULL;
+        css_vod_close(vod);
+        return NULL;
+    }
+    //建表时顺序扫描一次, 让内核提前读
+    madvise((void *) vod->map, vod->maplen, MADV_SEQUENTIAL);
+
+    if (vod_scan(vod, filename)) {
+        css_log(LOG_ERROR, "vod %s frame table allocation failed\n", filename);
+        css_vod_close(vod);
+        return NULL;
+    }
+
+    return vod;
+}
+
+void css_vod_close(struct css_vod *vod)
+{
+    if (vod->map) {
+        munmap((void *) vod->map, vod->maplen);
+    }
+    if (vod->fd > -1) {
+        close(vod->fd);
+    }
+    if (vod->frames) {
+        css_free(vod->frames);
+    }
+    css_free(vod);
+}
+
+int css_vod_count(struct css_vod *vod)
+{
+    return vod->count;
+}
+
+const struct css_vod_frame *css_vod_frame(struct css_vod *vod, int i)
+{
+    return i >= 0 && i < vod->count ? &vod->frames[i] : NULL;
+}
+
+int css_vod_seek(struct css_vod *vod, unsigned int sec, unsigned int nsec)
+{
+    const struct css_vod_frame *frame;
+    int lo = 0, hi = vod->count, mid;
+
+    //找第一个晚于目标时间的帧
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        frame = &vod->frames[mid];
+        if (frame->sec < sec || (frame->sec == sec && frame->nsec <= nsec)) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    //回退到所依赖的关键帧
+    for (mid = lo - 1; mid >= 0 && !vod->frames[mid].key; mid--);
+    if (mid >= 0) {
+        return mid;
+    }
+    //录制开始于目标时间之后, 从第一个关键帧开始
+    for (mid = lo; mid < vod->count && !vod->frames[mid].key; mid++);
+
+    return mid < vod->count ? mid : -1;
+}
+
+int css_vod_fd(struct css_vod *vod)
+{
+    return vod->fd;
+}
+
+off_t css_vod_size(struct css_vod *vod)
+{
+    return vod->size;
+}
+
+size_t css_vod_next_package(struct css_vod *vod, const struct css_vod_frame *frame, off_t *pos, off_t *payload)
+{
+    struct css_gmp_header hdr;
+
+    if (vod->es) {
+        if (*pos >= frame->end) {
+            return 0;
+        }
+        *payload = *pos;
+        *pos = frame->end;
+        return frame->end - *payload;
+    }
+
+    //包头已在建表时检查过
+    if (*pos >= frame->end || css_gmp_parse(vod->map + *pos, frame->end - *pos, &hdr) != CSS_GMP_PARSE_OK) {
+        return 0;
+    }
+    *payload = *pos + CSS_GMP_HEADER_LEN;
+    *pos += hdr.length;
+
+    return hdr.length - CSS_GMP_HEADER_LEN;
+}
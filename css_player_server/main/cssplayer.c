@@ -1801,6 +1801,12 @@ int main(int argc, char** argv)
    // css_heartbeat_init();
     css_log(LOG_NOTICE,"初始化心跳模块!\n");
 
+    //初始化H264码流解析模块
+    css_h264_init();
+
+    //初始化GMP包头解析模块
+    css_gmp_init();
+
     //初始化GMP信令监听模块 
     css_pthread_create_background(&css_player_background, NULL, css_monitor_udp_init, NULL);
    
@@ -8,6 +8,8 @@
  * \author root
  */
 
+#define _GNU_SOURCE /* sync_file_range() */
+
 /* When we include logger.h again it will trample on some stuff in syslog.h, but
  * nothing we care about in here. */
 #include <syslog.h>
@@ -31,7 +33,12 @@
 #include <signal.h>
 #include <csstime.h>
 #include <sys/stat.h>
+#include <sys/eventfd.h>
 #include <fcntl.h>
+#include <sched.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/uio.h>
 #ifdef HAVE_BKTR
 #include <execinfo.h>
 #define MAX_BACKTRACE_FRAMES 20
@@ -53,11 +60,21 @@
 #define GETTID() getpid()
 #endif
 static char dateformat[256] = "%b %e %T";		/* Original Ceictims Format */
+static volatile unsigned int dateformat_gen;	/* bumped on reload, drops the cached dates */
 
 static char queue_log_name[256] = QUEUELOG;
 static char exec_after_rotate[256] = "";
 
 static int filesize_reload_needed;
+
+/*! \brief When buffered lines are written to the file channels */
+static enum logflush {
+	FLUSH_IMMEDIATE,	/* every message, a write per message and channel */
+	FLUSH_BATCHED,		/* once per batch of messages the logger thread takes [default] */
+	FLUSH_INTERVAL,		/* at most every flush_interval ms */
+} flush_policy = FLUSH_BATCHED;
+static int flush_interval = 1000;	/* ms */
+static off_t writeback_bytes;		/* start writeback of a file channel every so many bytes, 0 never */
 static unsigned int global_logmask = 0xFFFF;
 static int queuelog_init;
 static int logger_initialized;
@@ -93,6 +110,12 @@ struct logchannel {
 	enum logtypes type;
 	/*! logfile logging file pointer */
 	FILE *fileptr;
+	/*! lines waiting for the next writev(), pointing into logbatch */
+	struct iovec *iov;
+	int iovcnt;
+	int iovalloc;
+	/*! file offset up to which writeback has been started */
+	off_t synced;
 	/*! Filename */
 	char filename[PATH_MAX];
 	/*! field for linking to list */
@@ -122,13 +145,115 @@ struct logmsg {
 		CSS_STRING_FIELD(message);
 		CSS_STRING_FIELD(level_name);
 	);
-	CSS_LIST_ENTRY(logmsg) list;
+	/*! next message in logq, written once by the producer that queued after us */
+	struct logmsg *volatile qnext;
 };
 
-static CSS_LIST_HEAD_STATIC(logmsgs, logmsg);
+/*! \brief Intrusive multi-producer/single-consumer queue of messages
+ *
+ * Producers swap themselves in as the newest message and then link the
+ * previous newest to it; only logger_thread() takes messages off the
+ * oldest end.  No lock is taken on either side.  The stub message keeps
+ * the queue non-empty so a producer always has something to link to.
+ */
+static struct {
+	struct logmsg *volatile head;	/*!< newest message, swapped by producers */
+	struct logmsg *tail;		/*!< oldest message, logger thread only */
+	struct logmsg stub;
+	int efd;			/*!< wakes the parked logger thread */
+	volatile int parked;
+} logq = { .head = &logq.stub, .tail = &logq.stub, .efd = -1 };
+
 static pthread_t logthread = CSS_PTHREADT_NULL;
-static css_cond_t logcond;
-static int close_logger_thread = 0;
+static volatile int close_logger_thread = 0;
+
+#define LOGBATCH_SIZE (256 * 1024)	//一批文件日志的缓冲区
+#define LOGBATCH_IOV 1024		//每次 writev() 最多合并的行数
+#define LOGGER_BATCH_MAX 4096		//日志线程每批最多处理的消息数
+
+/*! \brief Formatted file channel lines of the current batch, logger thread only
+ *
+ * A line is formatted once and referenced from the iovecs of every file
+ * channel that takes it; the buffer is reused once every channel has
+ * written its lines.
+ */
+static struct {
+	char buf[LOGBATCH_SIZE];
+	size_t len;
+	struct timeval first;		/*!< when the oldest line waiting was added */
+} logbatch;
+
+#define FASTLOG_RING_SIZE 1024	//每个线程缓存的快速日志条数, 2 的幂
+#define FASTLOG_BATCH 256	//日志线程每次在锁内取出的条数
+
+/*! \brief A css_log_fast() message, formatted by the logger thread */
+struct fastlog_record {
+	const char *fmt;
+	const char *file;
+	const char *function;
+	int line;
+	int level;
+	int nargs;
+	struct timespec ts;		/*!< CLOCK_MONOTONIC_COARSE */
+	unsigned long long args[CSS_LOG_FAST_ARGS];
+};
+
+/*! \brief Single-producer/single-consumer ring of the records of one thread */
+struct fastlog_ring {
+	volatile unsigned int head;	/*!< next slot to fill, moved by the owning thread */
+	volatile unsigned int tail;	/*!< next slot to render, moved by the logger thread */
+	volatile unsigned int dropped;	/*!< records lost to a full ring */
+	unsigned int reported;		/*!< drops already logged */
+	time_t reported_at;		/*!< drops are logged at most once a second */
+	volatile int exited;		/*!< the owning thread is gone, freed once drained */
+	long process_id;
+	CSS_LIST_ENTRY(fastlog_ring) list;
+	struct fastlog_record records[FASTLOG_RING_SIZE];
+};
+
+/* Threads add their ring on their first css_log_fast(), only the logger thread removes them */
+static CSS_LIST_HEAD_STATIC(fastlog_rings, fastlog_ring);
+
+#define FLIGHT_RING_SIZE 256	//每个线程保留的最近日志条数, 2 的幂
+#define FLIGHT_TEXT_LEN 112	//已格式化的消息保留的长度
+#define FLIGHT_TEXT -1		//记录的 nargs: u.text 是格式化好的消息
+#define FLIGHT_FORMAT -2	//记录的 nargs: 没有渠道要的消息, 只保留格式串
+
+/*! \brief A recent log message kept by the flight recorder */
+struct flight_record {
+	volatile unsigned int seq;	/*!< odd while the owning thread rewrites the record */
+	int level;
+	int line;
+	int nargs;			/*!< FLIGHT_TEXT, FLIGHT_FORMAT or the css_log_fast() words in u.args */
+	const char *file;
+	const char *function;
+	const char *fmt;
+	struct timespec ts;		/*!< CLOCK_REALTIME_COARSE */
+	union {
+		unsigned long long args[CSS_LOG_FAST_ARGS];
+		char text[FLIGHT_TEXT_LEN];
+	} u;
+};
+
+/*! \brief The most recent log messages of one thread, at every level
+ *
+ * Only the owning thread writes, oldest records are overwritten.  Nothing
+ * reads the ring unless a dump is asked for.
+ */
+struct flight_ring {
+	unsigned int next;		/*!< records written so far */
+	long process_id;
+	CSS_LIST_ENTRY(flight_ring) list;
+	struct flight_record records[FLIGHT_RING_SIZE];
+};
+
+static CSS_LIST_HEAD_STATIC(flight_rings, flight_ring);
+/*! \brief Where a fatal signal dumps the flight recorder */
+static char flight_crash_file[PATH_MAX];
+
+/* 写者只需保证自己的写入顺序 */
+#define FLIGHT_WMB() __atomic_thread_fence(__ATOMIC_RELEASE)
+#define FLIGHT_RMB() __atomic_thread_fence(__ATOMIC_ACQUIRE)
 
 static FILE *qlog;
 
@@ -195,7 +320,109 @@ CSS_THREADSTORAGE(verbose_buf);
 CSS_THREADSTORAGE(log_buf);
 #define LOG_BUF_INIT_SIZE       256
 
+/*! \brief The date of the current second rendered with dateformat
+ *
+ * Time zone conversion and strftime() run once a second per thread.  A
+ * %q (or %1q ... %6q) in dateformat is left out of the cached parts and
+ * its digits patched in on every message.
+ */
+struct logger_date {
+	time_t sec;
+	unsigned int gen;
+	int valid;
+	int decimals;			/*!< digits of %q, 0 when dateformat has none, -1 when not cacheable */
+	size_t before_len;
+	char before[sizeof(dateformat)];	/*!< rendered up to %q, or all of it */
+	char after[sizeof(dateformat)];		/*!< rendered after %q */
+	char out[sizeof(dateformat) * 2 + 8];	/*!< before, the digits and after */
+};
+
+CSS_THREADSTORAGE(date_buf);
+
+/*! \brief Find the one sub-second conversion in dateformat, -1 if there are several */
+static int logger_date_split(const char *fmt, size_t *start, size_t *end)
+{
+	const char *p;
+	int decimals = 0;
+
+	for (p = fmt; *p; p++) {
+		if (*p != '%' || !p[1])
+			continue;
+		if (p[1] == 'q' || (p[1] >= '1' && p[1] <= '6' && p[2] == 'q')) {
+			if (decimals)
+				return -1;
+			decimals = p[1] == 'q' ? 3 : p[1] - '0';
+			*start = p - fmt;
+			*end = *start + (p[1] == 'q' ? 2 : 3);
+		}
+		/* skip the conversion character, so %%q stays literal */
+		p++;
+	}
+
+	return decimals;
+}
+
+/*!
+ * \brief Render \a now with dateformat.
+ * \return the date, valid until the next call on this thread
+ */
+static const char *logger_date(const struct timeval *now)
+{
+	static char fallback[256];
+	struct logger_date *cache;
+	char fmt[sizeof(dateformat)];
+	struct css_tm tm;
+	size_t start, end, len;
+	long fraction;
+	int i;
+
+	if (!(cache = css_threadstorage_get(&date_buf, sizeof(*cache)))) {
+		/* no memory: render every time, racy but still a date */
+		css_localtime(now, &tm, NULL);
+		css_strftime(fallback, sizeof(fallback), dateformat, &tm);
+		return fallback;
+	}
+
+	if (!cache->valid || cache->sec != now->tv_sec || cache->gen != dateformat_gen) {
+		cache->gen = dateformat_gen;
+		css_copy_string(fmt, dateformat, sizeof(fmt));
+		css_localtime(now, &tm, NULL);
+		cache->decimals = logger_date_split(fmt, &start, &end);
+		if (cache->decimals > 0) {
+			cache->after[0] = '\0';
+			css_strftime(cache->after, sizeof(cache->after), fmt + end, &tm);
+			fmt[start] = '\0';
+		}
+		cache->before[0] = '\0';
+		css_strftime(cache->before, sizeof(cache->before), fmt, &tm);
+		cache->before_len = strlen(cache->before);
+		cache->sec = now->tv_sec;
+		cache->valid = 1;
+	}
+
+	if (!cache->decimals)
+		return cache->before;
+	if (cache->decimals < 0) {
+		/* several %q, nothing to reuse */
+		css_localtime(now, &tm, NULL);
+		css_strftime(cache->out, sizeof(cache->out), dateformat, &tm);
+		return cache->out;
+	}
+
+	memcpy(cache->out, cache->before, cache->before_len);
+	len = cache->before_len;
+	for (i = 6, fraction = now->tv_usec; i > cache->decimals; i--)
+		fraction /= 10;
+	for (i = cache->decimals; i > 0; i--, fraction /= 10)
+		cache->out[len + i - 1] = '0' + fraction % 10;
+	len += cache->decimals;
+	css_copy_string(cache->out + len, cache->after, sizeof(cache->out) - len);
+
+	return cache->out;
+}
+
 static void logger_queue_init(void);
+static void logger_channel_flush(struct logchannel *chan);
 
 static unsigned int make_components(const char *s, int lineno)
 {
@@ -274,6 +501,7 @@ static struct logchannel *make_logchannel(const char *channel, const char *compo
 			css_free(chan);
 			return NULL;
 		}
+		chan->synced = lseek(fileno(chan->fileptr), 0, SEEK_END);
 		chan->type = LOGTYPE_FILE;
 	}
 	chan->logmask = make_components(chan->components, lineno);
@@ -298,8 +526,11 @@ static void init_logger_chain(int locked)
 		CSS_RWLIST_WRLOCK(&logchannels);
 	}
 	while ((chan = CSS_RWLIST_REMOVE_HEAD(&logchannels, list))) {
+		logger_channel_flush(chan);
+		css_free(chan->iov);
 		css_free(chan);
 	}
+	logbatch.len = 0;
 	global_logmask = 0;
 	if (!locked) {
 		CSS_RWLIST_UNLOCK(&logchannels);
@@ -346,6 +577,27 @@ static void init_logger_chain(int locked)
 		css_copy_string(dateformat, s, sizeof(dateformat));
 	else
 		css_copy_string(dateformat, "%b %e %T", sizeof(dateformat));
+	dateformat_gen++;
+	flush_policy = FLUSH_BATCHED;
+	if ((s = css_variable_retrieve(cfg, "general", "flush"))) {
+		if (!strcasecmp(s, "immediate")) {
+			flush_policy = FLUSH_IMMEDIATE;
+		} else if (sscanf(s, "%30d", &flush_interval) == 1 && flush_interval > 0) {
+			flush_policy = FLUSH_INTERVAL;
+		} else if (strcasecmp(s, "batched")) {
+			fprintf(stderr, "Unknown flush policy: %s\n", s);
+		}
+	}
+	writeback_bytes = 0;
+	if ((s = css_variable_retrieve(cfg, "general", "writeback"))) {
+		long kb;
+
+		if (sscanf(s, "%30ld", &kb) == 1 && kb >= 0) {
+			writeback_bytes = (off_t) kb * 1024;
+		} else {
+			fprintf(stderr, "Invalid writeback: %s\n", s);
+		}
+	}
 	if ((s = css_variable_retrieve(cfg, "general", "queue_log"))) {
 		logfiles.queue_log = css_true(s);
 	}
@@ -741,6 +993,7 @@ static int reload_logger(int rotate)
 		}
 		if (f->fileptr && (f->fileptr != stdout) && (f->fileptr != stderr)) {
 			int rotate_this = 0;
+			logger_channel_flush(f);
 			if (ftello(f->fileptr) > 0x40000000) { /* Arbitrarily, 1 GB */
 				/* Be more proactive about rotating massive log files */
 				rotate_this = 1;
@@ -906,11 +1159,14 @@ struct verb {
 
 static CSS_RWLIST_HEAD_STATIC(verbosers, verb);
 
+static char *handle_logger_dump_flight(struct css_cli_entry *e, int cmd, struct css_cli_args *a);
+
 static struct css_cli_entry cli_logger[] = {
 	CSS_CLI_DEFINE(handle_logger_show_channels, "List configured log channels"),
 	CSS_CLI_DEFINE(handle_logger_reload, "Reopens the log files"),
 	CSS_CLI_DEFINE(handle_logger_rotate, "Rotates and reopens the log files"),
-	CSS_CLI_DEFINE(handle_logger_set_level, "Enables/Disables a specific logging level for this console")
+	CSS_CLI_DEFINE(handle_logger_set_level, "Enables/Disables a specific logging level for this console"),
+	CSS_CLI_DEFINE(handle_logger_dump_flight, "Writes the recent messages of every thread to a file")
 };
 
 static void _handle_SIGXFSZ(int sig)
@@ -942,11 +1198,133 @@ static void css_log_vsyslog(struct logmsg *msg)
 	syslog(syslog_level, "%s", buf);
 }
 
-/*! \brief Print a normal log message to the channels */
-static void logger_print_normal(struct logmsg *logmsg)
+/*!
+ * \brief Write the lines a file channel has waiting with as few writev() as it takes.
+ *
+ * \note Assumes logchannels is locked.
+ */
+static void logger_channel_flush(struct logchannel *chan)
+{
+	struct iovec *iov = chan->iov;
+	int iovcnt = chan->iovcnt, n;
+	ssize_t res;
+	off_t end;
+
+	chan->iovcnt = 0;
+	if (!iovcnt || !chan->fileptr || chan->disabled)
+		return;
+
+	while (iovcnt) {
+		n = iovcnt < LOGBATCH_IOV ? iovcnt : LOGBATCH_IOV;
+		if ((res = writev(fileno(chan->fileptr), iov, n)) < 0) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "**** Ceictims Logging Error: ***********\n");
+			if (errno == ENOMEM || errno == ENOSPC)
+				fprintf(stderr, "Ceictims logging error: Out of disk space, can't log to log file %s\n", chan->filename);
+			else
+				fprintf(stderr, "Logger Warning: Unable to write to log file '%s': %s (disabled)\n", chan->filename, strerror(errno));
+			chan->disabled = 1;
+			return;
+		}
+		/* skip what was written, a short write leaves the rest of a line */
+		while (n && res >= (ssize_t) iov->iov_len) {
+			res -= iov->iov_len;
+			iov++;
+			iovcnt--;
+			n--;
+		}
+		if (res) {
+			iov->iov_base = (char *) iov->iov_base + res;
+			iov->iov_len -= res;
+		}
+	}
+
+	/* Start writing the pages back without waiting, so they never pile up for one big flush */
+	if (writeback_bytes && (end = lseek(fileno(chan->fileptr), 0, SEEK_CUR)) - chan->synced >= writeback_bytes) {
+		sync_file_range(fileno(chan->fileptr), chan->synced, end - chan->synced, SYNC_FILE_RANGE_WRITE);
+		chan->synced = end;
+	}
+}
+
+/*!
+ * \brief Write the waiting lines of every file channel and reuse logbatch.
+ *
+ * \note Assumes logchannels is locked.
+ */
+static void logger_flush(void)
+{
+	struct logchannel *chan;
+
+	CSS_RWLIST_TRAVERSE(&logchannels, chan, list) {
+		if (chan->type == LOGTYPE_FILE)
+			logger_channel_flush(chan);
+	}
+	logbatch.len = 0;
+}
+
+/*!
+ * \brief Apply the flush policy to the lines waiting, logger thread only.
+ *
+ * \param force write everything regardless of the policy
+ * \return ms until waiting lines are due, -1 if none are waiting
+ */
+static int logger_flush_batch(int force)
+{
+	int64_t elapsed;
+
+	if (!logbatch.len)
+		return -1;
+	if (!force && flush_policy == FLUSH_INTERVAL &&
+	    (elapsed = css_tvdiff_ms(css_tvnow(), logbatch.first)) < flush_interval)
+		return flush_interval - elapsed;
+
+	CSS_RWLIST_RDLOCK(&logchannels);
+	logger_flush();
+	CSS_RWLIST_UNLOCK(&logchannels);
+
+	return -1;
+}
+
+/*!
+ * \brief Queue a line on a file channel.
+ *
+ * \param batch the line is in logbatch and waits for the flush policy,
+ * otherwise it is written before returning
+ */
+static void logger_channel_add(struct logchannel *chan, char *line, size_t len, int batch)
+{
+	struct iovec *iov;
+
+	if (chan->iovcnt == chan->iovalloc) {
+		if (!(iov = css_realloc(chan->iov, (chan->iovalloc + 64) * sizeof(*iov)))) {
+			logger_channel_flush(chan);
+			if (chan->iovcnt == chan->iovalloc)
+				return;
+		} else {
+			chan->iov = iov;
+			chan->iovalloc += 64;
+		}
+	}
+	chan->iov[chan->iovcnt].iov_base = line;
+	chan->iov[chan->iovcnt].iov_len = len;
+	chan->iovcnt++;
+
+	if (!batch)
+		logger_channel_flush(chan);
+}
+
+/*!
+ * \brief Print a normal log message to the channels
+ *
+ * \param batch called by the logger thread: file channel lines go to
+ * logbatch and are written by the flush policy
+ */
+static void logger_print_normal(struct logmsg *logmsg, int batch)
 {
 	struct logchannel *chan = NULL;
-	char buf[BUFSIZ];
+	char buf[BUFSIZ], linebuf[BUFSIZ + 512], *line = NULL;
+	size_t linelen = 0;
 	struct verb *v = NULL;
 
 	if (logmsg->level == __LOG_VERBOSE) {
@@ -993,27 +1371,33 @@ static void logger_print_normal(struct logmsg *logmsg)
 				css_console_puts_mutable(buf, logmsg->level);
 			/* File channels */
 			} else if (chan->type == LOGTYPE_FILE && (chan->logmask & (1 << logmsg->level))) {
-				int res = 0;
-
 				/* If no file pointer exists, skip it */
 				if (!chan->fileptr) {
 					continue;
 				}
 
-				/* Print out to the file */
-				res = fprintf(chan->fileptr, "[%s] %s[%ld] %s: %s",
-					      logmsg->date, logmsg->level_name, logmsg->process_id, logmsg->file, term_strip(buf, logmsg->message, BUFSIZ));
-				if (res <= 0 && !css_strlen_zero(logmsg->message)) {
-					fprintf(stderr, "**** Ceictims Logging Error: ***********\n");
-					if (errno == ENOMEM || errno == ENOSPC)
-						fprintf(stderr, "Ceictims logging error: Out of disk space, can't log to log file %s\n", chan->filename);
-					else
-						fprintf(stderr, "Logger Warning: Unable to write to log file '%s': %s (disabled)\n", chan->filename, strerror(errno));
-//					manager_event(EVENT_FLAG_SYSTEM, "LogChannel", "Channel: %s\r\nEnabled: No\r\nReason: %d - %s\r\n", chan->filename, errno, strerror(errno));
-					chan->disabled = 1;
-				} else if (res > 0) {
-					fflush(chan->fileptr);
+				/* Format the line once for every file channel */
+				if (!line) {
+					int res;
+
+					if (batch && LOGBATCH_SIZE - logbatch.len < sizeof(linebuf)) {
+						logger_flush();
+					}
+					line = batch ? logbatch.buf + logbatch.len : linebuf;
+					res = snprintf(line, sizeof(linebuf), "[%s] %s[%ld] %s: %s",
+						       logmsg->date, logmsg->level_name, logmsg->process_id, logmsg->file, term_strip(buf, logmsg->message, BUFSIZ));
+					if (res <= 0) {
+						break;
+					}
+					linelen = (size_t) res < sizeof(linebuf) ? (size_t) res : sizeof(linebuf) - 1;
+					if (batch) {
+						if (!logbatch.len) {
+							logbatch.first = css_tvnow();
+						}
+						logbatch.len += linelen;
+					}
 				}
+				logger_channel_add(chan, line, linelen, batch && flush_policy != FLUSH_IMMEDIATE);
 			}
 		}
 	} else if (logmsg->level != __LOG_VERBOSE) {
@@ -1031,42 +1415,775 @@ static void logger_print_normal(struct logmsg *logmsg)
 	return;
 }
 
-/*! \brief Actual logging thread */
-static void *logger_thread(void *data)
+/*! \brief Queue a message for the logger thread, callable from any thread */
+static void logq_push(struct logmsg *msg)
 {
-	struct logmsg *next = NULL, *msg = NULL;
+	struct logmsg *prev;
+
+	msg->qnext = NULL;
+	/* the message is complete before it can be reached */
+	__sync_synchronize();
+	prev = __sync_lock_test_and_set(&logq.head, msg);
+	/* between the swap and this store the consumer sees the queue end at prev */
+	prev->qnext = msg;
+}
 
-	for (;;) {
-		/* We lock the message list, and see if any message exists... if not we wait on the condition to be signalled */
-		CSS_LIST_LOCK(&logmsgs);
-		if (CSS_LIST_EMPTY(&logmsgs)) {
-			if (close_logger_thread) {
-				break;
+/*!
+ * \brief Take the oldest message, logger thread only.
+ *
+ * \param busy set when a producer is half way through logq_push()
+ * \return the message or NULL
+ */
+static struct logmsg *logq_pop(int *busy)
+{
+	struct logmsg *tail = logq.tail, *next = tail->qnext;
+
+	*busy = 0;
+	if (tail == &logq.stub) {
+		if (!next) {
+			return NULL;
+		}
+		logq.tail = tail = next;
+		next = next->qnext;
+	}
+	if (next) {
+		__sync_synchronize();
+		logq.tail = next;
+		return tail;
+	}
+	if (tail != logq.head) {
+		*busy = 1;
+		return NULL;
+	}
+	/* tail is the last message, put the stub behind it so it can be taken */
+	logq_push(&logq.stub);
+	if ((next = tail->qnext)) {
+		__sync_synchronize();
+		logq.tail = next;
+		return tail;
+	}
+	*busy = 1;
+	return NULL;
+}
+
+static int logq_empty(void)
+{
+	return logq.tail == logq.head && !logq.tail->qnext;
+}
+
+/*! \brief Wake the logger thread, only if it is parked */
+static void logq_wake(void)
+{
+	uint64_t one = 1;
+
+	__sync_synchronize();
+	if (logq.parked && __sync_bool_compare_and_swap(&logq.parked, 1, 0)) {
+		if (write(logq.efd, &one, sizeof(one)) < 0) {
+			fprintf(stderr, "logger wakeup failed: %s\n", strerror(errno));
+		}
+	}
+}
+
+static int fastlog_ring_init(void *data)
+{
+	struct fastlog_ring *ring = data;
+
+	ring->process_id = (long) GETTID();
+	CSS_LIST_LOCK(&fastlog_rings);
+	CSS_LIST_INSERT_TAIL(&fastlog_rings, ring, list);
+	CSS_LIST_UNLOCK(&fastlog_rings);
+
+	return 0;
+}
+
+/* 线程退出时环里可能还有记录, 由日志线程取完后释放 */
+static void fastlog_ring_exit(void *data)
+{
+	struct fastlog_ring *ring = data;
+
+	__sync_synchronize();
+	ring->exited = 1;
+	logq_wake();
+}
+
+CSS_THREADSTORAGE_CUSTOM(fastlog_buf, fastlog_ring_init, fastlog_ring_exit);
+
+/*!
+ * \brief Format the arguments of a record the way printf() would have.
+ *
+ * Every conversion is handed to snprintf() on its own, with the argument
+ * word cast back to the type its length modifier names.
+ */
+static void fastlog_format(char *buf, size_t size, const struct fastlog_record *rec)
+{
+	const char *p = rec->fmt;
+	char spec[32];
+	size_t len = 0, n;
+	int arg = 0, res, wide, half;
+	unsigned long long word;
+
+	while (*p && len < size - 1) {
+		if (*p != '%') {
+			buf[len++] = *p++;
+			continue;
+		}
+		if (p[1] == '%') {
+			buf[len++] = '%';
+			p += 2;
+			continue;
+		}
+
+		/* flags, width and precision, a '*' takes the next word */
+		spec[0] = *p++;
+		n = 1;
+		while (*p && strchr("-+ #0'.123456789*", *p) && n < sizeof(spec) - 24) {
+			if (*p == '*') {
+				word = arg < rec->nargs ? rec->args[arg] : 0;
+				arg++;
+				n += snprintf(spec + n, sizeof(spec) - n, "%d", (int) word);
+				p++;
+			} else {
+				spec[n++] = *p++;
+			}
+		}
+
+		/* length modifiers, replaced by our own */
+		wide = half = 0;
+		while (*p && strchr("hlLqjzt", *p)) {
+			if (*p == 'h') {
+				half++;
+			} else {
+				wide = 1;
+			}
+			p++;
+		}
+		if (!*p) {
+			break;
+		}
+
+		word = arg < rec->nargs ? rec->args[arg] : 0;
+		arg++;
+		switch (*p) {
+		case 'd':
+		case 'i':
+			spec[n++] = 'l';
+			spec[n++] = 'l';
+			spec[n++] = *p;
+			spec[n] = '\0';
+			res = snprintf(buf + len, size - len, spec, wide ? (long long) word :
+				half > 1 ? (long long) (signed char) word :
+				half ? (long long) (short) word : (long long) (int) word);
+			break;
+		case 'u':
+		case 'o':
+		case 'x':
+		case 'X':
+			spec[n++] = 'l';
+			spec[n++] = 'l';
+			spec[n++] = *p;
+			spec[n] = '\0';
+			res = snprintf(buf + len, size - len, spec, wide ? word :
+				half > 1 ? (unsigned long long) (unsigned char) word :
+				half ? (unsigned long long) (unsigned short) word : (unsigned long long) (unsigned int) word);
+			break;
+		case 'c':
+			spec[n++] = 'c';
+			spec[n] = '\0';
+			res = snprintf(buf + len, size - len, spec, (int) word);
+			break;
+		case 's':
+			spec[n++] = 's';
+			spec[n] = '\0';
+			res = snprintf(buf + len, size - len, spec, word ? (const char *) (uintptr_t) word : "(null)");
+			break;
+		case 'p':
+			spec[n++] = 'p';
+			spec[n] = '\0';
+			res = snprintf(buf + len, size - len, spec, (void *) (uintptr_t) word);
+			break;
+		case 'e':
+		case 'E':
+		case 'f':
+		case 'F':
+		case 'g':
+		case 'G':
+		case 'a':
+		case 'A':
+			/* the word holds a truncated value at best, see css_log_fast() */
+			buf[len] = '?';
+			res = 1;
+			break;
+		default:
+			/* %n and unknown conversions print nothing */
+			res = 0;
+			break;
+		}
+		p++;
+		if (res > 0) {
+			len += (size_t) res < size - len ? (size_t) res : size - len - 1;
+		}
+	}
+	buf[len] = '\0';
+}
+
+/*! \brief Render a record into a log message and print it to the channels, \a batch as logger_print_normal() */
+static void fastlog_print(const struct fastlog_record *rec, long process_id, int batch)
+{
+	struct logmsg *logmsg;
+	char message[BUFSIZ];
+	struct timespec mono;
+	struct timeval now;
+	long long ago;
+
+	fastlog_format(message, sizeof(message), rec);
+	if (!(logmsg = css_calloc_with_stringfields(1, struct logmsg, strlen(message) + 128)))
+		return;
+
+	css_string_field_set(logmsg, message, message);
+	logmsg->type = rec->level == __LOG_VERBOSE ? LOGMSG_VERBOSE : LOGMSG_NORMAL;
+
+	/* Place the monotonic timestamp on the wall clock */
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &mono);
+	now = css_tvnow();
+	ago = (long long) (mono.tv_sec - rec->ts.tv_sec) * 1000000 + (mono.tv_nsec - rec->ts.tv_nsec) / 1000;
+	if (ago > 0) {
+		now = css_tvsub(now, css_tv(ago / 1000000, ago % 1000000));
+	}
+	css_string_field_set(logmsg, date, logger_date(&now));
+
+	logmsg->level = rec->level;
+	logmsg->line = rec->line;
+	css_string_field_set(logmsg, level_name, levels[rec->level]);
+	css_string_field_set(logmsg, file, rec->file);
+	css_string_field_set(logmsg, function, rec->function);
+	logmsg->process_id = process_id;
+
+	logger_print_normal(logmsg, batch);
+	css_free(logmsg);
+}
+
+/*!
+ * \brief Render what the threads recorded with css_log_fast(), logger thread only.
+ *
+ * Records are copied out under the ring list lock and printed after it is
+ * dropped, so a thread making its first css_log_fast() call never waits
+ * for the channels.
+ *
+ * \return records rendered
+ */
+static int fastlog_drain(void)
+{
+	static struct {
+		struct fastlog_record rec;
+		long process_id;
+	} batch[FASTLOG_BATCH];
+	struct {
+		long process_id;
+		unsigned int dropped;
+	} drops[8];
+	struct fastlog_ring *ring;
+	unsigned int tail, dropped;
+	time_t now = time(NULL);
+	int count, ndrops, total = 0, i;
+
+	do {
+		count = ndrops = 0;
+		CSS_LIST_LOCK(&fastlog_rings);
+		CSS_LIST_TRAVERSE_SAFE_BEGIN(&fastlog_rings, ring, list) {
+			while (count < FASTLOG_BATCH && (tail = ring->tail) != ring->head) {
+				__sync_synchronize();
+				batch[count].rec = ring->records[tail & (FASTLOG_RING_SIZE - 1)];
+				batch[count].process_id = ring->process_id;
+				count++;
+				__sync_synchronize();
+				ring->tail = tail + 1;
+			}
+			if ((dropped = ring->dropped) != ring->reported && (now != ring->reported_at || ring->exited) &&
+			    ndrops < ARRAY_LEN(drops)) {
+				drops[ndrops].process_id = ring->process_id;
+				drops[ndrops].dropped = dropped - ring->reported;
+				ring->reported = dropped;
+				ring->reported_at = now;
+				ndrops++;
+			}
+			if (ring->exited) {
+				__sync_synchronize();
+				if (ring->tail == ring->head) {
+					CSS_LIST_REMOVE_CURRENT(list);
+					css_free(ring);
+				}
+			}
+		}
+		CSS_LIST_TRAVERSE_SAFE_END;
+		CSS_LIST_UNLOCK(&fastlog_rings);
+
+		for (i = 0; i < count; i++) {
+			fastlog_print(&batch[i].rec, batch[i].process_id, 1);
+		}
+		for (i = 0; i < ndrops; i++) {
+			css_log(LOG_WARNING, "%u fast log message%s of thread %ld dropped, ring full\n",
+				drops[i].dropped, ESS(drops[i].dropped), drops[i].process_id);
+		}
+		total += count;
+	} while (count == FASTLOG_BATCH);
+
+	return total;
+}
+
+static int fastlog_pending(void)
+{
+	struct fastlog_ring *ring;
+	int pending = 0;
+
+	CSS_LIST_LOCK(&fastlog_rings);
+	CSS_LIST_TRAVERSE(&fastlog_rings, ring, list) {
+		if (ring->tail != ring->head || ring->exited) {
+			pending = 1;
+			break;
+		}
+	}
+	CSS_LIST_UNLOCK(&fastlog_rings);
+
+	return pending;
+}
+
+static int flight_ring_init(void *data)
+{
+	struct flight_ring *ring = data;
+
+	ring->process_id = (long) GETTID();
+	CSS_LIST_LOCK(&flight_rings);
+	CSS_LIST_INSERT_TAIL(&flight_rings, ring, list);
+	CSS_LIST_UNLOCK(&flight_rings);
+
+	return 0;
+}
+
+static void flight_ring_exit(void *data)
+{
+	struct flight_ring *ring = data;
+
+	CSS_LIST_LOCK(&flight_rings);
+	CSS_LIST_REMOVE(&flight_rings, ring, list);
+	CSS_LIST_UNLOCK(&flight_rings);
+	css_free(ring);
+}
+
+CSS_THREADSTORAGE_CUSTOM(flight_buf, flight_ring_init, flight_ring_exit);
+
+/*! \brief Claim the next record of the calling thread, flight_end() publishes it */
+static struct flight_record *flight_begin(int level, const char *file, int line, const char *function, const char *fmt)
+{
+	struct flight_ring *ring;
+	struct flight_record *rec;
+
+	if (!(ring = css_threadstorage_get(&flight_buf, sizeof(*ring))))
+		return NULL;
+
+	rec = &ring->records[ring->next++ & (FLIGHT_RING_SIZE - 1)];
+	rec->seq++;
+	FLIGHT_WMB();
+	rec->level = level;
+	rec->file = file;
+	rec->line = line;
+	rec->function = function;
+	rec->fmt = fmt;
+	clock_gettime(CLOCK_REALTIME_COARSE, &rec->ts);
+
+	return rec;
+}
+
+static void flight_end(struct flight_record *rec)
+{
+	FLIGHT_WMB();
+	rec->seq++;
+}
+
+/*! \brief Keep a css_log() message already formatted */
+static void flight_log(int level, const char *file, int line, const char *function, const char *fmt, const char *text)
+{
+	struct flight_record *rec;
+
+	if (!(rec = flight_begin(level, file, line, function, fmt)))
+		return;
+	rec->nargs = FLIGHT_TEXT;
+	css_copy_string(rec->u.text, text, sizeof(rec->u.text));
+	flight_end(rec);
+}
+
+/*!
+ * \brief Keep a css_log() message no channel wants, unformatted.
+ *
+ * Filtered debug messages can be the most frequent of all, so they cost
+ * no more than a css_log_fast() call: the format is kept, the arguments
+ * are not, as their types and lifetimes are unknown here.
+ */
+static void flight_log_format(int level, const char *file, int line, const char *function, const char *fmt)
+{
+	struct flight_record *rec;
+
+	if (!(rec = flight_begin(level, file, line, function, fmt)))
+		return;
+	rec->nargs = FLIGHT_FORMAT;
+	flight_end(rec);
+}
+
+/*! \brief Keep a css_log_fast() message, unformatted */
+static void flight_log_fast(int level, const char *file, int line, const char *function, const char *fmt,
+	int nargs, const unsigned long long *args)
+{
+	struct flight_record *rec;
+
+	if (!(rec = flight_begin(level, file, line, function, fmt)))
+		return;
+	rec->nargs = nargs;
+	memcpy(rec->u.args, args, nargs * sizeof(*args));
+	flight_end(rec);
+}
+
+static void flight_write(int fd, const char *buf, int len)
+{
+	ssize_t res;
+
+	while (len > 0 && ((res = write(fd, buf, len)) > 0 || errno == EINTR)) {
+		if (res > 0) {
+			buf += res;
+			len -= res;
+		}
+	}
+}
+
+/*! \brief Output of flight_dump(), written without stdio so a signal handler can use it */
+struct flight_out {
+	int fd;
+	int len;
+	char last;			/*!< last character put */
+	char buf[BUFSIZ];
+};
+
+static void flight_putc(struct flight_out *out, char c)
+{
+	if (out->len == sizeof(out->buf)) {
+		flight_write(out->fd, out->buf, out->len);
+		out->len = 0;
+	}
+	out->buf[out->len++] = c;
+	out->last = c;
+}
+
+static void flight_puts(struct flight_out *out, const char *s)
+{
+	while (*s)
+		flight_putc(out, *s++);
+}
+
+/*! \brief Put a number in \a base, zero padded to \a width digits */
+static void flight_putnum(struct flight_out *out, unsigned long long n, int negative, int base, int width)
+{
+	char digits[24];
+	int i = 0;
+
+	do {
+		digits[i++] = "0123456789abcdef"[n % base];
+		n /= base;
+	} while (n);
+	while (i < width && i < sizeof(digits))
+		digits[i++] = '0';
+	if (negative)
+		flight_putc(out, '-');
+	while (i)
+		flight_putc(out, digits[--i]);
+}
+
+/*!
+ * \brief Put a css_log_fast() record, signal handler version of fastlog_format().
+ *
+ * Flags, width and precision are skipped, floating point prints "?".
+ */
+static void flight_put_fast(struct flight_out *out, const char *fmt, int nargs, const unsigned long long *args)
+{
+	const char *p = fmt;
+	unsigned long long word;
+	long long value;
+	int arg = 0, wide, half;
+
+	while (*p) {
+		if (*p != '%') {
+			flight_putc(out, *p++);
+			continue;
+		}
+		if (p[1] == '%') {
+			flight_putc(out, '%');
+			p += 2;
+			continue;
+		}
+		for (p++; *p && strchr("-+ #0'.123456789*", *p); p++) {
+			if (*p == '*')
+				arg++;
+		}
+		wide = half = 0;
+		for (; *p && strchr("hlLqjzt", *p); p++) {
+			if (*p == 'h')
+				half++;
+			else
+				wide = 1;
+		}
+		if (!*p)
+			break;
+
+		word = arg < nargs ? args[arg] : 0;
+		arg++;
+		switch (*p) {
+		case 'd':
+		case 'i':
+			value = wide ? (long long) word : half > 1 ? (signed char) word :
+				half ? (short) word : (int) word;
+			flight_putnum(out, value < 0 ? -(unsigned long long) value : value, value < 0, 10, 0);
+			break;
+		case 'u':
+		case 'o':
+		case 'x':
+		case 'X':
+			if (!wide)
+				word = half > 1 ? (unsigned char) word : half ? (unsigned short) word : (unsigned int) word;
+			flight_putnum(out, word, 0, *p == 'u' ? 10 : *p == 'o' ? 8 : 16, 0);
+			break;
+		case 'p':
+			flight_puts(out, "0x");
+			flight_putnum(out, word, 0, 16, 0);
+			break;
+		case 'c':
+			flight_putc(out, (char) word);
+			break;
+		case 's':
+			/* css_log_fast() strings live for good */
+			flight_puts(out, word ? (const char *) (uintptr_t) word : "(null)");
+			break;
+		case 'e':
+		case 'E':
+		case 'f':
+		case 'F':
+		case 'g':
+		case 'G':
+		case 'a':
+		case 'A':
+			flight_putc(out, '?');
+			break;
+		}
+		p++;
+	}
+}
+
+/*!
+ * \brief Write the records of every thread to \a fd, oldest first per thread.
+ *
+ * \param in_signal called from a fatal signal handler: no locks and only
+ * async-signal-safe calls, so no stdio and no time zone conversion, the
+ * date is written in seconds since the epoch
+ * \note Unless \a in_signal the caller holds the flight_rings lock.
+ * \return records written
+ */
+static int flight_dump(int fd, int in_signal)
+{
+	struct flight_ring *ring;
+	struct flight_record *slot, rec;
+	struct fastlog_record fast;
+	struct flight_out out = { .fd = fd };
+	char message[BUFSIZ];
+	unsigned int next, i, seq;
+	struct timeval tv;
+	const char *text;
+	size_t start, end;
+	int count = 0, usec;
+
+	/* a dateformat with %q already shows the sub-second part */
+	usec = in_signal || !logger_date_split(dateformat, &start, &end);
+
+	CSS_LIST_TRAVERSE(&flight_rings, ring, list) {
+		next = ring->next;
+		flight_puts(&out, "--- thread ");
+		flight_putnum(&out, ring->process_id < 0 ? -(unsigned long long) ring->process_id : ring->process_id,
+			ring->process_id < 0, 10, 0);
+		flight_puts(&out, ", last ");
+		flight_putnum(&out, next < FLIGHT_RING_SIZE ? next : FLIGHT_RING_SIZE, 0, 10, 0);
+		flight_puts(&out, " messages\n");
+
+		for (i = next < FLIGHT_RING_SIZE ? 0 : next - FLIGHT_RING_SIZE; i != next; i++) {
+			/* copy the record, skip it if its thread rewrote it meanwhile */
+			slot = &ring->records[i & (FLIGHT_RING_SIZE - 1)];
+			if ((seq = slot->seq) & 1)
+				continue;
+			FLIGHT_RMB();
+			rec = *slot;
+			FLIGHT_RMB();
+			if (slot->seq != seq)
+				continue;
+
+			flight_putc(&out, '[');
+			if (in_signal) {
+				flight_putnum(&out, rec.ts.tv_sec, 0, 10, 0);
+			} else {
+				tv.tv_sec = rec.ts.tv_sec;
+				tv.tv_usec = rec.ts.tv_nsec / 1000;
+				flight_puts(&out, logger_date(&tv));
+			}
+			if (usec) {
+				flight_putc(&out, '.');
+				flight_putnum(&out, rec.ts.tv_nsec / 1000, 0, 10, 6);
+			}
+			flight_puts(&out, "] ");
+			flight_puts(&out, rec.level >= 0 && rec.level < ARRAY_LEN(levels) && levels[rec.level] ?
+				levels[rec.level] : "LEVEL");
+			flight_putc(&out, '[');
+			flight_putnum(&out, ring->process_id < 0 ? -(unsigned long long) ring->process_id : ring->process_id,
+				ring->process_id < 0, 10, 0);
+			flight_puts(&out, "] ");
+			flight_puts(&out, rec.file);
+			flight_putc(&out, ':');
+			flight_putnum(&out, rec.line, 0, 10, 0);
+			flight_putc(&out, ' ');
+			flight_puts(&out, rec.function);
+			flight_puts(&out, ": ");
+
+			if (rec.nargs == FLIGHT_TEXT) {
+				text = rec.u.text;
+				/* verbose messages start with their marker */
+				if (text[0] == 127)
+					text++;
+				flight_puts(&out, text);
+			} else if (rec.nargs == FLIGHT_FORMAT) {
+				flight_puts(&out, rec.fmt);
+			} else if (in_signal) {
+				flight_put_fast(&out, rec.fmt, rec.nargs, rec.u.args);
 			} else {
-				css_cond_wait(&logcond, &logmsgs.lock);
+				memset(&fast, 0, sizeof(fast));
+				fast.fmt = rec.fmt;
+				fast.nargs = rec.nargs;
+				memcpy(fast.args, rec.u.args, rec.nargs * sizeof(*fast.args));
+				fastlog_format(message, sizeof(message), &fast);
+				flight_puts(&out, message);
 			}
+			if (out.last != '\n')
+				flight_putc(&out, '\n');
+			count++;
 		}
-		next = CSS_LIST_FIRST(&logmsgs);
-		CSS_LIST_HEAD_INIT_NOLOCK(&logmsgs);
-		CSS_LIST_UNLOCK(&logmsgs);
+	}
+	flight_write(fd, out.buf, out.len);
+
+	return count;
+}
+
+/*! \brief Fatal signal: dump the flight recorder, then die the way the signal meant to */
+static void flight_fatal_handler(int sig)
+{
+	int fd;
+
+	if ((fd = open(flight_crash_file, O_WRONLY | O_CREAT | O_TRUNC, 0644)) > -1) {
+		flight_dump(fd, 1);
+		close(fd);
+	}
+	/* the handler was reset to the default, raise again for the core dump */
+	raise(sig);
+}
 
-		/* Otherwise go through and process each message in the order added */
-		while ((msg = next)) {
-			/* Get the next entry now so that we can free our current structure later */
-			next = CSS_LIST_NEXT(msg, list);
+static struct sigaction handle_fatal = {
+	.sa_handler = flight_fatal_handler,
+	.sa_flags = SA_RESETHAND | SA_NODEFER,
+};
+
+static const int fatal_signals[] = { SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT };
 
+static char *handle_logger_dump_flight(struct css_cli_entry *e, int cmd, struct css_cli_args *a)
+{
+	char filename[PATH_MAX];
+	int fd, count;
+
+	switch (cmd) {
+	case CLI_INIT:
+		e->command = "logger dump flight";
+		e->usage =
+			"Usage: logger dump flight [<file>]\n"
+			"       Writes the last messages of every thread, at every level\n"
+			"       and whether logged anywhere or not, to <file> (default\n"
+			"       flight-<time>.log in the log directory).\n";
+		return NULL;
+	case CLI_GENERATE:
+		return NULL;
+	}
+
+	if (a->argc > 4)
+		return CLI_SHOWUSAGE;
+	if (a->argc == 4) {
+		css_copy_string(filename, a->argv[3], sizeof(filename));
+	} else {
+		snprintf(filename, sizeof(filename), "%s/flight-%ld.log", css_config_CSS_LOG_DIR, (long) time(NULL));
+	}
+
+	if ((fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+		css_cli(a->fd, "Unable to open %s: %s\n", filename, strerror(errno));
+		return CLI_FAILURE;
+	}
+	CSS_LIST_LOCK(&flight_rings);
+	count = flight_dump(fd, 0);
+	CSS_LIST_UNLOCK(&flight_rings);
+	close(fd);
+
+	css_cli(a->fd, "Wrote %d message%s to %s\n", count, ESS(count), filename);
+
+	return CLI_SUCCESS;
+}
+
+/*! \brief Actual logging thread */
+static void *logger_thread(void *data)
+{
+	struct logmsg *msg = NULL;
+	struct pollfd pfd = { .fd = logq.efd, .events = POLLIN };
+	uint64_t count;
+	int busy, n, timeout;
+
+	for (;;) {
+		/* Process the messages in the order added, a bounded batch at a time */
+		for (n = 0; n < LOGGER_BATCH_MAX && (msg = logq_pop(&busy)); n++) {
 			/* Depending on the type, send it to the proper function */
-			logger_print_normal(msg);
+			logger_print_normal(msg, 1);
 
 			/* Free the data since we are done */
 			css_free(msg);
 		}
+		n += fastlog_drain();
 
+		/* One writev() per file channel for the whole batch */
+		timeout = logger_flush_batch(0);
+		if (n) {
+			continue;
+		}
+		if (busy) {
+			/* a producer was preempted between its swap and its link */
+			sched_yield();
+			continue;
+		}
+
+		/* Announce the park, then look again: a producer queueing after the check sees parked */
+		logq.parked = 1;
+		__sync_synchronize();
+		if (!logq_empty() || fastlog_pending()) {
+			logq.parked = 0;
+			continue;
+		}
 		/* If we should stop, then stop */
 		if (close_logger_thread)
 			break;
+		/* Sleep until woken, or until the waiting lines are due */
+		if ((poll(&pfd, 1, timeout) < 0 && errno != EINTR) ||
+		    ((pfd.revents & POLLIN) && read(logq.efd, &count, sizeof(count)) < 0 && errno != EINTR)) {
+			fprintf(stderr, "logger wait failed: %s\n", strerror(errno));
+			break;
+		}
+		logq.parked = 0;
 	}
 
+	logger_flush_batch(1);
+
 	return NULL;
 }
 
@@ -1104,13 +2221,25 @@ static void logger_queue_init(void)
 
 int init_logger(void)
 {
+	int i;
+
 	/* auto rotate if sig SIGXFSZ comes a-knockin */
 	sigaction(SIGXFSZ, &handle_SIGXFSZ, NULL);
 
+	/* leave the recent messages behind when we crash */
+	snprintf(flight_crash_file, sizeof(flight_crash_file), "%s/flight-crash-%ld.log",
+		css_config_CSS_LOG_DIR, (long) getpid());
+	for (i = 0; i < ARRAY_LEN(fatal_signals); i++) {
+		sigaction(fatal_signals[i], &handle_fatal, NULL);
+	}
+
 	/* start logger thread */
-	css_cond_init(&logcond, NULL);
+	if ((logq.efd = eventfd(0, 0)) < 0) {
+		return -1;
+	}
 	if (css_pthread_create(&logthread, NULL, logger_thread, NULL) < 0) {
-		css_cond_destroy(&logcond);
+		close(logq.efd);
+		logq.efd = -1;
 		return -1;
 	}
 
@@ -1132,14 +2261,17 @@ void close_logger(void)
 
 	logger_initialized = 0;
 
-	/* Stop logger thread */
-	CSS_LIST_LOCK(&logmsgs);
+	/* Stop logger thread, it drains the queue first */
 	close_logger_thread = 1;
-	css_cond_signal(&logcond);
-	CSS_LIST_UNLOCK(&logmsgs);
+	if (logthread != CSS_PTHREADT_NULL) {
+		uint64_t one = 1;
 
-	if (logthread != CSS_PTHREADT_NULL)
+		__sync_synchronize();
+		if (write(logq.efd, &one, sizeof(one)) < 0) {
+			fprintf(stderr, "logger wakeup failed: %s\n", strerror(errno));
+		}
 		pthread_join(logthread, NULL);
+	}
 
 	CSS_RWLIST_WRLOCK(&logchannels);
 
@@ -1169,11 +2301,9 @@ void css_log(int level, const char *file, int line, const char *function, const
 {
 	struct logmsg *logmsg = NULL;
 	struct css_str *buf = NULL;
-	struct css_tm tm;
 	struct timeval now = css_tvnow();
 	int res = 0;
 	va_list ap;
-	char datestring[256];
 
 	if (!(buf = css_str_thread_get(&log_buf, LOG_BUF_INIT_SIZE)))
 		return;
@@ -1188,6 +2318,7 @@ void css_log(int level, const char *file, int line, const char *function, const
 		result = css_str_set_va(&buf, BUFSIZ, fmt, ap); /* XXX BUFSIZ ? */
 		va_end(ap);
 		if (result != CSS_DYNSTR_BUILD_FAILED) {
+			flight_log(level, file, line, function, fmt, css_str_buffer(buf));
 			term_filter_escapes(css_str_buffer(buf));
 			fputs(css_str_buffer(buf), stdout);
 		}
@@ -1199,13 +2330,14 @@ void css_log(int level, const char *file, int line, const char *function, const
 	   is zero, if option_verbose is non-zero (this allows for 'level zero'
 	   LOG_DEBUG messages to be displayed, if the logmask on any channel
 	   allows it)
+	   The flight recorder keeps them all the same.
 	*/
-	if (!option_verbose && !option_debug && (level == __LOG_DEBUG))
-		return;
-
-	/* Ignore anything that never gets logged anywhere */
-	if (level != __LOG_VERBOSE && !(global_logmask & (1 << level)))
+	if ((!option_verbose && !option_debug && (level == __LOG_DEBUG)) ||
+	    /* Ignore anything that never gets logged anywhere */
+	    (level != __LOG_VERBOSE && !(global_logmask & (1 << level)))) {
+		flight_log_format(level, file, line, function, fmt);
 		return;
+	}
 	
 	/* Build string */
 	va_start(ap, fmt);
@@ -1216,6 +2348,8 @@ void css_log(int level, const char *file, int line, const char *function, const
 	if (res == CSS_DYNSTR_BUILD_FAILED)
 		return;
 
+	flight_log(level, file, line, function, fmt, css_str_buffer(buf));
+
 	/* Create a new logging message */
 	if (!(logmsg = css_calloc_with_stringfields(1, struct logmsg, res + 128)))
 		return;
@@ -1231,9 +2365,7 @@ void css_log(int level, const char *file, int line, const char *function, const
 	}
 
 	/* Create our date/time */
-	css_localtime(&now, &tm, NULL);
-	css_strftime(datestring, sizeof(datestring), dateformat, &tm);
-	css_string_field_set(logmsg, date, datestring);
+	css_string_field_set(logmsg, date, logger_date(&now));
 
 	/* Copy over data */
 	logmsg->level = level;
@@ -1245,18 +2377,70 @@ void css_log(int level, const char *file, int line, const char *function, const
         
 	/* If the logger thread is active, append it to the tail end of the list - otherwise skip that step */
 	if (logthread != CSS_PTHREADT_NULL) {
-		CSS_LIST_LOCK(&logmsgs);
-		CSS_LIST_INSERT_TAIL(&logmsgs, logmsg, list);
-		css_cond_signal(&logcond);
-		CSS_LIST_UNLOCK(&logmsgs);
+		logq_push(logmsg);
+		logq_wake();
 	} else {
-		logger_print_normal(logmsg);
+		logger_print_normal(logmsg, 0);
 		css_free(logmsg);
 	}
 
 	return;
 }
 
+void __css_log_fast(int level, const char *file, int line, const char *function, const char *fmt, int nargs, ...)
+{
+	unsigned long long args[CSS_LOG_FAST_ARGS];
+	struct fastlog_ring *ring;
+	struct fastlog_record *rec;
+	unsigned int head;
+	va_list ap;
+	int i;
+
+	va_start(ap, nargs);
+	for (i = 0; i < nargs && i < CSS_LOG_FAST_ARGS; i++) {
+		args[i] = va_arg(ap, unsigned long long);
+	}
+	va_end(ap);
+	nargs = i;
+
+	flight_log_fast(level, file, line, function, fmt, nargs, args);
+
+	/* Same filtering as css_log() */
+	if (!option_verbose && !option_debug && (level == __LOG_DEBUG))
+		return;
+	if (level != __LOG_VERBOSE && !(global_logmask & (1 << level)))
+		return;
+
+	if (!(ring = css_threadstorage_get(&fastlog_buf, sizeof(*ring))))
+		return;
+
+	head = ring->head;
+	if (head - ring->tail >= FASTLOG_RING_SIZE) {
+		ring->dropped++;
+		return;
+	}
+	rec = &ring->records[head & (FASTLOG_RING_SIZE - 1)];
+	rec->fmt = fmt;
+	rec->file = file;
+	rec->function = function;
+	rec->line = line;
+	rec->level = level;
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &rec->ts);
+	memcpy(rec->args, args, nargs * sizeof(*args));
+	rec->nargs = nargs;
+
+	/* Without the logger thread there is no one to defer to */
+	if (logthread == CSS_PTHREADT_NULL) {
+		fastlog_print(rec, ring->process_id, 0);
+		return;
+	}
+
+	/* the record is complete before the logger thread can see it */
+	__sync_synchronize();
+	ring->head = head + 1;
+	logq_wake();
+}
+
 #ifdef HAVE_BKTR
 
 struct css_bt *css_bt_create(void) 
@@ -1477,13 +2661,11 @@ void __css_verbose_ap(const char *file, int line, const char *func, const char *
 
 	if (css_opt_timestamp) {
 		struct timeval now;
-		struct css_tm tm;
 		char date[40];
 		char *datefmt;
 
 		now = css_tvnow();
-		css_localtime(&now, &tm, NULL);
-		css_strftime(date, sizeof(date), dateformat, &tm);
+		css_copy_string(date, logger_date(&now), sizeof(date));
 		datefmt = alloca(strlen(date) + 3 + strlen(fmt) + 1);
 		sprintf(datefmt, "%c[%s] %s", 127, date, fmt);
 		fmt = datefmt;
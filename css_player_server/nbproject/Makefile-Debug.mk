@@ -37,7 +37,12 @@ OBJECTDIR=${CND_BUILDDIR}/${CND_CONF}/${CND_PLATFORM}
 OBJECTFILES= \
 	${OBJECTDIR}/main/cli.o \
 	${OBJECTDIR}/main/config.o \
+	${OBJECTDIR}/main/css_gmp.o \
+	${OBJECTDIR}/main/css_h264.o \
 	${OBJECTDIR}/main/css_monitor.o \
+	${OBJECTDIR}/main/css_recorder.o \
+	${OBJECTDIR}/main/css_segment.o \
+	${OBJECTDIR}/main/css_vod.o \
 	${OBJECTDIR}/main/cssmm.o \
 	${OBJECTDIR}/main/cssobj2.o \
 	${OBJECTDIR}/main/cssplayer.o \
@@ -55,9 +60,19 @@ OBJECTFILES= \
 	${OBJECTDIR}/main/threadstorage.o \
 	${OBJECTDIR}/main/utils.o
 
+# Benchmark Object Files, the server without its main()
+BENCHOBJECTFILES= \
+	$(filter-out ${OBJECTDIR}/main/cssplayer.o,${OBJECTFILES}) \
+	${OBJECTDIR}/tools/gmp_bench.o
+
+# Test Object Files
+TESTOBJECTFILES= \
+	$(filter-out ${OBJECTDIR}/main/cssplayer.o,${OBJECTFILES}) \
+	${OBJECTDIR}/tools/recorder_test.o
+
 
 # C Compiler Flags
-CFLAGS=-Wall -lm -g -L/usr/pkg/lib -levent -lrt -lpthread -lcrypto -ledit
+CFLAGS=-Wall -lm -g -L/usr/pkg/lib -levent -levent_pthreads -lrt -lpthread -lcrypto -ledit
 
 # CC Compiler Flags
 CCFLAGS=
@@ -75,11 +90,21 @@ LDLIBSOPTIONS=
 # Build Targets
 .build-conf: ${BUILD_SUBPROJECTS}
 	"${MAKE}"  -f nbproject/Makefile-${CND_CONF}.mk ${CND_DISTDIR}/${CND_CONF}/${CND_PLATFORM}/css_player_server
+	"${MAKE}"  -f nbproject/Makefile-${CND_CONF}.mk ${CND_DISTDIR}/${CND_CONF}/${CND_PLATFORM}/gmp_bench
+	"${MAKE}"  -f nbproject/Makefile-${CND_CONF}.mk ${CND_DISTDIR}/${CND_CONF}/${CND_PLATFORM}/recorder_test
 
 ${CND_DISTDIR}/${CND_CONF}/${CND_PLATFORM}/css_player_server: ${OBJECTFILES}
 	${MKDIR} -p ${CND_DISTDIR}/${CND_CONF}/${CND_PLATFORM}
 	${LINK.c} -o ${CND_DISTDIR}/${CND_CONF}/${CND_PLATFORM}/css_player_server ${OBJECTFILES} ${LDLIBSOPTIONS}
 
+${CND_DISTDIR}/${CND_CONF}/${CND_PLATFORM}/gmp_bench: ${BENCHOBJECTFILES}
+	${MKDIR} -p ${CND_DISTDIR}/${CND_CONF}/${CND_PLATFORM}
+	${LINK.c} -o ${CND_DISTDIR}/${CND_CONF}/${CND_PLATFORM}/gmp_bench ${BENCHOBJECTFILES} ${LDLIBSOPTIONS} -Wl,--wrap=malloc -Wl,--wrap=calloc -Wl,--wrap=realloc
+
+${CND_DISTDIR}/${CND_CONF}/${CND_PLATFORM}/recorder_test: ${TESTOBJECTFILES}
+	${MKDIR} -p ${CND_DISTDIR}/${CND_CONF}/${CND_PLATFORM}
+	${LINK.c} -o ${CND_DISTDIR}/${CND_CONF}/${CND_PLATFORM}/recorder_test ${TESTOBJECTFILES} ${LDLIBSOPTIONS}
+
 ${OBJECTDIR}/include/css_monitor.h.gch: include/css_monitor.h 
 	${MKDIR} -p ${OBJECTDIR}/include
 	${RM} "$@.d"
@@ -95,11 +120,36 @@ ${OBJECTDIR}/main/config.o: main/config.c
 	${RM} "$@.d"
 	$(COMPILE.c) -g -Iinclude -Iinclude -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/main/config.o main/config.c
 
+${OBJECTDIR}/main/css_gmp.o: main/css_gmp.c 
+	${MKDIR} -p ${OBJECTDIR}/main
+	${RM} "$@.d"
+	$(COMPILE.c) -g -Iinclude -Iinclude -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/main/css_gmp.o main/css_gmp.c
+
+${OBJECTDIR}/main/css_h264.o: main/css_h264.c 
+	${MKDIR} -p ${OBJECTDIR}/main
+	${RM} "$@.d"
+	$(COMPILE.c) -g -Iinclude -Iinclude -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/main/css_h264.o main/css_h264.c
+
 ${OBJECTDIR}/main/css_monitor.o: main/css_monitor.c 
 	${MKDIR} -p ${OBJECTDIR}/main
 	${RM} "$@.d"
 	$(COMPILE.c) -g -Iinclude -Iinclude -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/main/css_monitor.o main/css_monitor.c
 
+${OBJECTDIR}/main/css_recorder.o: main/css_recorder.c 
+	${MKDIR} -p ${OBJECTDIR}/main
+	${RM} "$@.d"
+	$(COMPILE.c) -g -Iinclude -Iinclude -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/main/css_recorder.o main/css_recorder.c
+
+${OBJECTDIR}/main/css_segment.o: main/css_segment.c 
+	${MKDIR} -p ${OBJECTDIR}/main
+	${RM} "$@.d"
+	$(COMPILE.c) -g -Iinclude -Iinclude -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/main/css_segment.o main/css_segment.c
+
+${OBJECTDIR}/main/css_vod.o: main/css_vod.c 
+	${MKDIR} -p ${OBJECTDIR}/main
+	${RM} "$@.d"
+	$(COMPILE.c) -g -Iinclude -Iinclude -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/main/css_vod.o main/css_vod.c
+
 ${OBJECTDIR}/main/cssmm.o: main/cssmm.c 
 	${MKDIR} -p ${OBJECTDIR}/main
 	${RM} "$@.d"
@@ -180,6 +230,16 @@ ${OBJECTDIR}/main/utils.o: main/utils.c
 	${RM} "$@.d"
 	$(COMPILE.c) -g -Iinclude -Iinclude -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/main/utils.o main/utils.c
 
+${OBJECTDIR}/tools/gmp_bench.o: tools/gmp_bench.c 
+	${MKDIR} -p ${OBJECTDIR}/tools
+	${RM} "$@.d"
+	$(COMPILE.c) -g -Iinclude -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/tools/gmp_bench.o tools/gmp_bench.c
+
+${OBJECTDIR}/tools/recorder_test.o: tools/recorder_test.c 
+	${MKDIR} -p ${OBJECTDIR}/tools
+	${RM} "$@.d"
+	$(COMPILE.c) -g -Iinclude -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/tools/recorder_test.o tools/recorder_test.c
+
 # Subprojects
 .build-subprojects:
 
@@ -187,6 +247,8 @@ ${OBJECTDIR}/main/utils.o: main/utils.c
 .clean-conf: ${CLEAN_SUBPROJECTS}
 	${RM} -r ${CND_BUILDDIR}/${CND_CONF}
 	${RM} ${CND_DISTDIR}/${CND_CONF}/${CND_PLATFORM}/css_player_server
+	${RM} ${CND_DISTDIR}/${CND_CONF}/${CND_PLATFORM}/gmp_bench
+	${RM} ${CND_DISTDIR}/${CND_CONF}/${CND_PLATFORM}/recorder_test
 
 # Subprojects
 .clean-subprojects:
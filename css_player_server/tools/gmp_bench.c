@@ -0,0 +1,416 @@
+/*
+ * File:   gmp_bench.c
+ * Author: root
+ *
+ * Offline benchmark of the GMP ingest pipeline.
+ *
+ * Loads a capture of GMP datagrams (a normal or sort recording), replays
+ * it with synthetic loss, reordering and duplication through the same
+ * reorder, assembly and recording code the server runs, and reports
+ * throughput, allocations and whether the sort recordings came out in
+ * sequence order.
+ *
+ * Linked with the server objects except cssplayer.o, and with malloc(),
+ * calloc() and realloc() wrapped (-Wl,--wrap) to count the allocations
+ * the server code makes.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <endian.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <getopt.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <arpa/inet.h>
+
+#include "cssplayer.h"
+#include "options.h"
+#include "logger.h"
+#include "utils.h"
+#include "unaligned.h"
+#include "css_gmp.h"
+#include "css_monitor.h"
+
+#define BENCH_SOURCE_PORT 5004 //回放数据包的源端口
+#define BENCH_DEFAULT_DEPTH 8
+#define BENCH_DEFAULT_TIMEOUT 1000
+
+/* cssplayer.c 提供的全局符号, 本程序没有控制台 */
+struct css_flags css_options;
+
+void css_console_puts_mutable(const char *string, int level)
+{
+    fputs(string, stderr);
+}
+
+void css_console_toggle_loglevel(int fd, int level, int state)
+{
+}
+
+void css_console_toggle_mute(int fd, int silent)
+{
+}
+
+//服务端代码的内存分配次数
+static volatile unsigned long bench_allocs;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+    __sync_fetch_and_add(&bench_allocs, 1);
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size)
+{
+    __sync_fetch_and_add(&bench_allocs, 1);
+    return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    __sync_fetch_and_add(&bench_allocs, 1);
+    return __real_realloc(ptr, size);
+}
+
+/*! \brief A datagram of the capture */
+struct bench_dgram {
+    const unsigned char *data;
+    size_t len;
+};
+
+/*! \brief One delivery of the replay schedule */
+struct bench_event {
+    uint64_t key;               /*!< delivery position, reordered packages later */
+    uint32_t index;             /*!< datagram */
+    uint32_t round;
+};
+
+static uint32_t bench_seed = 2463534242U;
+
+static uint32_t bench_rand(void)
+{
+    bench_seed ^= bench_seed << 13;
+    bench_seed ^= bench_seed >> 17;
+    bench_seed ^= bench_seed << 5;
+    return bench_seed;
+}
+
+//命中概率, 以百分比给出
+static int bench_hit(double percent)
+{
+    return percent > 0 && bench_rand() % 1000000 < percent * 10000;
+}
+
+static int bench_event_cmp(const void *a, const void *b)
+{
+    const struct bench_event *x = a, *y = b;
+
+    if (x->key != y->key) {
+        return x->key < y->key ? -1 : 1;
+    }
+    return 0;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "Usage: %s [options] <capture>\n"
+            "  Replay a capture of GMP datagrams (normal or sort recording)\n"
+            "  through the ingest pipeline.\n"
+            "  -l <percent>  drop this share of datagrams (0)\n"
+            "  -r <percent>  deliver this share late (0)\n"
+            "  -d <n>        by at most n datagrams (%d)\n"
+            "  -u <percent>  deliver this share twice (0)\n"
+            "  -n <rounds>   replay the capture this many times, sequence\n"
+            "                numbers continued (1)\n"
+            "  -t <ms>       reorder_timeout (%d)\n"
+            "  -s <seed>     random seed\n"
+            "  -o <dir>      write the recordings here, must hold no sort\n"
+            "                recording (a new directory under /tmp)\n",
+            name, BENCH_DEFAULT_DEPTH, BENCH_DEFAULT_TIMEOUT);
+}
+
+/*!
+ * \brief Split a capture into datagrams by their announced length.
+ * \return datagrams found, -1 on failure
+ */
+static int bench_load(const unsigned char *map, size_t maplen, struct bench_dgram **dgrams)
+{
+    struct css_gmp_header hdr;
+    struct bench_dgram *list = NULL, *tmp;
+    size_t pos = 0;
+    int count = 0, alloc = 0, res;
+
+    while (pos < maplen) {
+        res = css_gmp_parse(map + pos, maplen - pos, &hdr);
+        if (res == CSS_GMP_PARSE_SHORT || res == CSS_GMP_PARSE_TRUNCATED || res == CSS_GMP_PARSE_LENGTH) {
+            //长度不可信, 无法继续切分
+            if (pos < maplen) {
+                fprintf(stderr, "capture: %zu bytes after offset %zu do not split (%s)\n",
+                        maplen - pos, pos, css_gmp_parse_str(res));
+            }
+            break;
+        }
+        if (count == alloc) {
+            alloc = alloc ? alloc * 2 : 4096;
+            if (!(tmp = realloc(list, alloc * sizeof(*list)))) {
+                free(list);
+                return -1;
+            }
+            list = tmp;
+        }
+        list[count].data = map + pos;
+        list[count].len = hdr.length;
+        count++;
+        pos += hdr.length;
+    }
+
+    *dgrams = list;
+
+    return count;
+}
+
+/*!
+ * \brief Check that a sort recording holds packages in sequence order.
+ *
+ * \param packages set to the packages in the file
+ * \return packages that do not follow the one before them
+ */
+static unsigned int bench_check_sort(const char *filename, unsigned int *packages, unsigned int *gaps)
+{
+    struct css_gmp_header hdr;
+    unsigned char *map;
+    struct stat st;
+    size_t pos = 0;
+    unsigned int bad = 0, last = 0, step;
+    int fd;
+
+    *packages = 0;
+    if ((fd = open(filename, O_RDONLY)) < 0 || fstat(fd, &st) || !st.st_size) {
+        if (fd > -1) {
+            close(fd);
+        }
+        return 0;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return 0;
+    }
+
+    while (css_gmp_parse(map + pos, st.st_size - pos, &hdr) != CSS_GMP_PARSE_SHORT && hdr.length >= CSS_GMP_HEADER_LEN &&
+           hdr.length <= st.st_size - pos) {
+        //每个包必须在前一个之后, 相同或回退都是排序错误
+        if ((*packages)++) {
+            step = (hdr.seq - last + CSS_GMP_SEQ_MAX) % CSS_GMP_SEQ_MAX;
+            if (!step || step >= CSS_GMP_SEQ_MAX / 2) {
+                bad++;
+            } else if (step > 1) {
+                (*gaps)++;
+            }
+        }
+        last = hdr.seq;
+        pos += hdr.length;
+    }
+    munmap(map, st.st_size);
+
+    return bad;
+}
+
+int main(int argc, char *argv[])
+{
+    double loss = 0, reorder = 0, dup = 0;
+    int depth = BENCH_DEFAULT_DEPTH, rounds = 1, timeout = BENCH_DEFAULT_TIMEOUT;
+    char outdir[PATH_MAX] = "", filename[PATH_MAX + 256];
+    struct bench_dgram *dgrams;
+    struct bench_event *events;
+    struct css_monitor_replay_stats stats;
+    struct sockaddr_in from;
+    struct timeval start, end;
+    struct stat st;
+    unsigned char *map, buf[2048];
+    unsigned int span, seq, first_seq, last_seq, packages, gaps = 0, bad = 0, written = 0, files = 0;
+    unsigned long allocs;
+    uint64_t total, count = 0, dropped = 0, duplicated = 0, reordered = 0, i;
+    double secs;
+    DIR *dir;
+    struct dirent *de;
+    int opt, fd, n, r;
+
+    while ((opt = getopt(argc, argv, "l:r:d:u:n:t:s:o:h")) != -1) {
+        switch (opt) {
+        case 'l':
+            loss = atof(optarg);
+            break;
+        case 'r':
+            reorder = atof(optarg);
+            break;
+        case 'd':
+            depth = atoi(optarg);
+            break;
+        case 'u':
+            dup = atof(optarg);
+            break;
+        case 'n':
+            rounds = atoi(optarg);
+            break;
+        case 't':
+            timeout = atoi(optarg);
+            break;
+        case 's':
+            bench_seed = strtoul(optarg, NULL, 0) | 1;
+            break;
+        case 'o':
+            css_copy_string(outdir, optarg, sizeof(outdir));
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (optind != argc - 1 || depth < 1 || rounds < 1 || timeout < 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if ((fd = open(argv[optind], O_RDONLY)) < 0 || fstat(fd, &st) || !st.st_size) {
+        fprintf(stderr, "can not read %s: %s\n", argv[optind], fd < 0 ? strerror(errno) : "empty");
+        return 1;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED || (n = bench_load(map, st.st_size, &dgrams)) < 0) {
+        fprintf(stderr, "can not load %s\n", argv[optind]);
+        return 1;
+    }
+    if (!n) {
+        fprintf(stderr, "%s holds no GMP datagram\n", argv[optind]);
+        return 1;
+    }
+
+    //每轮接着上一轮的包号, 一轮跨越的包号数
+    first_seq = le32toh(get_unaligned_uint32(dgrams[0].data + 11)) % CSS_GMP_SEQ_MAX;
+    last_seq = le32toh(get_unaligned_uint32(dgrams[n - 1].data + 11)) % CSS_GMP_SEQ_MAX;
+    span = (last_seq - first_seq + CSS_GMP_SEQ_MAX) % CSS_GMP_SEQ_MAX + 1;
+
+    //生成投递顺序: 丢弃, 推后, 重复
+    total = (uint64_t) n * rounds;
+    if (!(events = malloc(sizeof(*events) * total * (dup > 0 ? 2 : 1)))) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    for (r = 0; r < rounds; r++) {
+        for (i = 0; i < n; i++) {
+            uint64_t pos = ((uint64_t) r * n + i) * 2;
+
+            if (bench_hit(loss)) {
+                dropped++;
+                continue;
+            }
+            events[count].index = i;
+            events[count].round = r;
+            events[count].key = pos;
+            if (bench_hit(reorder)) {
+                events[count].key += 2 * (1 + bench_rand() % depth) + 1;
+                reordered++;
+            }
+            count++;
+            if (bench_hit(dup)) {
+                events[count] = events[count - 1];
+                events[count].key = pos + 2 * (1 + bench_rand() % depth) + 1;
+                duplicated++;
+                count++;
+            }
+        }
+    }
+    qsort(events, count, sizeof(*events), bench_event_cmp);
+
+    if (!*outdir) {
+        css_copy_string(outdir, "/tmp/gmp_bench.XXXXXX", sizeof(outdir));
+        if (!mkdtemp(outdir)) {
+            fprintf(stderr, "can not create %s: %s\n", outdir, strerror(errno));
+            return 1;
+        }
+    } else if ((dir = opendir(outdir))) {
+        while ((de = readdir(dir))) {
+            if (!strncmp(de->d_name, "sort-", 5)) {
+                fprintf(stderr, "%s already holds sort recordings\n", outdir);
+                return 1;
+            }
+        }
+        closedir(dir);
+    } else {
+        fprintf(stderr, "can not open %s: %s\n", outdir, strerror(errno));
+        return 1;
+    }
+
+    memset(&from, 0, sizeof(from));
+    from.sin_family = AF_INET;
+    from.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    from.sin_port = htons(BENCH_SOURCE_PORT);
+
+    if (css_monitor_replay_start(outdir, timeout)) {
+        fprintf(stderr, "replay start failed\n");
+        return 1;
+    }
+
+    printf("%d datagrams x %d round%s: %llu delivered, %llu dropped, %llu late by up to %d, %llu duplicated\n",
+            n, rounds, rounds == 1 ? "" : "s", (unsigned long long) count, (unsigned long long) dropped,
+            (unsigned long long) reordered, depth, (unsigned long long) duplicated);
+
+    allocs = bench_allocs;
+    gettimeofday(&start, NULL);
+    for (i = 0; i < count; i++) {
+        const struct bench_dgram *d = &dgrams[events[i].index];
+        size_t len = d->len < sizeof(buf) ? d->len : sizeof(buf);
+
+        memcpy(buf, d->data, len);
+        if (len >= CSS_GMP_HEADER_LEN) {
+            seq = le32toh(get_unaligned_uint32(buf + 11));
+            put_unaligned_uint32(buf + 11, htole32((seq + (uint64_t) events[i].round * span) % CSS_GMP_SEQ_MAX));
+        }
+        css_monitor_replay_feed(&from, buf, len);
+    }
+    gettimeofday(&end, NULL);
+    allocs = bench_allocs - allocs;
+    css_monitor_replay_stop(&stats);
+
+    secs = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+    printf("%.3f s, %.0f packets/s, %.1f ns/packet, %lu allocation%s (%.3f per packet)\n",
+            secs, secs > 0 ? count / secs : 0, count ? secs * 1e9 / count : 0,
+            allocs, allocs == 1 ? "" : "s", count ? (double) allocs / count : 0);
+    printf("%u stream%s: %llu packets out, %llu gaps (%llu lost), %llu duplicates, %llu late, %llu frames, %llu frames dropped\n",
+            stats.streams, stats.streams == 1 ? "" : "s", (unsigned long long) stats.packets,
+            (unsigned long long) stats.gaps, (unsigned long long) stats.lost, (unsigned long long) stats.dups,
+            (unsigned long long) stats.late, (unsigned long long) stats.frames, (unsigned long long) stats.frames_dropped);
+
+    //检查排序录制
+    if ((dir = opendir(outdir))) {
+        while ((de = readdir(dir))) {
+            if (strncmp(de->d_name, "sort-", 5)) {
+                continue;
+            }
+            snprintf(filename, sizeof(filename), "%s/%s", outdir, de->d_name);
+            bad += bench_check_sort(filename, &packages, &gaps);
+            written += packages;
+            files++;
+        }
+        closedir(dir);
+    }
+    printf("%u sort recording%s in %s: %u packages, %u gaps, %u out of order: %s\n",
+            files, files == 1 ? "" : "s", outdir, written, gaps, bad,
+            !bad && written == stats.packets ? "ordering OK" : "ordering BROKEN");
+
+    return !bad && written == stats.packets ? 0 : 2;
+}
@@ -0,0 +1,284 @@
+/*
+ * File:   recorder_test.c
+ * Author: root
+ *
+ * Test of the asynchronous recording writer with many sinks per producer.
+ *
+ * Opens a lot of sinks on a single producer queue, as an ingest worker
+ * does with many streams, appends small records to all of them in turn
+ * with a periodic flush, closes them and checks every file holds exactly
+ * the records written to it.  A write the recorder refuses is retried
+ * after a pause; a sink that never gets a chunk fails the test.  With -D
+ * every sink must still be open with O_DIRECT when it is closed.
+ *
+ * Linked with the server objects except cssplayer.o.
+ */
+
+#define _GNU_SOURCE /* O_DIRECT */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <dirent.h>
+#include <fcntl.h>
+
+#include "cssplayer.h"
+#include "options.h"
+#include "logger.h"
+#include "utils.h"
+#include "css_recorder.h"
+
+#define TEST_DEFAULT_SINKS 256
+#define TEST_DEFAULT_CHUNKS 4
+#define TEST_DEFAULT_ROUNDS 200
+#define TEST_DEFAULT_FLUSH 10
+#define TEST_RECORD_LEN 61 //不整除页大小, 块不会恰好写满
+#define TEST_RETRY_MAX 2000 //每次重试等 1ms
+#define TEST_SETTLE_US 100000 //关闭前等写线程写完已排队的块
+
+/* cssplayer.c 提供的全局符号, 本程序没有控制台 */
+struct css_flags css_options;
+
+void css_console_puts_mutable(const char *string, int level)
+{
+    fputs(string, stderr);
+}
+
+void css_console_toggle_loglevel(int fd, int level, int state)
+{
+}
+
+void css_console_toggle_mute(int fd, int silent)
+{
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  Write to many recorder sinks through one producer queue and\n"
+            "  check what reaches the files.\n"
+            "  -n <sinks>    sinks open at once (%d)\n"
+            "  -c <chunks>   chunks in flight per producer (%d)\n"
+            "  -k <KB>       chunk size, rounded up to the page size (4)\n"
+            "  -r <rounds>   records written to every sink (%d)\n"
+            "  -f <rounds>   flush every sink after this many rounds,\n"
+            "                0 never (%d)\n"
+            "  -D            open the sinks with O_DIRECT\n"
+            "  -o <dir>      write the files here (a new directory under /tmp)\n",
+            name, TEST_DEFAULT_SINKS, TEST_DEFAULT_CHUNKS, TEST_DEFAULT_ROUNDS, TEST_DEFAULT_FLUSH);
+}
+
+static void test_record(char *buf, int sink, int round)
+{
+    int i;
+
+    for (i = 0; i < TEST_RECORD_LEN; i++) {
+        buf[i] = (char) (sink * 31 + round * 7 + i);
+    }
+}
+
+/*!
+ * \brief Check a file holds \a rounds records of \a sink in order.
+ * \return 0 if it does
+ */
+static int test_check(const char *filename, int sink, int rounds)
+{
+    char want[TEST_RECORD_LEN], got[TEST_RECORD_LEN];
+    FILE *f;
+    int r, res = 0;
+
+    if (!(f = fopen(filename, "r"))) {
+        fprintf(stderr, "can not open %s: %s\n", filename, strerror(errno));
+        return -1;
+    }
+    for (r = 0; r < rounds; r++) {
+        test_record(want, sink, r);
+        if (fread(got, 1, sizeof(got), f) != sizeof(got) || memcmp(want, got, sizeof(got))) {
+            fprintf(stderr, "%s: record %d is missing or wrong\n", filename, r);
+            res = -1;
+            break;
+        }
+    }
+    if (!res && fread(got, 1, 1, f)) {
+        fprintf(stderr, "%s: trailing bytes after %d records\n", filename, rounds);
+        res = -1;
+    }
+    fclose(f);
+
+    return res;
+}
+
+/*!
+ * \brief Count the sink files of \a outdir this process has open without O_DIRECT.
+ *
+ * The sinks are opaque, their descriptors are found through /proc.
+ *
+ * \return the count, -1 if /proc can not be read
+ */
+static int test_direct(const char *outdir, int *found)
+{
+    char path[PATH_MAX], target[PATH_MAX], prefix[PATH_MAX + 8], line[64];
+    struct dirent *de;
+    unsigned int flags;
+    int buffered = 0;
+    ssize_t len;
+    DIR *dir;
+    FILE *f;
+
+    snprintf(prefix, sizeof(prefix), "%s/sink-", outdir);
+    if (!(dir = opendir("/proc/self/fd"))) {
+        return -1;
+    }
+    *found = 0;
+    while ((de = readdir(dir))) {
+        snprintf(path, sizeof(path), "/proc/self/fd/%s", de->d_name);
+        if ((len = readlink(path, target, sizeof(target) - 1)) < 0) {
+            continue;
+        }
+        target[len] = '\0';
+        if (strncmp(target, prefix, strlen(prefix))) {
+            continue;
+        }
+        (*found)++;
+        snprintf(path, sizeof(path), "/proc/self/fdinfo/%s", de->d_name);
+        if (!(f = fopen(path, "r"))) {
+            continue;
+        }
+        while (fgets(line, sizeof(line), f)) {
+            if (sscanf(line, "flags: %o", &flags) == 1 && !(flags & O_DIRECT)) {
+                buffered++;
+            }
+        }
+        fclose(f);
+    }
+    closedir(dir);
+
+    return buffered;
+}
+
+int main(int argc, char *argv[])
+{
+    int nsinks = TEST_DEFAULT_SINKS, chunks = TEST_DEFAULT_CHUNKS, chunk = 4;
+    int rounds = TEST_DEFAULT_ROUNDS, flush = TEST_DEFAULT_FLUSH;
+    unsigned int flags = 0;
+    char outdir[PATH_MAX] = "", filename[PATH_MAX + 32], buf[TEST_RECORD_LEN];
+    struct css_recorder *rec;
+    struct css_recorder_sink **sinks;
+    unsigned long retries = 0;
+    off_t start;
+    size_t done;
+    int opt, i, r, n, buffered, found, bad = 0;
+
+    while ((opt = getopt(argc, argv, "n:c:k:r:f:Do:h")) != -1) {
+        switch (opt) {
+        case 'n':
+            nsinks = atoi(optarg);
+            break;
+        case 'c':
+            chunks = atoi(optarg);
+            break;
+        case 'k':
+            chunk = atoi(optarg);
+            break;
+        case 'r':
+            rounds = atoi(optarg);
+            break;
+        case 'f':
+            flush = atoi(optarg);
+            break;
+        case 'D':
+            flags |= CSS_RECORDER_DIRECT;
+            break;
+        case 'o':
+            css_copy_string(outdir, optarg, sizeof(outdir));
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (optind != argc || nsinks < 1 || chunks < 1 || chunk < 1 || rounds < 1 || flush < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (!*outdir) {
+        css_copy_string(outdir, "/tmp/recorder_test.XXXXXX", sizeof(outdir));
+        if (!mkdtemp(outdir)) {
+            fprintf(stderr, "can not create %s: %s\n", outdir, strerror(errno));
+            return 1;
+        }
+    }
+
+    if (!(sinks = calloc(nsinks, sizeof(*sinks)))) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    if (!(rec = css_recorder_start(1, chunk * 1024, chunks, 0, flags))) {
+        fprintf(stderr, "recorder start failed\n");
+        return 1;
+    }
+    for (i = 0; i < nsinks; i++) {
+        snprintf(filename, sizeof(filename), "%s/sink-%d", outdir, i);
+        if (!(sinks[i] = css_recorder_open(rec, 0, filename))) {
+            fprintf(stderr, "can not open %s\n", filename);
+            return 1;
+        }
+    }
+
+    //写失败时可能已收下一部分 (O_DIRECT 的记录会跨块), 只重试其余部分
+    for (r = 0; r < rounds && !bad; r++) {
+        for (i = 0; i < nsinks && !bad; i++) {
+            test_record(buf, i, r);
+            start = css_recorder_tell(sinks[i]);
+            for (n = 0, done = 0; css_recorder_write(sinks[i], buf + done, sizeof(buf) - done); n++) {
+                if (n == TEST_RETRY_MAX) {
+                    fprintf(stderr, "sink %d got no chunk in round %d\n", i, r);
+                    bad = 1;
+                    break;
+                }
+                retries++;
+                usleep(1000);
+                done = css_recorder_tell(sinks[i]) - start;
+            }
+        }
+        if (flush && !((r + 1) % flush)) {
+            for (i = 0; i < nsinks; i++) {
+                css_recorder_flush(sinks[i]);
+            }
+        }
+    }
+
+    //只有关闭时排队的尾块可以不是整块
+    if ((flags & CSS_RECORDER_DIRECT) && !bad) {
+        usleep(TEST_SETTLE_US);
+        if ((buffered = test_direct(outdir, &found)) < 0) {
+            fprintf(stderr, "can not read /proc/self/fd\n");
+            bad = 1;
+        } else if (buffered || found != nsinks) {
+            fprintf(stderr, "%d of %d sinks found open, %d without O_DIRECT\n", found, nsinks, buffered);
+            bad = 1;
+        }
+    }
+
+    for (i = 0; i < nsinks; i++) {
+        css_recorder_close(sinks[i]);
+    }
+    css_recorder_stop(rec);
+    free(sinks);
+
+    for (i = 0; i < nsinks && !bad; i++) {
+        snprintf(filename, sizeof(filename), "%s/sink-%d", outdir, i);
+        bad = test_check(filename, i, rounds) ? 1 : 0;
+    }
+
+    printf("%d sinks x %d records of %d bytes, %d chunks in flight, %lu retries in %s: %s\n",
+            nsinks, rounds, TEST_RECORD_LEN, chunks, retries, outdir, bad ? "FAILED" : "OK");
+
+    return bad ? 2 : 0;
+}